@@ -0,0 +1,95 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Config protocol - batched commands from the host over the vendor defined HID interface, to read and change the
+ * key map, macros and settings and to query the firmware state. Changes take effect right away and are stored in
+ * the flash store, which commits them once the matrix is idle.
+ *
+ * A request report holds commands back to back, each an id, the length of its arguments and the arguments, ended by
+ * CONFIG_CMD_END or the end of the report. The response report holds, for each command, its id, a status, the
+ * length of its result and the result. A command whose result does not fit into the rest of the response is not
+ * run, and neither are the ones behind it - the host sends them again in a new request. A read asking for more than
+ * a whole response holds is refused as invalid. Values are little endian.
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <stdint.h>
+
+#define CONFIG_PROTOCOL_VERSION 1
+
+// flash store address of the settings, one byte each, 0xFF for the default
+#define CONFIG_SETTINGS_FLASH_STORE_ADDR 944
+
+enum config_command {
+    CONFIG_CMD_END = 0x00,
+    CONFIG_CMD_GET_INFO = 0x01,        // -> protocol version, layers, rows, columns, macro store size (16 bits)
+    CONFIG_CMD_GET_STATE = 0x02,       // -> active layers, flags, time (32 bits), event queue and report overflows
+                                       //    (32 bits each)
+    CONFIG_CMD_GET_KEYMAP = 0x03,      // layer, row, column, count -> count actions (16 bits each) along the row
+    CONFIG_CMD_SET_KEYMAP = 0x04,      // layer, row, column, actions (16 bits each) along the row
+    CONFIG_CMD_RESET_KEYMAP = 0x05,    // back to the built in layers
+    CONFIG_CMD_GET_MACROS = 0x06,      // offset (16 bits), count -> count bytes of the macros in use
+    CONFIG_CMD_SET_MACROS = 0x07,      // offset (16 bits), bytes - stored, in use after CONFIG_CMD_LOAD_MACROS
+    CONFIG_CMD_LOAD_MACROS = 0x08,     // start using the stored macros, fails if they are invalid
+    CONFIG_CMD_GET_SETTING = 0x09,     // setting -> value
+    CONFIG_CMD_SET_SETTING = 0x0a,     // setting, value
+    CONFIG_CMD_FLUSH = 0x0b,           // commit everything to flash right away
+    CONFIG_CMD_GET_LATENCY = 0x0c,     // probe -> count (32 bits), min, average, max (16 bits each, us), see latency.h
+    CONFIG_CMD_GET_LATENCY_HISTOGRAM = 0x0d,  // probe -> LATENCY_NUM_BUCKETS counts (16 bits each)
+    CONFIG_CMD_RESET_LATENCY = 0x0e,   // start the latency probes over
+    CONFIG_CMD_GET_TRACE = 0x0f,       // sequence number (32 bits), count -> sequence number of the first event
+                                       //    returned (32 bits), up to count events (8 bytes each), see trace.h
+    CONFIG_CMD_CLEAR_TRACE = 0x10,     // drop the traced events and start the sequence numbers over
+};
+
+enum config_status {
+    CONFIG_STATUS_OK = 0x00,
+    CONFIG_STATUS_UNKNOWN_COMMAND = 0x01,
+    CONFIG_STATUS_INVALID = 0x02,
+};
+
+// flags of CONFIG_CMD_GET_STATE
+#define CONFIG_STATE_MACRO_PLAYING 0x01
+#define CONFIG_STATE_FLASH_BUSY 0x02
+
+enum config_setting {
+    CONFIG_SETTING_DEBOUNCE_MODE = 0x00,  // enum debounce_mode
+    CONFIG_SETTING_DEBOUNCE_TIME = 0x01,  // ms
+    CONFIG_SETTING_TAP_HOLD_MODE = 0x02,  // enum keyboard_tap_hold_mode
+    CONFIG_SETTING_TAPPING_TERM = 0x03,   // 10 ms steps, at least one
+    CONFIG_SETTING_LED_BRIGHTNESS = 0x04, // 0 (off) to 254, default LED_DEFAULT_BRIGHTNESS
+};
+
+#define CONFIG_NUM_SETTINGS 5
+
+// apply the stored settings, call after keyboard_init()
+void config_init(void);
+
+// answer a pending request from the host, called from the main loop
+void config_poll(void);
+
+#endif  // _CONFIG_H
@@ -0,0 +1,60 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Debounce - filters switch chatter out of the raw matrix state, one row at a time.
+ *
+ * DEBOUNCE_EAGER reports presses on the first scan that sees them and releases once the key has read released for
+ * the debounce time. A released key ignores presses for the debounce time so that release bounce cannot register.
+ * DEBOUNCE_DEFERRED reports both presses and releases once the key has been stable for the debounce time.
+ * DEBOUNCE_ROW reports a whole row once none of its keys have changed for the debounce time.
+ */
+
+#ifndef _DEBOUNCE_H
+#define _DEBOUNCE_H
+
+#include <stdint.h>
+
+enum debounce_mode {
+    DEBOUNCE_EAGER,
+    DEBOUNCE_DEFERRED,
+    DEBOUNCE_ROW,
+};
+
+#ifndef DEBOUNCE_DEFAULT_MODE
+#define DEBOUNCE_DEFAULT_MODE DEBOUNCE_EAGER
+#endif
+
+#ifndef DEBOUNCE_DEFAULT_TIME_MS
+#define DEBOUNCE_DEFAULT_TIME_MS 5
+#endif
+
+void debounce_init(enum debounce_mode mode, uint8_t debounce_ms);
+
+// change the mode and time without losing the state of the keys, not to be interrupted by debounce_row()
+void debounce_set(enum debounce_mode mode, uint8_t debounce_ms);
+
+uint16_t debounce_row(uint16_t row, uint16_t raw_cols, uint8_t elapsed_ms);
+
+#endif  // _DEBOUNCE_H
@@ -0,0 +1,59 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Single producer, single consumer queue of key events. The scan (SysTick interrupt) pushes the debounced key
+ * changes, the main loop pops them and turns them into reports - neither side ever blocks or disables interrupts.
+ */
+
+#ifndef _EVENT_QUEUE_H
+#define _EVENT_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// must be a power of two
+#define EVENT_QUEUE_SIZE 32
+
+struct key_event {
+    uint32_t time_ms;  // scan time the change was seen at
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+};
+
+void event_queue_init(void);
+
+// producer side, returns false (and leaves the queue untouched) if the queue is full
+bool event_queue_push(const struct key_event *event);
+
+// consumer side, returns false if the queue is empty
+bool event_queue_pop(struct key_event *event);
+
+bool event_queue_empty(void);
+
+// number of pushes rejected because the queue was full
+uint32_t event_queue_overflows(void);
+
+#endif  // _EVENT_QUEUE_H
@@ -23,7 +23,18 @@
  */
 
 /**
- * Flash store - allows storage of arbitrary values in the last page of the flash.
+ * Flash store - allows storage of arbitrary values in the last pages of the flash.
+ *
+ * The store is an append-only log of records, each holding the new contents of one address range of a
+ * FLASH_STORE_SIZE byte address space. A read overlays the valid records from oldest to newest, so the newest write
+ * of every byte wins and bytes never written read as 0xFF. The pages are split into two banks: when the active bank
+ * fills up, the current contents are compacted into the other one and the old bank is erased. A small write costs a
+ * few half-word programs, and the pages are only erased once per bank's worth of writes.
+ *
+ * Writes are not programmed right away: they wait in RAM (reads already see them) until the main loop commits them
+ * with flash_store_step() while the matrix is idle. A commit is split into steps of at most one page erase or one
+ * record, so scanning and USB are serviced in between. The records of a batch only count once the commit marker
+ * behind them is written, so a commit cut short by a power loss leaves the previous contents.
  */
 
 #ifndef _FLASH_STORE_H
@@ -32,9 +43,37 @@
 #define FLASH_NUM_PAGES 32
 #define FLASH_PAGE_SIZE 1024
 
+// pages at the end of the flash used by the store (kept out of the rom region of the linker script), an even
+// number of at least two
+#ifndef FLASH_STORE_NUM_PAGES
+#define FLASH_STORE_NUM_PAGES 4
+#endif
+
+// size of the address space seen through flash_store_read() and flash_store_write()
+#define FLASH_STORE_SIZE 1024
+
+// RAM for writes waiting to be committed, a write that does not fit commits the waiting ones first
+#ifndef FLASH_STORE_PENDING_SIZE
+#define FLASH_STORE_PENDING_SIZE 128
+#endif
+
+#include <stdbool.h>
 #include <stdint.h>
 
-void flash_store_write(uint16_t addr, void *data, uint16_t size);
+// find the active bank and the end of its log, call once before using the store
+void flash_store_init(void);
+
+// returns false if the range is invalid or too large to be batched, the data is committed later
+bool flash_store_write(uint16_t addr, const void *data, uint16_t size);
+// true if a write of size bytes can wait for the next commit, rather than committing the waiting ones right away
+bool flash_store_has_room(uint16_t size);
 void flash_store_read(uint16_t addr, void *data, uint16_t size);
 
+// do the next step of committing the waiting writes, returns false if there was nothing left to do
+bool flash_store_step(void);
+// commit all waiting writes right away
+void flash_store_flush(void);
+// true while writes wait to be committed
+bool flash_store_busy(void);
+
 #endif  // _FLASH_STORE_H
@@ -25,10 +25,101 @@
 #ifndef _KEYBOARD_H
 #define _KEYBOARD_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debounce.h"
+
+// scan period, which is also the interval the host polls the keyboard at - 2 (500Hz) or 1 (1000Hz)
+#ifndef KEYBOARD_POLL_INTERVAL_MS
 #define KEYBOARD_POLL_INTERVAL_MS 2
+#endif
+
+#if (KEYBOARD_POLL_INTERVAL_MS != 1) && (KEYBOARD_POLL_INTERVAL_MS != 2)
+#error "KEYBOARD_POLL_INTERVAL_MS must be 1 or 2"
+#endif
+
+// the USB start of frame locks the scan on to land this long before each frame the host polls the keyboard in,
+// leaving the main loop time to have the report waiting in the endpoint
+#ifndef KEYBOARD_SOF_LEAD_US
+#define KEYBOARD_SOF_LEAD_US 250
+#endif
+
+// scanning stops after the matrix has been idle this long, until the next key press
+#ifndef KEYBOARD_IDLE_TIMEOUT_MS
+#define KEYBOARD_IDLE_TIMEOUT_MS 2000
+#endif
+
+// config changes are committed to flash once the matrix has been idle this long
+#ifndef KEYBOARD_COMMIT_IDLE_MS
+#define KEYBOARD_COMMIT_IDLE_MS 500
+#endif
+
+// a dual-role key still down after this long counts as held
+#ifndef KEYBOARD_TAPPING_TERM_MS
+#define KEYBOARD_TAPPING_TERM_MS 200
+#endif
+
+// key events held back while a dual-role key is undecided - once full, the key counts as held
+#ifndef KEYBOARD_TAP_HOLD_MAX_DEFERRED
+#define KEYBOARD_TAP_HOLD_MAX_DEFERRED 4
+#endif
+
+// how a dual-role key gets decided before its tapping term is over - its release always makes it a tap
+enum keyboard_tap_hold_mode {
+    KEYBOARD_TAP_HOLD_TERM = 0x00,        // only by the tapping term
+    KEYBOARD_TAP_HOLD_PERMISSIVE = 0x01,  // held once another key is pressed and released while it is down
+    KEYBOARD_TAP_HOLD_INTERRUPT = 0x02,   // held as soon as another key is pressed while it is down
+};
+
+#ifndef KEYBOARD_TAP_HOLD_DEFAULT_MODE
+#define KEYBOARD_TAP_HOLD_DEFAULT_MODE KEYBOARD_TAP_HOLD_PERMISSIVE
+#endif
+
+#define NUM_ROWS (uint16_t)7
+#define NUM_COLS (uint16_t)16
 
 void keyboard_init(void);
 
+// scan the matrix and queue the key changes, called from the SysTick interrupt every KEYBOARD_POLL_INTERVAL_MS
+void keyboard_scan(void);
+
+// start of a frame the host polls the keyboard in, called from the USB interrupt while scanning - moves the next
+// scan periods so they end up KEYBOARD_SOF_LEAD_US ahead of the frames
+void keyboard_sof(void);
+
+// turn the queued key changes into reports and update the LEDs, called from the main loop
 void keyboard_poll(void);
 
+// true if keyboard_poll() has something to do
+bool keyboard_has_work(void);
+
+// true once the matrix has been idle for KEYBOARD_IDLE_TIMEOUT_MS
+bool keyboard_can_sleep(void);
+
+// true once the matrix has been idle for KEYBOARD_COMMIT_IDLE_MS
+bool keyboard_can_commit(void);
+
+// the key map changed, rebuild the effective map
+void keyboard_keymap_changed(void);
+
+// layers currently active, one bit each
+uint8_t keyboard_get_layers(void);
+
+// time of the last scan
+uint32_t keyboard_get_time_ms(void);
+
+// change the debounce mode and time on the fly
+void keyboard_set_debounce(enum debounce_mode mode, uint8_t debounce_ms);
+
+// change how dual-role keys are decided, from the main loop
+void keyboard_set_tap_hold(enum keyboard_tap_hold_mode mode, uint16_t tapping_term_ms);
+
+// stop the scan tick and arm the wake up on a key press, call with interrupts masked right before sleeping -
+// returns false (and keeps scanning) if a key went down in the meantime
+bool keyboard_sleep(void);
+
+// resume scanning after a sleep, whatever interrupt ended it
+void keyboard_wake(void);
+
 #endif  // _KEYBOARD_H
@@ -0,0 +1,111 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Key map - a stack of layers, each mapping (row, column) to a 16-bit action: the action type in the upper byte and
+ * its argument (key code, modifier mask or layer) in the lower one. Layer 0 is always active, and an entry of a
+ * higher active layer overrides the ones below it unless it is transparent.
+ *
+ * Dual-role keys send their key code when tapped and act as modifiers or a momentary layer key when held. What they
+ * do when held is packed into the type, which makes them take up ranges of types.
+ *
+ * The layers are kept in RAM. They start out as the built in ones, and once an entry has been changed all of them
+ * are stored in the flash store and loaded from there on the next boot. The first change only starts copying the
+ * layers: the main loop hands them to the flash store a row at a time with keymap_step(), as fast as it commits them,
+ * so a change never holds up typing with a long commit.
+ */
+
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "keyboard.h"
+
+// layers in keymap_layers, up to 8
+#define KEYMAP_NUM_LAYERS 3
+
+#if KEYMAP_NUM_LAYERS > 8
+#error "at most 8 layers are supported"
+#endif
+
+enum keymap_action_type {
+    KEYMAP_ACTION_KEY = 0x00,              // key code, KEY_NONE for no key
+    KEYMAP_ACTION_MODIFIER = 0x01,         // modifier mask
+    KEYMAP_ACTION_LAYER_MOMENTARY = 0x02,  // layer active while the key is held
+    KEYMAP_ACTION_LAYER_TOGGLE = 0x03,     // layer switched on or off with every press
+    KEYMAP_ACTION_LAYER_ONE_SHOT = 0x04,   // layer active for the next key press
+    KEYMAP_ACTION_MACRO = 0x05,            // macro played when the key is pressed
+    KEYMAP_ACTION_MOD_TAP = 0x20,          // 0x20 to 0x3f: key code on tap, modifiers on hold, see MT()
+    KEYMAP_ACTION_LAYER_TAP = 0x40,        // 0x40 to 0x47: key code on tap, momentary layer on hold, see LT()
+};
+
+#define KEYMAP_ACTION(type, arg) (uint16_t)(((type) << 8) | (arg))
+#define KEYMAP_ACTION_TYPE(action) (uint8_t)((action) >> 8)
+#define KEYMAP_ACTION_ARG(action) (uint8_t)((action) & 0xff)
+
+// the modifiers of a mod-tap key are Ctrl, Shift, Alt and Meta in bits 0 to 3 of the type, of the right hand if bit
+// 4 is set - a mask with modifiers of both hands keeps the right hand ones
+#define KEYMAP_ACTION_IS_MOD_TAP(action) ((KEYMAP_ACTION_TYPE(action) & 0xe0) == KEYMAP_ACTION_MOD_TAP)
+#define KEYMAP_ACTION_IS_LAYER_TAP(action) ((KEYMAP_ACTION_TYPE(action) & 0xf8) == KEYMAP_ACTION_LAYER_TAP)
+#define KEYMAP_MOD_TAP_MASK(action) (uint8_t)((KEYMAP_ACTION_TYPE(action) & 0x0f) \
+    << ((KEYMAP_ACTION_TYPE(action) & 0x10) ? 4 : 0))
+#define KEYMAP_LAYER_TAP_LAYER(action) (uint8_t)(KEYMAP_ACTION_TYPE(action) & 0x07)
+
+// falls through to the next active layer below
+#define KEYMAP_TRANSPARENT 0xffff
+
+// shorthands for the layer tables, plain key codes are actions of their own
+#define MOD(mask) KEYMAP_ACTION(KEYMAP_ACTION_MODIFIER, mask)
+#define MO(layer) KEYMAP_ACTION(KEYMAP_ACTION_LAYER_MOMENTARY, layer)
+#define TG(layer) KEYMAP_ACTION(KEYMAP_ACTION_LAYER_TOGGLE, layer)
+#define OSL(layer) KEYMAP_ACTION(KEYMAP_ACTION_LAYER_ONE_SHOT, layer)
+#define MACRO(index) KEYMAP_ACTION(KEYMAP_ACTION_MACRO, index)
+#define MT(mask, key) KEYMAP_ACTION(KEYMAP_ACTION_MOD_TAP | (((mask) & 0xf0) ? 0x10 | ((mask) >> 4) : (mask)), key)
+#define LT(layer, key) KEYMAP_ACTION(KEYMAP_ACTION_LAYER_TAP | (layer), key)
+#define ___ KEYMAP_TRANSPARENT
+
+// a marker and the layers, behind the macros - the layers are stored little endian, in layer, row, column order
+#define KEYMAP_FLASH_STORE_ADDR 256
+#define KEYMAP_STORE_MAGIC 0x4d4b  // "KM"
+#define KEYMAP_STORE_LAYERS_ADDR (KEYMAP_FLASH_STORE_ADDR + 2)
+
+// 224 bytes of RAM per layer, and as much of the flash store
+extern uint16_t keymap_layers[KEYMAP_NUM_LAYERS][NUM_ROWS][NUM_COLS];
+
+// load the stored layers, the built in ones if there are none
+void keymap_init(void);
+
+// change an entry and store the layers, returns false if it is out of range or could not be stored (the entry is
+// left as it was then)
+bool keymap_set(uint8_t layer, uint8_t row, uint8_t col, uint16_t action);
+
+// continue copying the layers into the flash store after the first change, called from the main loop
+void keymap_step(void);
+
+// go back to the built in layers
+void keymap_reset(void);
+
+#endif  // _KEYMAP_H
@@ -0,0 +1,86 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Latency probes - count, min, max, average and a histogram of how long each stage between a key change and its
+ * report reaching the host takes, kept all the time and read back over the config interface. The M0 has no cycle
+ * counter, so timestamps come from the SysTick counter, at 1/6 us resolution, and the results are in us.
+ *
+ * A stage probe takes latency_start() at its beginning and hands it to latency_end() at its end, which only works for
+ * spans shorter than a scan period. The end-to-end probe runs from the scan that saw a key change to the host taking
+ * the report that carries it, on the scan clock.
+ *
+ * Each probe is recorded from one context only (the SysTick interrupt, the USB interrupt or the main loop). Building
+ * with LATENCY_PROBES=0 leaves the probes out.
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdint.h>
+
+#ifndef LATENCY_PROBES
+#define LATENCY_PROBES 1
+#endif
+
+enum latency_probe {
+    LATENCY_PROBE_SCAN = 0x00,        // keyboard_scan(), in the SysTick interrupt
+    LATENCY_PROBE_POLL = 0x01,        // keyboard_poll()
+    LATENCY_PROBE_REPORT = 0x02,      // building a report from the pressed keys
+    LATENCY_PROBE_SEND = 0x03,        // queueing a report for the endpoint
+    LATENCY_PROBE_USB_ISR = 0x04,     // the USB interrupt, callbacks included
+    LATENCY_PROBE_END_TO_END = 0x05,  // key change scanned to its report taken by the host
+    LATENCY_NUM_PROBES,
+};
+
+// bucket 0 counts spans below 2 us, bucket n the ones from 2^n up to 2^(n + 1) us, the last one all longer ones too
+#define LATENCY_NUM_BUCKETS 14
+
+struct latency_stats {
+    uint32_t count;
+    uint16_t min_us;
+    uint16_t max_us;  // spans saturate at 0xffff us
+    uint64_t total_us;
+    uint16_t histogram[LATENCY_NUM_BUCKETS];  // saturating
+};
+
+#if LATENCY_PROBES
+uint32_t latency_start(void);
+void latency_end(enum latency_probe probe, uint32_t start);
+void latency_record(enum latency_probe probe, uint32_t span_us);
+#else
+#define latency_start() 0
+#define latency_end(probe, start) ((void)(start))
+#define latency_record(probe, span_us) ((void)(span_us))
+#endif
+
+// scan clock in us, with the time since the last scan from the SysTick counter - also there without the probes
+uint32_t latency_now_us(void);
+
+void latency_reset(void);
+
+// consistent copy of the stats of a probe, from the main loop
+void latency_get(enum latency_probe probe, struct latency_stats *stats);
+
+#endif  // _LATENCY_H
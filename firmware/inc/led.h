@@ -0,0 +1,59 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Lock LEDs - Num, Caps and Scroll Lock on PA7-PA9, driven by timer PWM so they can be dimmed. The outputs only
+ * change when the host sends a new LED state or the brightness changes, nothing touches them in between.
+ *
+ * Effects, like the self test at power up, step from the timer's update interrupt, which is only on while one runs.
+ */
+
+#ifndef _LED_H
+#define _LED_H
+
+#include <stdint.h>
+
+// LED bits as in the HID output report from the host
+#define LED_NUM_LOCK 0x01
+#define LED_CAPS_LOCK 0x02
+#define LED_SCROLL_LOCK 0x04
+#define LED_ALL (LED_NUM_LOCK | LED_CAPS_LOCK | LED_SCROLL_LOCK)
+
+// 0 is off, 255 full on - steps in between are gamma corrected
+#ifndef LED_DEFAULT_BRIGHTNESS
+#define LED_DEFAULT_BRIGHTNESS 255
+#endif
+
+// every LED lights up for this long after power up
+#define LED_SELF_TEST_PERIOD_MS 1000
+
+// start the timers with the self test running
+void led_init(void);
+
+// show the host's LED state (LED_* bits), right away or once the running effect is over
+void led_set(uint8_t leds);
+
+void led_set_brightness(uint8_t brightness);
+
+#endif  // _LED_H
@@ -0,0 +1,92 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Macros - stored sequences of key presses, releases and delays, played back one report at a time.
+ *
+ * The sequences are stored back to back in the flash store, each ended by MACRO_END, and kept in RAM for playback.
+ * Most steps are a single byte, so text costs a byte per character (two for shifted ones):
+ *
+ *   key code                  tap the key (press it, release it with the next report)
+ *   MACRO_SHIFT, key code     tap the key with Shift held
+ *   MACRO_PRESS, key code     press the key and keep it down, modifiers as usages 0xE0 to 0xE7
+ *   MACRO_RELEASE, key code   release it again
+ *   MACRO_DELAY, ms           wait before the next step
+ *
+ * The macro keys are reported on top of the keys the user is holding. A tap of a different key with the same Shift
+ * state goes out in the same report as the release of the previous one, so text plays back at about one character
+ * per report.
+ */
+
+#ifndef _MACRO_H
+#define _MACRO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "usb_hid.h"
+
+#define NUM_MACROS 4
+
+// flash store space for all sequences, also the RAM kept for them
+#ifndef MACRO_STORE_SIZE
+#define MACRO_STORE_SIZE 256
+#endif
+
+#define MACRO_FLASH_STORE_ADDR 0
+
+// step codes, outside the range of key codes
+#define MACRO_END 0x00
+#define MACRO_PRESS 0xf0
+#define MACRO_RELEASE 0xf1
+#define MACRO_SHIFT 0xf2
+#define MACRO_DELAY 0xf3
+
+// load the sequences from the flash store, the defaults if there are none
+void macro_init(void);
+
+// store part of the sequences without using them yet
+bool macro_write(uint16_t offset, const uint8_t *data, uint16_t size);
+
+// start using the stored sequences, returns false (and keeps the ones in use) if they are invalid
+bool macro_load(void);
+
+// the MACRO_STORE_SIZE bytes of sequences in use
+const uint8_t *macro_get_data(void);
+
+// start playing a macro, a macro still playing is cut short
+void macro_play(uint8_t index);
+
+bool macro_playing(void);
+
+// true if macro_step() has a step to play at the given time
+bool macro_ready(uint32_t time_ms);
+
+// play steps up to the next change of the macro keys, returns true if they changed - call once per report sent
+bool macro_step(uint32_t time_ms);
+
+// keys held by the macro, to be merged into the report
+const struct usb_hid_nkro_report *macro_get_keys(void);
+
+#endif  // _MACRO_H
@@ -0,0 +1,62 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Key matrix - drives the rows and samples the columns, producing one snapshot of the whole matrix per scan.
+ *
+ * By default the CPU strobes the rows itself. With MATRIX_SCAN_DMA set, TIM3 and two DMA channels scan the matrix
+ * continuously at MATRIX_DMA_SCAN_RATE_HZ without any CPU involvement, and matrix_scan() only copies out the last
+ * complete frame.
+ *
+ * While the keyboard is idle, matrix_sleep() stops scanning and drives every row, so that a key press raises an
+ * EXTI edge on its column and wakes the core.
+ */
+
+#ifndef _MATRIX_H
+#define _MATRIX_H
+
+#include "keyboard.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef MATRIX_SCAN_DMA
+#define MATRIX_SCAN_DMA 0
+#endif
+
+#ifndef MATRIX_DMA_SCAN_RATE_HZ
+#define MATRIX_DMA_SCAN_RATE_HZ 8000
+#endif
+
+void matrix_init(void);
+
+void matrix_scan(uint16_t matrix[NUM_ROWS]);
+
+// stop scanning and arm the wake up on the columns, returns false (still scanning) if a key is already down
+bool matrix_sleep(void);
+
+// disarm the wake up and resume scanning
+void matrix_wake(void);
+
+#endif  // _MATRIX_H
@@ -0,0 +1,53 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Code run from SRAM. Flash needs a wait state at 48MHz and the M0 has no cache, so every instruction fetched from
+ * it - and every taken branch, which throws away the prefetch - costs extra cycles. The linker script puts the
+ * .ramfunc section in with the initialised data, which reset_handler copies to RAM before main().
+ *
+ * RAM is 6K including the stack, so only the paths that run on every scan and every pass of the main loop go there.
+ * The link fails if they leave less than the reserved stack space (see stm32f070c6-cm3.ld).
+ */
+
+#ifndef _RAMFUNC_H
+#define _RAMFUNC_H
+
+// 0 keeps everything in flash, for a build whose RAM is needed elsewhere
+#ifndef RAMFUNC_ENABLED
+#define RAMFUNC_ENABLED 1
+#endif
+
+#if RAMFUNC_ENABLED
+// noinline: a RAM function inlined into a caller in flash would run from flash after all
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+// keeps a helper of a RAM function in flash, GCC would otherwise inline a static function with a single caller and
+// take it to RAM with it - for the paths that only run on a key change
+#define FLASHFUNC __attribute__((noinline))
+
+#endif  // _RAMFUNC_H
@@ -0,0 +1,90 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Trace - a ring buffer of compact, timestamped events for reconstructing what happened between the matrix and the
+ * host: raw and debounced matrix changes, reports queued and taken by the host, LED state set by the host and queue
+ * overflows. Recording one costs a handful of instructions with interrupts masked, so the trace is always on, also
+ * in the scan interrupt. Once the buffer is full, each new event replaces the oldest one.
+ *
+ * Every event gets a sequence number, counting up from 0 since the last trace_clear(). The host reads the buffer in
+ * chunks over the config interface, starting from the sequence number it has read up to - a jump in the numbers it
+ * gets back means events were overwritten before it got to them. Building with TRACE_EVENTS=0 leaves the trace out.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 1
+#endif
+
+// number of events kept, must be a power of two
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 128
+#endif
+
+enum trace_event {
+    TRACE_EVENT_MATRIX = 0x01,         // raw state of a row changed: row, columns read
+    TRACE_EVENT_KEY_DOWN = 0x02,       // debounced key press passed on to the main loop: row, column
+    TRACE_EVENT_KEY_UP = 0x03,         // debounced key release passed on to the main loop: row, column
+    TRACE_EVENT_REPORT = 0x04,         // report queued for the host: length, report number
+    TRACE_EVENT_REPORT_SENT = 0x05,    // report taken by the host (IN complete): 0, report number
+    TRACE_EVENT_LEDS = 0x06,           // LED state set by the host: LEDs, 0
+    TRACE_EVENT_OVERFLOW = 0x07,       // change lost: enum trace_overflow, (row << 8) | column or the report number
+    TRACE_EVENT_REPORT_MERGED = 0x08,  // report merged into the queued one still waiting: length, its report number
+};
+
+enum trace_overflow {
+    TRACE_OVERFLOW_EVENT_QUEUE = 0x00,   // key change held back by a full event queue, retried on the next scan
+    TRACE_OVERFLOW_REPORT_QUEUE = 0x01,  // queued report overwritten by a newer one
+};
+
+// 8 bytes, laid out the same way in the config protocol
+struct trace_entry {
+    uint32_t time_us;  // scan clock, see latency_now_us()
+    uint8_t event;     // enum trace_event
+    uint8_t arg;
+    uint16_t value;
+};
+
+#if TRACE_EVENTS
+// from any context
+void trace_record(enum trace_event event, uint8_t arg, uint16_t value);
+#else
+#define trace_record(event, arg, value) ((void)(value))
+#endif
+
+void trace_clear(void);
+
+// sequence number of the next event to be recorded
+uint32_t trace_next_sequence(void);
+
+// copy up to max_entries events starting at *sequence, or at the oldest one kept if that one has already been
+// overwritten, and set *sequence to the first one copied. Returns the number of entries copied.
+uint8_t trace_read(uint32_t *sequence, struct trace_entry *entries, uint8_t max_entries);
+
+#endif  // _TRACE_H
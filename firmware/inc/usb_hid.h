@@ -29,20 +29,68 @@
 #include <stdint.h>
 
 #define MAX_NUM_KEY_CODES 6
+#define NKRO_NUM_KEY_CODES 0xE0  // every usage below the modifiers
 
+// size of the reports of the config interface, both ways
+#define USB_HID_CONFIG_REPORT_SIZE 32
+
+enum usb_hid_protocol {
+    USB_HID_PROTOCOL_BOOT = 0,
+    USB_HID_PROTOCOL_REPORT = 1,
+};
+
+// boot protocol report (6KRO)
 struct usb_hid_report {
     uint8_t modifiers;
-    uint8_t leds;
+    uint8_t reserved;
     uint8_t key_codes[MAX_NUM_KEY_CODES];
 } __attribute((packed));
 
+// report protocol report (NKRO) - one bit per key code
+struct usb_hid_nkro_report {
+    uint8_t modifiers;
+    uint8_t key_bits[NKRO_NUM_KEY_CODES / 8];
+} __attribute((packed));
+
 void usb_hid_init(void);
 
-void usb_hid_get_leds(struct usb_hid_report *report);
+void usb_hid_get_leds(uint8_t *leds);
+
+// true if the host sent an LED state usb_hid_get_leds() has not returned yet
+bool usb_hid_leds_pending(void);
+
+enum usb_hid_protocol usb_hid_get_protocol(void);
+
+// scan time of the oldest key change in the next report sent, for the end-to-end latency probe
+void usb_hid_stamp_report(uint32_t change_ms);
+
+// queue a report for the IN endpoint, reports reach the host in the order they were queued. With merge set, the
+// report replaces the newest queued one instead if that one hasn't gone to the endpoint yet, for a caller that knows
+// the host doesn't need to see both - returns true if it did.
+bool usb_hid_send_report(struct usb_hid_report *report, bool merge);
+
+bool usb_hid_send_nkro_report(struct usb_hid_nkro_report *report, bool merge);
+
+// start of frame interrupt, which calls keyboard_sof() on the frames the host polls the keyboard in - only on while
+// scanning, it would end every sleep otherwise
+void usb_hid_set_sof_enabled(bool enabled);
+
+// run the remote wakeup signalling, called from the main loop with the current time
+void usb_hid_update(uint32_t time_ms);
+
+// true if the host sent a config request usb_hid_get_config_request() has not returned yet
+bool usb_hid_config_request_pending(void);
+
+// returns the pending config request, false if there is none - the next one is only accepted once the response to
+// this one has been sent
+bool usb_hid_get_config_request(uint8_t *request);
+void usb_hid_send_config_response(const uint8_t *response);
 
-void usb_hid_send_report(struct usb_hid_report *report);
+// true while a queued report waits for the endpoint
+bool usb_hid_reports_queued(void);
 
-void usb_hid_poll(void);
+// number of queued reports overwritten because the host fell behind
+uint32_t usb_hid_get_report_overflows(void);
 
 
 #endif  // _USB_HID_H
\ No newline at end of file
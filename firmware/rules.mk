@@ -48,6 +48,7 @@ CC	= $(PREFIX)gcc
 LD	= $(PREFIX)gcc
 OBJCOPY	= $(PREFIX)objcopy
 OBJDUMP	= $(PREFIX)objdump
+SIZE	= $(PREFIX)size
 OOCD	?= openocd
 DFU_UTIL ?= dfu-util
 
@@ -141,6 +142,8 @@ $(BUILD_DIR)/%.o: %.S
 $(PROJECT).elf: $(OBJS) $(LDSCRIPT) $(LIBDEPS)
 	@printf "  LD\t$@\n"
 	$(Q)$(LD) $(TGT_LDFLAGS) $(LDFLAGS) $(OBJS) $(LDLIBS) -o $@
+	@# data includes the .ramfunc code copied to RAM at reset, data + bss is the static RAM left to the stack
+	$(Q)$(SIZE) $@
 
 %.bin: %.elf
 	@printf "  OBJCOPY\t$@\n"
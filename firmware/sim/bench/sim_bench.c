@@ -0,0 +1,440 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Benchmark suite - replays matrix traces through the firmware in the simulator and prints, per trace, the host time
+ * the scan and keyboard_poll() take, the reports sent per key event, lost events and the press-to-host latency, one
+ * JSON object per line.
+ *
+ * The synthetic traces (fast typing, rollover chords, gaming and chattering switches) are built in and the same on
+ * every run. Recorded ones are read from the files given on the command line, one matrix row change per line: the
+ * time in us, the row and the columns read, as in the TRACE_EVENT_MATRIX events of the firmware's trace (trace.h).
+ *
+ * Exits with an error if a press never reaches the host or a key is left down after a trace, so 'make sim-bench'
+ * fails on those as well.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event_queue.h"
+#include "hid_codes.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "usb_hid.h"
+
+// past the LED self test
+#define BENCH_SETTLE_MS 1100
+
+// after the last event, for the last reports to reach the host
+#define BENCH_DRAIN_MS 200
+
+// a press after the key has been up for less than this is a bounce rather than a key stroke of its own, and the
+// synthetic traces leave keys up for longer than this between strokes
+#define BENCH_BOUNCE_GAP_MS 10
+
+#define BENCH_TYPING_TEXT "the quick brown fox jumps over the lazy dog while five boxing wizards jump quickly "
+#define BENCH_TYPING_STROKES 600
+#define BENCH_CHATTER_STROKES 300
+#define BENCH_CHORDS 40
+#define BENCH_GAMING_MS 20000
+
+struct bench_event {
+    uint32_t time_ms;
+    uint32_t order;  // keeps events at the same time in the order they were added
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+};
+
+struct bench_trace {
+    char name[64];
+    struct bench_event *events;
+    size_t num_events;
+    size_t max_events;
+    uint32_t key_free_ms[NUM_ROWS][NUM_COLS];  // while building: when each key is released again
+};
+
+struct bench_key {
+    uint8_t row;
+    uint8_t col;
+};
+
+static uint32_t bench_seed;
+
+// the same numbers on every run
+static uint32_t bench_random(uint32_t min, uint32_t max) {
+    bench_seed = (bench_seed * 1103515245) + 12345;
+    return min + ((bench_seed >> 16) % (max - min + 1));
+}
+
+static void bench_trace_init(struct bench_trace *trace, const char *name) {
+    memset(trace, 0, sizeof(*trace));
+    snprintf(trace->name, sizeof(trace->name), "%s", name);
+    bench_seed = 1;
+}
+
+static void bench_add(struct bench_trace *trace, uint32_t time_ms, uint8_t row, uint8_t col, bool pressed) {
+    if (trace->num_events == trace->max_events) {
+        trace->max_events = trace->max_events ? (2 * trace->max_events) : 1024;
+        trace->events = realloc(trace->events, trace->max_events * sizeof(*trace->events));
+        if (trace->events == NULL) {
+            fprintf(stderr, "bench: out of memory\n");
+            exit(1);
+        }
+    }
+    trace->events[trace->num_events] = (struct bench_event){
+        .time_ms = time_ms,
+        .order = trace->num_events,
+        .row = row,
+        .col = col,
+        .pressed = pressed,
+    };
+    trace->num_events++;
+}
+
+// a key press held for hold_ms, bouncing for up to bounce_ms on the way down and up, returns when it was pressed -
+// later than asked for if the key is still down from before
+static uint32_t bench_add_stroke(struct bench_trace *trace, struct bench_key key, uint32_t time_ms, uint32_t hold_ms,
+    uint32_t bounce_ms) {
+
+    if (time_ms < trace->key_free_ms[key.row][key.col]) {
+        time_ms = trace->key_free_ms[key.row][key.col];
+    }
+
+    uint32_t release_ms = time_ms + hold_ms;
+    for (uint32_t ms = 0; ms < bounce_ms; ms++) {
+        bench_add(trace, time_ms + ms, key.row, key.col, ms % 2 == 0);
+        bench_add(trace, release_ms + ms, key.row, key.col, ms % 2 != 0);
+    }
+    bench_add(trace, time_ms + bounce_ms, key.row, key.col, true);
+    bench_add(trace, release_ms + bounce_ms, key.row, key.col, false);
+
+    trace->key_free_ms[key.row][key.col] = release_ms + bounce_ms + (2 * BENCH_BOUNCE_GAP_MS);
+    return time_ms;
+}
+
+static int bench_compare_events(const void *a, const void *b) {
+    const struct bench_event *event_a = a;
+    const struct bench_event *event_b = b;
+    if (event_a->time_ms != event_b->time_ms) {
+        return (event_a->time_ms < event_b->time_ms) ? -1 : 1;
+    }
+    return (event_a->order < event_b->order) ? -1 : (event_a->order > event_b->order);
+}
+
+// position of the first layer 0 key with the action
+static bool bench_find_key(uint16_t action, struct bench_key *key) {
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < NUM_COLS; col++) {
+            if (keymap_layers[0][row][col] == action) {
+                *key = (struct bench_key){.row = row, .col = col};
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static struct bench_key bench_char_key(char c) {
+    uint8_t key_code;
+    bool shifted;
+    struct bench_key key = {0};
+    if (!sim_char_to_key(c, &key_code, &shifted) || !bench_find_key(KEYMAP_ACTION(KEYMAP_ACTION_KEY, key_code), &key)) {
+        fprintf(stderr, "bench: no key for '%c'\n", c);
+        exit(1);
+    }
+    return key;
+}
+
+// text typed quickly, with the next key often going down before the previous one comes up
+static void bench_typing(struct bench_trace *trace, const char *name, uint32_t strokes, uint32_t max_bounce_ms) {
+    bench_trace_init(trace, name);
+    const char *text = BENCH_TYPING_TEXT;
+    uint32_t time_ms = 0;
+    for (uint32_t i = 0; i < strokes; i++) {
+        struct bench_key key = bench_char_key(text[i % strlen(text)]);
+        uint32_t bounce_ms = max_bounce_ms ? bench_random(1, max_bounce_ms) : 0;
+        time_ms = bench_add_stroke(trace, key, time_ms, bench_random(50, 110), bounce_ms);
+        time_ms += bench_random(40, 100);
+    }
+}
+
+// chords of up to a dozen keys going down and coming up within a few ms of each other
+static void bench_rollover(struct bench_trace *trace) {
+    bench_trace_init(trace, "rollover");
+    const char *keys = "qwertyuiopasdfghjklzxcvbnm1234567890";
+    uint32_t time_ms = 0;
+    for (uint32_t chord = 0; chord < BENCH_CHORDS; chord++) {
+        uint32_t num_keys = bench_random(6, 12);
+        uint32_t first = bench_random(0, strlen(keys) - 1);
+        uint32_t press_ms = time_ms;
+        uint32_t release_ms = time_ms + 60;
+        for (uint32_t i = 0; i < num_keys; i++) {
+            struct bench_key key = bench_char_key(keys[(first + (3 * i)) % strlen(keys)]);
+            press_ms += bench_random(0, 3);
+            release_ms += bench_random(0, 3);
+            bench_add_stroke(trace, key, press_ms, release_ms - press_ms, 0);
+        }
+        time_ms = release_ms + 100;
+    }
+}
+
+// movement keys held for a while, one or two at a time and now and then with Shift, with action keys tapped in
+// between
+static void bench_gaming(struct bench_trace *trace) {
+    bench_trace_init(trace, "gaming");
+    const char *moves = "wasd";
+    const char *actions = "12345reqf ";
+    struct bench_key shift;
+    if (!bench_find_key(MOD(KEY_MOD_LSHIFT), &shift)) {
+        fprintf(stderr, "bench: no left Shift key\n");
+        exit(1);
+    }
+
+    for (uint32_t time_ms = 0; time_ms < BENCH_GAMING_MS;) {
+        uint32_t hold_ms = bench_random(150, 600);
+        uint32_t num_moves = bench_random(1, 2);
+        uint32_t move = bench_random(0, 3);
+        for (uint32_t i = 0; i < num_moves; i++) {
+            bench_add_stroke(trace, bench_char_key(moves[(move + i) % 4]), time_ms, hold_ms, 0);
+        }
+        if (bench_random(0, 3) == 0) {
+            bench_add_stroke(trace, shift, time_ms, hold_ms, 0);
+        }
+        for (uint32_t action_ms = time_ms + bench_random(50, 150); action_ms < time_ms + hold_ms;
+            action_ms += bench_random(100, 400)) {
+            bench_add_stroke(trace, bench_char_key(actions[bench_random(0, strlen(actions) - 1)]), action_ms,
+                bench_random(30, 60), 0);
+        }
+        time_ms += hold_ms + bench_random(0, 20);
+    }
+}
+
+// a recorded trace, see the top of the file - returns false if it can't be read
+static bool bench_load(struct bench_trace *trace, const char *path) {
+    const char *name = strrchr(path, '/') ? (strrchr(path, '/') + 1) : path;
+    bench_trace_init(trace, name);
+    char *dot = strrchr(trace->name, '.');
+    if (dot != NULL) {
+        *dot = '\0';
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "bench: can't open %s\n", path);
+        return false;
+    }
+
+    uint16_t rows[NUM_ROWS] = {0};
+    char line[256];
+    bool ok = true;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        unsigned long time_us;
+        unsigned int row;
+        unsigned int cols;
+        int fields = sscanf(line, "%lu %u %i", &time_us, &row, &cols);
+        if (fields <= 0) {
+            continue;
+        }
+        if ((fields != 3) || (row >= NUM_ROWS) || (cols > 0xffff)) {
+            fprintf(stderr, "bench: %s: bad line: %s", path, line);
+            ok = false;
+            break;
+        }
+
+        uint16_t changed = rows[row] ^ cols;
+        for (uint8_t col = 0; col < NUM_COLS; col++) {
+            if (changed & (1 << col)) {
+                bench_add(trace, time_us / 1000, row, col, cols & (1 << col));
+            }
+        }
+        rows[row] = cols;
+    }
+    fclose(file);
+
+    // whatever is still down at the end comes up again
+    uint32_t end_ms = trace->num_events ? (trace->events[trace->num_events - 1].time_ms + 1) : 0;
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < NUM_COLS; col++) {
+            if (rows[row] & (1 << col)) {
+                bench_add(trace, end_ms, row, col, false);
+            }
+        }
+    }
+    return ok;
+}
+
+static int bench_compare_u32(const void *a, const void *b) {
+    uint32_t value_a = *(const uint32_t *)a;
+    uint32_t value_b = *(const uint32_t *)b;
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+static uint32_t bench_percentile(const uint32_t *sorted, size_t count, uint32_t percent) {
+    return count ? sorted[((count - 1) * percent) / 100] : 0;
+}
+
+// replay a trace from a fresh boot and print its results, returns false if keys went missing or got stuck
+static bool bench_run(struct bench_trace *trace) {
+    qsort(trace->events, trace->num_events, sizeof(*trace->events), bench_compare_events);
+
+    sim_boot();
+    sim_key_release_all();
+    sim_run_ms(BENCH_SETTLE_MS);
+    sim_reset_timing();
+    uint32_t reports_before = sim_host_num_reports();
+
+    // for every key that sends a key code: the host's press count and the time a key stroke started, while the host
+    // has yet to see it
+    uint8_t key_codes[NUM_ROWS][NUM_COLS] = {{0}};
+    uint32_t host_presses[NUM_ROWS][NUM_COLS] = {{0}};
+    bool key_down[NUM_ROWS][NUM_COLS] = {{false}};
+    uint32_t release_ms[NUM_ROWS][NUM_COLS] = {{0}};
+    bool press_pending[NUM_ROWS][NUM_COLS] = {{false}};
+    uint32_t press_ms[NUM_ROWS][NUM_COLS] = {{0}};
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < NUM_COLS; col++) {
+            uint16_t action = keymap_layers[0][row][col];
+            if ((KEYMAP_ACTION_TYPE(action) == KEYMAP_ACTION_KEY) && (KEYMAP_ACTION_ARG(action) != KEY_NONE)) {
+                key_codes[row][col] = KEYMAP_ACTION_ARG(action);
+                host_presses[row][col] = sim_host_key_presses(key_codes[row][col]);
+            }
+        }
+    }
+
+    uint32_t *latencies_us = malloc((trace->num_events + 1) * sizeof(*latencies_us));
+    size_t num_latencies = 0;
+    uint32_t num_presses = 0;
+    uint32_t spurious_presses = 0;
+
+    uint32_t end_ms = (trace->num_events ? trace->events[trace->num_events - 1].time_ms : 0) + BENCH_DRAIN_MS;
+    size_t next = 0;
+    for (uint32_t ms = 0; ms < end_ms; ms++) {
+        for (; (next < trace->num_events) && (trace->events[next].time_ms <= ms); next++) {
+            const struct bench_event *event = &trace->events[next];
+            uint8_t row = event->row;
+            uint8_t col = event->col;
+            if (event->pressed) {
+                sim_key_press(row, col);
+                bool stroke = !key_down[row][col]
+                    && ((release_ms[row][col] == 0) || (ms - release_ms[row][col] >= BENCH_BOUNCE_GAP_MS));
+                if (stroke && key_codes[row][col] && !press_pending[row][col]) {
+                    press_pending[row][col] = true;
+                    press_ms[row][col] = ms;
+                    num_presses++;
+                }
+            } else {
+                sim_key_release(row, col);
+                release_ms[row][col] = ms;
+            }
+            key_down[row][col] = event->pressed;
+        }
+
+        sim_run_ms(1);
+
+        for (uint8_t row = 0; row < NUM_ROWS; row++) {
+            for (uint8_t col = 0; col < NUM_COLS; col++) {
+                if (!key_codes[row][col]) {
+                    continue;
+                }
+                uint32_t presses = sim_host_key_presses(key_codes[row][col]);
+                uint32_t new_presses = presses - host_presses[row][col];
+                host_presses[row][col] = presses;
+                if (new_presses && press_pending[row][col]) {
+                    press_pending[row][col] = false;
+                    latencies_us[num_latencies++] = (ms + 1 - press_ms[row][col]) * 1000;
+                    new_presses--;
+                }
+                spurious_presses += new_presses;
+            }
+        }
+    }
+
+    uint32_t missed_presses = num_presses - num_latencies;
+    uint32_t stuck_keys = 0;
+    for (uint16_t key_code = 0; key_code < 0x100; key_code++) {
+        stuck_keys += sim_host_key_down(key_code);
+    }
+
+    struct sim_timing timing;
+    sim_get_timing(&timing);
+    uint32_t reports = sim_host_num_reports() - reports_before;
+    qsort(latencies_us, num_latencies, sizeof(*latencies_us), bench_compare_u32);
+
+    printf("{\"trace\": \"%s\", \"events\": %zu, \"duration_ms\": %u, ", trace->name, trace->num_events, end_ms);
+    printf("\"scans\": %llu, \"ns_per_scan\": %.1f, \"polls\": %llu, \"ns_per_poll\": %.1f, ",
+        (unsigned long long)timing.scans, timing.scans ? (double)timing.scan_ns / timing.scans : 0.0,
+        (unsigned long long)timing.polls, timing.polls ? (double)timing.poll_ns / timing.polls : 0.0);
+    printf("\"reports\": %u, \"reports_per_event\": %.3f, ", reports,
+        trace->num_events ? (double)reports / trace->num_events : 0.0);
+    printf("\"event_queue_overflows\": %u, \"report_overflows\": %u, ", event_queue_overflows(),
+        usb_hid_get_report_overflows());
+    printf("\"presses\": %u, \"missed_presses\": %u, \"spurious_presses\": %u, \"stuck_keys\": %u, ", num_presses,
+        missed_presses, spurious_presses, stuck_keys);
+    printf("\"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}}\n",
+        bench_percentile(latencies_us, num_latencies, 50), bench_percentile(latencies_us, num_latencies, 90),
+        bench_percentile(latencies_us, num_latencies, 99), bench_percentile(latencies_us, num_latencies, 100));
+
+    free(latencies_us);
+    free(trace->events);
+    return (missed_presses == 0) && (stuck_keys == 0);
+}
+
+int main(int argc, char **argv) {
+    bool ok = true;
+    struct bench_trace trace;
+
+    // the synthetic traces look the keys up in the layers, which are there once the firmware has booted
+    sim_boot();
+
+    bench_typing(&trace, "fast_typing", BENCH_TYPING_STROKES, 0);
+    ok = bench_run(&trace) && ok;
+    bench_rollover(&trace);
+    ok = bench_run(&trace) && ok;
+    bench_gaming(&trace);
+    ok = bench_run(&trace) && ok;
+    bench_typing(&trace, "chatter", BENCH_CHATTER_STROKES, 5);
+    ok = bench_run(&trace) && ok;
+
+    for (int i = 1; i < argc; i++) {
+        if (!bench_load(&trace, argv[i])) {
+            free(trace.events);
+            ok = false;
+            continue;
+        }
+        ok = bench_run(&trace) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/cm3/cortex.h>. The simulator never interrupts the firmware, so masking
+ * interrupts is a no-op.
+ */
+
+#ifndef _SIM_LIBOPENCM3_CORTEX_H
+#define _SIM_LIBOPENCM3_CORTEX_H
+
+#include <stdint.h>
+
+static inline void cm_enable_interrupts(void) {}
+
+static inline void cm_disable_interrupts(void) {}
+
+static inline uint32_t cm_mask_interrupts(uint32_t mask) {
+    (void)mask;
+    return 0;
+}
+
+#endif  // _SIM_LIBOPENCM3_CORTEX_H
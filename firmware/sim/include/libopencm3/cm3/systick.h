@@ -0,0 +1,49 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/cm3/systick.h>. The simulator drives sys_tick_handler() from its own clock.
+ */
+
+#ifndef _SIM_LIBOPENCM3_SYSTICK_H
+#define _SIM_LIBOPENCM3_SYSTICK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STK_CSR_CLKSOURCE_AHB_DIV8 (0 << 2)
+#define STK_CSR_CLKSOURCE_AHB (1 << 2)
+#define STK_CSR_CLKSOURCE_EXT STK_CSR_CLKSOURCE_AHB_DIV8
+
+void systick_set_reload(uint32_t value);
+uint32_t systick_get_reload(void);
+bool systick_set_frequency(uint32_t freq, uint32_t ahb);
+uint32_t systick_get_value(void);
+void systick_set_clocksource(uint8_t clocksource);
+void systick_interrupt_enable(void);
+void systick_interrupt_disable(void);
+void systick_counter_enable(void);
+void systick_counter_disable(void);
+
+#endif  // _SIM_LIBOPENCM3_SYSTICK_H
@@ -0,0 +1,49 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/stm32/flash.h> (STM32F0 subset).
+ *
+ * The simulated flash follows the F0 programming rules: a half-word can only be programmed when it is erased
+ * (0xFFFF) or when writing 0x0000, and the controller has to be unlocked first.
+ */
+
+#ifndef _SIM_LIBOPENCM3_FLASH_H
+#define _SIM_LIBOPENCM3_FLASH_H
+
+#include <stdint.h>
+
+#define FLASH_ACR_LATENCY_000_024MHZ 0x0
+#define FLASH_ACR_LATENCY_024_048MHZ 0x1
+
+void flash_prefetch_enable(void);
+void flash_prefetch_disable(void);
+void flash_set_ws(uint32_t ws);
+void flash_unlock(void);
+void flash_lock(void);
+void flash_erase_page(uint32_t page_address);
+void flash_program_half_word(uint32_t address, uint16_t data);
+void flash_program_word(uint32_t address, uint32_t data);
+
+#endif  // _SIM_LIBOPENCM3_FLASH_H
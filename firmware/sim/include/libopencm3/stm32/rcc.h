@@ -0,0 +1,84 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/stm32/rcc.h> (STM32F0 subset). Clock control has no effect in the simulator.
+ */
+
+#ifndef _SIM_LIBOPENCM3_RCC_H
+#define _SIM_LIBOPENCM3_RCC_H
+
+#include <stdint.h>
+
+#define RCC_CFGR_HPRE_NODIV 0x0
+#define RCC_CFGR_PPRE_NODIV 0x0
+#define RCC_CFGR_PLLMUL_MUL4 0x2
+#define RCC_CFGR_PLLSRC_HSI_CLK_DIV2 0x0
+#define RCC_CFGR_PLLSRC_HSE_CLK 0x1
+#define RCC_CFGR_PLLXTPRE_HSE_CLK 0x0
+#define RCC_CFGR_PLLXTPRE_HSE_CLK_DIV2 0x1
+
+enum rcc_osc {
+    RCC_HSI14,
+    RCC_HSI,
+    RCC_HSE,
+    RCC_PLL,
+    RCC_LSE,
+    RCC_LSI,
+    RCC_HSI48,
+};
+
+enum rcc_periph_clken {
+    RCC_DMA,
+    RCC_GPIOA,
+    RCC_GPIOB,
+    RCC_GPIOC,
+    RCC_GPIOD,
+    RCC_GPIOF,
+    RCC_SYSCFG_COMP,
+    RCC_TIM1,
+    RCC_TIM3,
+    RCC_TIM14,
+    RCC_TIM16,
+    RCC_TIM17,
+    RCC_USB,
+    RCC_PWR,
+};
+
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+
+void rcc_osc_on(enum rcc_osc osc);
+void rcc_wait_for_osc_ready(enum rcc_osc osc);
+void rcc_set_sysclk_source(enum rcc_osc clk);
+void rcc_set_usbclk_source(enum rcc_osc clk);
+void rcc_set_hpre(uint32_t hpre);
+void rcc_set_ppre(uint32_t ppre);
+void rcc_set_pll_multiplication_factor(uint32_t mul);
+void rcc_set_pll_source(uint32_t pllsrc);
+void rcc_set_pllxtpre(uint32_t pllxtpre);
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_clock_disable(enum rcc_periph_clken clken);
+
+#endif  // _SIM_LIBOPENCM3_RCC_H
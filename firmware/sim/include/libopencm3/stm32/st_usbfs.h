@@ -0,0 +1,54 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/stm32/st_usbfs.h>. The simulated USB device lives in sim_usb.c.
+ */
+
+#ifndef _SIM_LIBOPENCM3_ST_USBFS_H
+#define _SIM_LIBOPENCM3_ST_USBFS_H
+
+#include <stdint.h>
+
+#include <libopencm3/usb/usbd.h>
+
+// USB_CNTR - only the start of frame interrupt mask and the suspend and resume bits are modelled
+extern volatile uint32_t sim_usb_cntr;
+#define USB_CNTR_REG (&sim_usb_cntr)
+
+#define USB_CNTR_SOFM 0x0200
+#define USB_CNTR_RESUME 0x0010
+#define USB_CNTR_FSUSP 0x0008
+#define USB_CNTR_LPMODE 0x0004
+
+// USB_FNR - the frame number of the last start of frame
+extern volatile uint32_t sim_usb_fnr;
+#define USB_FNR_REG (&sim_usb_fnr)
+
+#define USB_FNR_FN 0x07ff
+
+// the simulated host only flags a start of frame while its interrupt is enabled, there is no stale one to clear
+#define USB_CLR_ISTR_SOF() ((void)0)
+
+#endif  // _SIM_LIBOPENCM3_ST_USBFS_H
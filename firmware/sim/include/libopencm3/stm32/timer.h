@@ -0,0 +1,103 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/stm32/timer.h> (STM32F0 subset).
+ *
+ * The simulated timers count in simulator time and raise DMA requests for update and compare events, see
+ * sim_hw.c for the request mapping. Output compare channels in PWM mode drive their alternate function pins.
+ */
+
+#ifndef _SIM_LIBOPENCM3_TIMER_H
+#define _SIM_LIBOPENCM3_TIMER_H
+
+#include <stdint.h>
+
+#include <libopencm3/stm32/memorymap.h>
+
+#define TIM1 TIM1_BASE
+#define TIM3 TIM3_BASE
+#define TIM14 TIM14_BASE
+#define TIM16 TIM16_BASE
+#define TIM17 TIM17_BASE
+
+#define TIM_CR1_CKD_CK_INT (0x0 << 8)
+#define TIM_CR1_CMS_EDGE (0x0 << 5)
+#define TIM_CR1_DIR_UP (0 << 4)
+
+#define TIM_DIER_UIE (1 << 0)
+#define TIM_DIER_CC1IE (1 << 1)
+#define TIM_DIER_CC2IE (1 << 2)
+#define TIM_DIER_CC3IE (1 << 3)
+#define TIM_DIER_CC4IE (1 << 4)
+#define TIM_DIER_UDE (1 << 8)
+#define TIM_DIER_CC1DE (1 << 9)
+#define TIM_DIER_CC2DE (1 << 10)
+#define TIM_DIER_CC3DE (1 << 11)
+#define TIM_DIER_CC4DE (1 << 12)
+
+#define TIM_SR_UIF (1 << 0)
+
+#define TIM_EGR_UG (1 << 0)
+
+enum tim_oc_id {
+    TIM_OC1 = 0,
+    TIM_OC1N,
+    TIM_OC2,
+    TIM_OC2N,
+    TIM_OC3,
+    TIM_OC3N,
+    TIM_OC4,
+};
+
+enum tim_oc_mode {
+    TIM_OCM_FROZEN,
+    TIM_OCM_ACTIVE,
+    TIM_OCM_INACTIVE,
+    TIM_OCM_TOGGLE,
+    TIM_OCM_FORCE_LOW,
+    TIM_OCM_FORCE_HIGH,
+    TIM_OCM_PWM1,
+    TIM_OCM_PWM2,
+};
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction);
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value);
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode);
+void timer_set_oc_polarity_high(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_break_main_output(uint32_t timer_peripheral);
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value);
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq);
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq);
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event);
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
+uint32_t timer_get_counter(uint32_t timer_peripheral);
+
+#endif  // _SIM_LIBOPENCM3_TIMER_H
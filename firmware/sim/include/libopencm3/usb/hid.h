@@ -0,0 +1,63 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/usb/hid.h>.
+ */
+
+#ifndef _SIM_LIBOPENCM3_HID_H
+#define _SIM_LIBOPENCM3_HID_H
+
+#include <stdint.h>
+
+#include <libopencm3/usb/usbstd.h>
+
+#define USB_CLASS_HID 3
+
+#define USB_HID_DT_HID 0x21
+#define USB_HID_DT_REPORT 0x22
+
+#define USB_HID_SUBCLASS_NO 0
+#define USB_HID_SUBCLASS_BOOT_INTERFACE 1
+
+#define USB_HID_INTERFACE_PROTOCOL_NONE 0
+#define USB_HID_INTERFACE_PROTOCOL_KEYBOARD 1
+#define USB_HID_INTERFACE_PROTOCOL_MOUSE 2
+
+#define USB_HID_REQ_TYPE_GET_REPORT 0x01
+#define USB_HID_REQ_TYPE_GET_IDLE 0x02
+#define USB_HID_REQ_TYPE_GET_PROTOCOL 0x03
+#define USB_HID_REQ_TYPE_SET_REPORT 0x09
+#define USB_HID_REQ_TYPE_SET_IDLE 0x0a
+#define USB_HID_REQ_TYPE_SET_PROTOCOL 0x0b
+
+struct usb_hid_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdHID;
+    uint8_t bCountryCode;
+    uint8_t bNumDescriptors;
+} __attribute__((packed));
+
+#endif  // _SIM_LIBOPENCM3_HID_H
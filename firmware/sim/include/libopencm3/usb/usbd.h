@@ -0,0 +1,78 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulation stand-in for <libopencm3/usb/usbd.h>.
+ *
+ * The device side is backed by sim_usb.c, which also plays the role of the USB host: it polls IN endpoints at
+ * their bInterval and issues control requests such as Set_Report.
+ */
+
+#ifndef _SIM_LIBOPENCM3_USBD_H
+#define _SIM_LIBOPENCM3_USBD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/usb/usbstd.h>
+
+enum usbd_request_return_codes {
+    USBD_REQ_NOTSUPP = 0,
+    USBD_REQ_HANDLED = 1,
+    USBD_REQ_NEXT_CALLBACK = 2,
+};
+
+typedef struct _usbd_driver usbd_driver;
+typedef struct _usbd_device usbd_device;
+
+extern const usbd_driver st_usbfs_v2_usb_driver;
+
+typedef void (*usbd_control_complete_callback)(usbd_device *usbd_dev, struct usb_setup_data *req);
+typedef enum usbd_request_return_codes (*usbd_control_callback)(usbd_device *usbd_dev, struct usb_setup_data *req,
+    uint8_t **buf, uint16_t *len, usbd_control_complete_callback *complete);
+typedef void (*usbd_set_config_callback)(usbd_device *usbd_dev, uint16_t wValue);
+typedef void (*usbd_endpoint_callback)(usbd_device *usbd_dev, uint8_t ep);
+
+usbd_device *usbd_init(const usbd_driver *driver, const struct usb_device_descriptor *dev,
+    const struct usb_config_descriptor *conf, const char * const *strings, int num_strings,
+    uint8_t *control_buffer, uint16_t control_buffer_size);
+
+void usbd_register_reset_callback(usbd_device *usbd_dev, void (*callback)(void));
+void usbd_register_suspend_callback(usbd_device *usbd_dev, void (*callback)(void));
+void usbd_register_resume_callback(usbd_device *usbd_dev, void (*callback)(void));
+void usbd_register_sof_callback(usbd_device *usbd_dev, void (*callback)(void));
+int usbd_register_control_callback(usbd_device *usbd_dev, uint8_t type, uint8_t type_mask,
+    usbd_control_callback callback);
+int usbd_register_set_config_callback(usbd_device *usbd_dev, usbd_set_config_callback callback);
+
+void usbd_poll(usbd_device *usbd_dev);
+void usbd_disconnect(usbd_device *usbd_dev, bool disconnected);
+
+void usbd_ep_setup(usbd_device *usbd_dev, uint8_t addr, uint8_t type, uint16_t max_size,
+    usbd_endpoint_callback callback);
+uint16_t usbd_ep_write_packet(usbd_device *usbd_dev, uint8_t addr, const void *buf, uint16_t len);
+uint16_t usbd_ep_read_packet(usbd_device *usbd_dev, uint8_t addr, void *buf, uint16_t len);
+void usbd_ep_nak_set(usbd_device *usbd_dev, uint8_t addr, uint8_t nak);
+
+#endif  // _SIM_LIBOPENCM3_USBD_H
@@ -0,0 +1,110 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Host-native simulator - runs the unmodified firmware sources on Linux against a simulated key matrix, flash and
+ * USB host.
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// matrix wiring of the board: rows are driven on PA0..PA6, columns are read back on PB0..PB15
+#define SIM_MATRIX_ROWS 7
+#define SIM_MATRIX_COLS 16
+#define SIM_ROW_START_PIN 0
+
+struct sim_flash_stats {
+    uint32_t erases;
+    uint32_t programs;
+    uint32_t errors;
+    uint64_t busy_us;  // time the CPU would have been stalled by the flash controller
+};
+
+// host time spent in the firmware's scan and main loop key handling since boot or sim_reset_timing()
+struct sim_timing {
+    uint64_t scans;    // keyboard_scan() from the SysTick interrupt
+    uint64_t scan_ns;
+    uint64_t polls;    // keyboard_poll() from the main loop
+    uint64_t poll_ns;
+};
+
+// simulator clock, advanced by sim_run_ms()
+uint64_t sim_time_us(void);
+void sim_run_ms(uint32_t ms);
+
+// power up the board and enumerate it on the host, starting the clock over
+void sim_boot(void);
+
+void sim_reset_timing(void);
+void sim_get_timing(struct sim_timing *timing);
+
+// simulated hardware
+void sim_hw_init(void);
+void sim_hw_run_us(uint32_t us);
+bool sim_nvic_irq_enabled(uint8_t irqn);
+bool sim_exti_irq_pending(void);
+bool sim_systick_running(void);
+bool sim_systick_irq_pending(void);  // true once per counter wrap that is due, for sim_run_ms()
+int64_t sim_systick_ticks_to_wrap(void);  // SysTick ticks until the next scan
+void sim_systick_set_drift_ppm(int32_t ppm);  // the board's crystal against the host's frame clock
+void sim_key_press(uint8_t row, uint8_t col);
+void sim_key_release(uint8_t row, uint8_t col);
+void sim_key_release_all(void);
+uint16_t sim_gpio_output(uint32_t gpioport);  // pins driven by a timer read high if they are high at all
+uint32_t sim_gpio_duty_permille(uint32_t gpioport, uint16_t gpio);
+bool sim_timer_irq_pending(uint32_t timer_peripheral);
+void sim_flash_get_stats(struct sim_flash_stats *stats);
+
+// simulated USB device
+bool sim_usb_irq_pending(void);
+
+// simulated USB host
+void sim_host_enumerate(void);
+void sim_host_frame(void);
+void sim_host_set_leds(uint8_t leds);
+void sim_host_set_boot_protocol(bool boot);
+void sim_host_set_remote_wakeup(bool enable);
+void sim_host_get_device_status(void);
+int sim_host_control_result(uint8_t *data);  // data stage length of the last control request, -1 if STALLed
+void sim_host_suspend(void);
+void sim_host_resume(void);
+bool sim_host_is_suspended(void);
+uint32_t sim_host_num_remote_wakeups(void);
+void sim_host_set_paused(bool paused);
+void sim_host_set_verbose(bool verbose);
+bool sim_host_key_down(uint8_t key_code);
+uint32_t sim_host_key_presses(uint8_t key_code);
+void sim_host_clear_text(void);
+const char *sim_host_get_text(void);  // characters typed since sim_host_clear_text(), US layout
+bool sim_char_to_key(char c, uint8_t *key_code, bool *shifted);
+bool sim_host_rollover_error(void);
+void sim_host_send_config_request(const uint8_t *request);  // USB_HID_CONFIG_REPORT_SIZE bytes
+bool sim_host_get_config_response(uint8_t *response);
+uint32_t sim_host_num_reports(void);
+
+#endif  // _SIM_H
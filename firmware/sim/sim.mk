@@ -0,0 +1,79 @@
+# Host-native simulation build - compiles the firmware sources with the host compiler against the libopencm3
+# stand-ins in sim/include, and links them with the simulated hardware and USB host. Run the result with
+# 'make sim-run' (or build/sim/keyboard-sim -v to print every report the host receives).
+#
+# 'make sim-bench' replays the synthetic typing traces and the recorded ones in sim/bench/traces through the same
+# build and writes the results, one JSON object per trace, to build/sim/bench.json.
+
+HOST_CC ?= cc
+
+SIM_DIR = sim
+SIM_BUILD_DIR = $(BUILD_DIR)/sim
+SIM_BIN = $(SIM_BUILD_DIR)/$(PROJECT)-sim
+
+SIM_CFILES = $(notdir $(wildcard $(SIM_DIR)/*.c))
+SIM_OBJS = $(CFILES:%.c=$(SIM_BUILD_DIR)/%.o) $(SIM_CFILES:%.c=$(SIM_BUILD_DIR)/%.o)
+
+BENCH_DIR = $(SIM_DIR)/bench
+BENCH_BIN = $(SIM_BUILD_DIR)/$(PROJECT)-bench
+BENCH_RESULTS = $(SIM_BUILD_DIR)/bench.json
+BENCH_TRACES = $(wildcard $(BENCH_DIR)/traces/*.trace)
+BENCH_OBJS = $(filter-out $(SIM_BUILD_DIR)/sim_main.o, $(SIM_OBJS)) $(SIM_BUILD_DIR)/sim_bench.o
+
+SIM_CPPFLAGS += -MD -Wall -Wundef
+SIM_CPPFLAGS += -I$(SIM_DIR)/include -I$(SIM_DIR) $(patsubst %,-I%, . $(INCLUDE_DIR)) -I$(GEN_DIR)
+
+SIM_CFLAGS += -O2 $(CSTD) -g
+SIM_CFLAGS += -fno-common
+SIM_CFLAGS += -Wextra -Wshadow -Wno-unused-variable -Wimplicit-function-declaration
+SIM_CFLAGS += -Wredundant-decls -Wstrict-prototypes -Wmissing-prototypes
+
+# the firmware keeps addresses (DMA buffers, flash) in uint32_t, which only holds up if the simulator's static data
+# sits in the low 4 GB - so link without PIE and don't warn about the casts
+SIM_CFLAGS += -fno-pie -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+SIM_LDFLAGS += -no-pie
+
+# main.c provides the interrupt handlers, but the simulator brings its own entry point
+$(SIM_BUILD_DIR)/main.o: SIM_CFLAGS += -Dmain=sim_firmware_main -Wno-missing-prototypes
+$(SIM_BUILD_DIR)/main.o: SIM_CFLAGS += '-DWAIT_FOR_INTERRUPT()=((void)0)'
+
+# the scenario loads the flash store image of the layers from the key map compiler
+$(SIM_BUILD_DIR)/keymap.o: $(KEYMAP_HEADER)
+$(SIM_BUILD_DIR)/sim_main.o: SIM_CFLAGS += '-DSIM_KEYMAP_IMAGE="$(KEYMAP_IMAGE)"'
+$(SIM_BIN): $(KEYMAP_IMAGE)
+
+$(SIM_BUILD_DIR)/%.o: $(SOURCE_DIR)/%.c
+	@printf "  HOSTCC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(HOST_CC) $(SIM_CFLAGS) $(CFLAGS) $(SIM_CPPFLAGS) $(CPPFLAGS) -o $@ -c $<
+
+$(SIM_BUILD_DIR)/%.o: $(SIM_DIR)/%.c
+	@printf "  HOSTCC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(HOST_CC) $(SIM_CFLAGS) $(CFLAGS) $(SIM_CPPFLAGS) $(CPPFLAGS) -o $@ -c $<
+
+$(SIM_BUILD_DIR)/%.o: $(BENCH_DIR)/%.c
+	@printf "  HOSTCC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(HOST_CC) $(SIM_CFLAGS) $(CFLAGS) $(SIM_CPPFLAGS) $(CPPFLAGS) -o $@ -c $<
+
+$(SIM_BIN): $(SIM_OBJS)
+	@printf "  HOSTLD\t$@\n"
+	$(Q)$(HOST_CC) $(SIM_LDFLAGS) $(SIM_OBJS) -o $@
+
+$(BENCH_BIN): $(BENCH_OBJS)
+	@printf "  HOSTLD\t$@\n"
+	$(Q)$(HOST_CC) $(SIM_LDFLAGS) $(BENCH_OBJS) -o $@
+
+sim: $(SIM_BIN)
+
+sim-run: $(SIM_BIN)
+	$(SIM_BIN)
+
+sim-bench: $(BENCH_BIN)
+	$(BENCH_BIN) $(BENCH_TRACES) > $(BENCH_RESULTS).tmp || { cat $(BENCH_RESULTS).tmp; rm $(BENCH_RESULTS).tmp; exit 1; }
+	@mv $(BENCH_RESULTS).tmp $(BENCH_RESULTS)
+	@cat $(BENCH_RESULTS)
+
+.PHONY: sim sim-run sim-bench
+-include $(SIM_OBJS:.o=.d) $(SIM_BUILD_DIR)/sim_bench.d
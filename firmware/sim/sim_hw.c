@@ -0,0 +1,879 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulated STM32F070 peripherals: GPIO with the key matrix attached, flash and the clock/SysTick controls.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/memorymap.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#define SIM_ROW_GPIO_PORT GPIOA
+#define SIM_COL_GPIO_PORT GPIOB
+
+#define SIM_GPIO_PORT_STRIDE 0x400
+#define SIM_NUM_GPIO_PORTS 6
+
+#define SIM_FLASH_SIZE (32 * 1024)
+#define SIM_FLASH_PAGE_SIZE 1024
+#define SIM_FLASH_ERASE_TIME_US 40000  // worst case tERASE from the datasheet
+#define SIM_FLASH_PROGRAM_TIME_US 70   // worst case tPROG for a half-word
+
+#define SIM_NUM_TIMERS 5
+#define SIM_NUM_TIMER_CHANNELS 4
+#define SIM_NUM_DMA_CHANNELS 5
+
+// the simulator starts with the clocks as setup_clock() leaves them
+uint32_t rcc_ahb_frequency = 48000000;
+uint32_t rcc_apb1_frequency = 48000000;
+
+struct sim_timer {
+    uint32_t base;
+    uint8_t up_dma_channel;                             // DMA channel of the update request, 0 if none
+    uint8_t cc_dma_channel[SIM_NUM_TIMER_CHANNELS];     // DMA channels of the compare requests, 0 if none
+    bool has_break;                                     // outputs stay off until the main output is enabled
+    bool enabled;
+    uint32_t prescaler;
+    uint32_t period;
+    uint32_t repetition;
+    uint32_t repetition_left;                           // periods until the next update event
+    uint32_t oc_value[SIM_NUM_TIMER_CHANNELS];
+    enum tim_oc_mode oc_mode[SIM_NUM_TIMER_CHANNELS];
+    uint8_t oc_enabled;                                 // one bit per channel
+    bool main_output;
+    uint32_t dier;
+    uint32_t sr;
+    uint64_t counter;
+};
+
+// timer channels that can drive a pin through its alternate function
+struct sim_timer_pin {
+    uint32_t gpioport;
+    uint16_t gpio;
+    uint8_t alt_func_num;
+    uint32_t timer_peripheral;
+    enum tim_oc_id oc_id;
+};
+
+struct sim_dma_channel {
+    bool enabled;
+    bool read_from_memory;
+    bool memory_increment;
+    bool circular;
+    uint32_t memory_size;
+    uint32_t peripheral_address;
+    uint32_t memory_address;
+    uint16_t number_of_data;
+    uint16_t remaining;
+};
+
+// DMA request mapping of the STM32F070
+static struct sim_timer sim_timers[SIM_NUM_TIMERS] = {
+    {.base = TIM1_BASE, .up_dma_channel = 5, .cc_dma_channel = {2, 3, 5, 4}, .has_break = true},
+    {.base = TIM3_BASE, .up_dma_channel = 3, .cc_dma_channel = {4, 0, 2, 3}},
+    {.base = TIM14_BASE},
+    {.base = TIM16_BASE, .up_dma_channel = 3, .cc_dma_channel = {3, 0, 0, 0}, .has_break = true},
+    {.base = TIM17_BASE, .up_dma_channel = 1, .cc_dma_channel = {1, 0, 0, 0}, .has_break = true},
+};
+
+// timer outputs on port A of the STM32F070 (complementary outputs are not modelled)
+static const struct sim_timer_pin sim_timer_pins[] = {
+    {GPIOA, GPIO6, GPIO_AF1, TIM3, TIM_OC1},
+    {GPIOA, GPIO6, GPIO_AF5, TIM16, TIM_OC1},
+    {GPIOA, GPIO7, GPIO_AF1, TIM3, TIM_OC2},
+    {GPIOA, GPIO7, GPIO_AF4, TIM14, TIM_OC1},
+    {GPIOA, GPIO7, GPIO_AF5, TIM17, TIM_OC1},
+    {GPIOA, GPIO8, GPIO_AF2, TIM1, TIM_OC1},
+    {GPIOA, GPIO9, GPIO_AF2, TIM1, TIM_OC2},
+    {GPIOA, GPIO10, GPIO_AF2, TIM1, TIM_OC3},
+    {GPIOA, GPIO11, GPIO_AF2, TIM1, TIM_OC4},
+};
+
+static struct sim_dma_channel sim_dma_channels[SIM_NUM_DMA_CHANNELS + 1];
+
+static uint64_t sim_nvic_enabled;  // one bit per external interrupt
+
+static bool sim_systick_counter_enabled;
+static bool sim_systick_interrupt_enabled;
+
+// SysTick clock since power up, with the board's crystal off from the host's frame clock by sim_systick_drift_ppm
+static uint64_t sim_systick_ticks;
+static uint64_t sim_systick_fraction;  // millionths of a tick
+static int32_t sim_systick_drift_ppm;
+static uint64_t sim_systick_next_wrap;  // tick the counter next reloads on while it runs
+static uint64_t sim_systick_remaining;  // ticks it had left when it was stopped, 0 for a reload on the next tick
+
+// EXTI lines 0..15
+static uint32_t sim_exti_port[16];
+static uint16_t sim_exti_enabled;
+static uint16_t sim_exti_rising;
+static uint16_t sim_exti_falling;
+static uint16_t sim_exti_pending;
+static uint16_t sim_gpio_inputs[SIM_NUM_GPIO_PORTS];  // input state at the last edge check
+
+static uint16_t sim_gpio_odr[SIM_NUM_GPIO_PORTS];
+static uint16_t sim_gpio_af_pins[SIM_NUM_GPIO_PORTS];  // pins in alternate function mode
+static uint8_t sim_gpio_af[SIM_NUM_GPIO_PORTS][16];
+static uint16_t sim_matrix[SIM_MATRIX_ROWS];
+
+static bool sim_flash_locked = true;
+static struct sim_flash_stats sim_flash_stats;
+
+static uint32_t sim_gpio_port_idx(uint32_t gpioport) {
+    uint32_t port_idx = (gpioport - GPIO_PORT_A_BASE) / SIM_GPIO_PORT_STRIDE;
+    if ((gpioport < GPIO_PORT_A_BASE) || (port_idx >= SIM_NUM_GPIO_PORTS)) {
+        fprintf(stderr, "sim: access to invalid GPIO port 0x%08x\n", gpioport);
+        abort();
+    }
+    return port_idx;
+}
+
+static uint16_t *sim_gpio_port(uint32_t gpioport) {
+    return &sim_gpio_odr[sim_gpio_port_idx(gpioport)];
+}
+
+void sim_hw_init(void) {
+    memset(sim_gpio_odr, 0, sizeof(sim_gpio_odr));
+    memset(sim_gpio_af_pins, 0, sizeof(sim_gpio_af_pins));
+    memset(sim_gpio_af, 0, sizeof(sim_gpio_af));
+    memset(sim_matrix, 0, sizeof(sim_matrix));
+    memset(&sim_flash_stats, 0, sizeof(sim_flash_stats));
+    memset(sim_dma_channels, 0, sizeof(sim_dma_channels));
+    sim_nvic_enabled = 0;
+    sim_systick_counter_enabled = false;
+    sim_systick_interrupt_enabled = false;
+    sim_systick_ticks = 0;
+    sim_systick_fraction = 0;
+    sim_systick_drift_ppm = 0;
+    sim_systick_next_wrap = 0;
+    sim_systick_remaining = 0;
+    memset(sim_exti_port, 0, sizeof(sim_exti_port));
+    sim_exti_enabled = 0;
+    sim_exti_rising = 0;
+    sim_exti_falling = 0;
+    sim_exti_pending = 0;
+    memset(sim_gpio_inputs, 0, sizeof(sim_gpio_inputs));
+    sim_flash_locked = true;
+
+    for (int i = 0; i < SIM_NUM_TIMERS; i++) {
+        sim_timers[i].enabled = false;
+        sim_timers[i].prescaler = 0;
+        sim_timers[i].period = 0xffff;
+        sim_timers[i].repetition = 0;
+        sim_timers[i].repetition_left = 0;
+        memset(sim_timers[i].oc_value, 0, sizeof(sim_timers[i].oc_value));
+        memset(sim_timers[i].oc_mode, 0, sizeof(sim_timers[i].oc_mode));
+        sim_timers[i].oc_enabled = 0;
+        sim_timers[i].main_output = false;
+        sim_timers[i].dier = 0;
+        sim_timers[i].sr = 0;
+        sim_timers[i].counter = 0;
+    }
+
+    // the firmware addresses flash by its absolute address, so back it with memory at the same place
+    static uint8_t *sim_flash = NULL;
+    if (sim_flash == NULL) {
+        sim_flash = mmap((void *)(uintptr_t)FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (sim_flash != (uint8_t *)(uintptr_t)FLASH_BASE) {
+            fprintf(stderr, "sim: unable to map simulated flash at 0x%08x\n", FLASH_BASE);
+            exit(1);
+        }
+    }
+    memset(sim_flash, 0xff, SIM_FLASH_SIZE);
+}
+
+// latch edges on the EXTI lines after anything that may have changed an input
+static void sim_exti_update(void) {
+    for (int port = 0; port < SIM_NUM_GPIO_PORTS; port++) {
+        uint32_t gpioport = GPIO_PORT_A_BASE + (port * 0x400);
+        uint16_t inputs = gpio_port_read(gpioport);
+        uint16_t rising = inputs & ~sim_gpio_inputs[port];
+        uint16_t falling = ~inputs & sim_gpio_inputs[port];
+        sim_gpio_inputs[port] = inputs;
+
+        for (int line = 0; line < 16; line++) {
+            uint16_t bit = 1 << line;
+            if ((sim_exti_port[line] == gpioport) && (sim_exti_enabled & bit)
+                && (((rising & sim_exti_rising) | (falling & sim_exti_falling)) & bit)) {
+                sim_exti_pending |= bit;
+            }
+        }
+    }
+}
+
+void sim_key_press(uint8_t row, uint8_t col) {
+    sim_matrix[row] |= (uint16_t)(1 << col);
+    sim_exti_update();
+}
+
+void sim_key_release(uint8_t row, uint8_t col) {
+    sim_matrix[row] &= (uint16_t)~(1 << col);
+    sim_exti_update();
+}
+
+void sim_key_release_all(void) {
+    memset(sim_matrix, 0, sizeof(sim_matrix));
+    sim_exti_update();
+}
+
+bool sim_exti_irq_pending(void) {
+    return ((sim_exti_pending & (EXTI0 | EXTI1)) && sim_nvic_irq_enabled(NVIC_EXTI0_1_IRQ))
+        || ((sim_exti_pending & (EXTI2 | EXTI3)) && sim_nvic_irq_enabled(NVIC_EXTI2_3_IRQ))
+        || ((sim_exti_pending & 0xfff0) && sim_nvic_irq_enabled(NVIC_EXTI4_15_IRQ));
+}
+
+bool sim_systick_running(void) {
+    return sim_systick_counter_enabled && sim_systick_interrupt_enabled;
+}
+
+void sim_systick_set_drift_ppm(int32_t ppm) {
+    sim_systick_drift_ppm = ppm;
+}
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig) {
+    if (trig == EXTI_TRIGGER_RISING || trig == EXTI_TRIGGER_BOTH) {
+        sim_exti_rising |= extis;
+    } else {
+        sim_exti_rising &= ~extis;
+    }
+    if (trig == EXTI_TRIGGER_FALLING || trig == EXTI_TRIGGER_BOTH) {
+        sim_exti_falling |= extis;
+    } else {
+        sim_exti_falling &= ~extis;
+    }
+}
+
+void exti_enable_request(uint32_t extis) {
+    sim_exti_update();
+    sim_exti_enabled |= extis;
+}
+
+void exti_disable_request(uint32_t extis) {
+    sim_exti_enabled &= ~extis;
+}
+
+void exti_reset_request(uint32_t extis) {
+    sim_exti_pending &= ~extis;
+}
+
+void exti_select_source(uint32_t exti, uint32_t gpioport) {
+    for (int line = 0; line < 16; line++) {
+        if (exti & (1 << line)) {
+            sim_exti_port[line] = gpioport;
+        }
+    }
+}
+
+uint32_t exti_get_flag_status(uint32_t exti) {
+    return sim_exti_pending & exti;
+}
+
+static struct sim_timer *sim_timer(uint32_t timer_peripheral);
+
+// share of the time a timer channel drives its pin high, in per mille
+static uint32_t sim_timer_duty_permille(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+    struct sim_timer *timer = sim_timer(timer_peripheral);
+    uint32_t ch = oc_id / 2;
+    if (!timer->enabled || !(timer->oc_enabled & (1 << ch)) || (timer->has_break && !timer->main_output)) {
+        return 0;
+    }
+
+    uint32_t steps = timer->period + 1;
+    uint32_t active = (timer->oc_value[ch] < steps) ? timer->oc_value[ch] : steps;
+    switch (timer->oc_mode[ch]) {
+        case TIM_OCM_PWM1:
+            return active * 1000 / steps;
+        case TIM_OCM_PWM2:
+            return (steps - active) * 1000 / steps;
+        case TIM_OCM_FORCE_HIGH:
+            return 1000;
+        default:
+            return 0;
+    }
+}
+
+uint32_t sim_gpio_duty_permille(uint32_t gpioport, uint16_t gpio) {
+    uint32_t port_idx = sim_gpio_port_idx(gpioport);
+    if (!(sim_gpio_af_pins[port_idx] & gpio)) {
+        return (sim_gpio_odr[port_idx] & gpio) ? 1000 : 0;
+    }
+
+    uint8_t alt_func_num = sim_gpio_af[port_idx][__builtin_ctz(gpio)];
+    for (size_t i = 0; i < sizeof(sim_timer_pins) / sizeof(sim_timer_pins[0]); i++) {
+        const struct sim_timer_pin *pin = &sim_timer_pins[i];
+        if ((pin->gpioport == gpioport) && (pin->gpio == gpio) && (pin->alt_func_num == alt_func_num)) {
+            return sim_timer_duty_permille(pin->timer_peripheral, pin->oc_id);
+        }
+    }
+    return 0;
+}
+
+uint16_t sim_gpio_output(uint32_t gpioport) {
+    uint32_t port_idx = sim_gpio_port_idx(gpioport);
+    uint16_t output = sim_gpio_odr[port_idx] & ~sim_gpio_af_pins[port_idx];
+    for (int pin = 0; pin < 16; pin++) {
+        if ((sim_gpio_af_pins[port_idx] & (1 << pin)) && sim_gpio_duty_permille(gpioport, 1 << pin)) {
+            output |= 1 << pin;
+        }
+    }
+    return output;
+}
+
+void sim_flash_get_stats(struct sim_flash_stats *stats) {
+    memcpy(stats, &sim_flash_stats, sizeof(*stats));
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios) {
+    *sim_gpio_port(gpioport) |= gpios;
+    if (sim_exti_enabled) {
+        sim_exti_update();
+    }
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios) {
+    *sim_gpio_port(gpioport) &= ~gpios;
+    if (sim_exti_enabled) {
+        sim_exti_update();
+    }
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios) {
+    return gpio_port_read(gpioport) & gpios;
+}
+
+void gpio_toggle(uint32_t gpioport, uint16_t gpios) {
+    *sim_gpio_port(gpioport) ^= gpios;
+}
+
+uint16_t gpio_port_read(uint32_t gpioport) {
+    if (gpioport != SIM_COL_GPIO_PORT) {
+        return *sim_gpio_port(gpioport);
+    }
+
+    // every driven row shows its pressed keys on the column inputs (the diodes prevent ghosting)
+    uint16_t driven_rows = *sim_gpio_port(SIM_ROW_GPIO_PORT) >> SIM_ROW_START_PIN;
+    uint16_t col_states = 0;
+    for (int row = 0; row < SIM_MATRIX_ROWS; row++) {
+        if (driven_rows & (1 << row)) {
+            col_states |= sim_matrix[row];
+        }
+    }
+    return col_states;
+}
+
+void gpio_port_write(uint32_t gpioport, uint16_t data) {
+    *sim_gpio_port(gpioport) = data;
+}
+
+void gpio_mode_setup(uint32_t gpioport, uint8_t mode, uint8_t pull_up_down, uint16_t gpios) {
+    uint32_t port_idx = sim_gpio_port_idx(gpioport);
+    if (mode == GPIO_MODE_AF) {
+        sim_gpio_af_pins[port_idx] |= gpios;
+    } else {
+        sim_gpio_af_pins[port_idx] &= ~gpios;
+    }
+    (void)pull_up_down;
+}
+
+void gpio_set_output_options(uint32_t gpioport, uint8_t otype, uint8_t speed, uint16_t gpios) {
+    (void)sim_gpio_port(gpioport);
+    (void)otype;
+    (void)speed;
+    (void)gpios;
+}
+
+void gpio_set_af(uint32_t gpioport, uint8_t alt_func_num, uint16_t gpios) {
+    uint32_t port_idx = sim_gpio_port_idx(gpioport);
+    for (int pin = 0; pin < 16; pin++) {
+        if (gpios & (1 << pin)) {
+            sim_gpio_af[port_idx][pin] = alt_func_num;
+        }
+    }
+}
+
+static uint32_t sim_periph_read(uint32_t address) {
+    uint32_t port = address & ~(uint32_t)0x3ff;
+    if ((port >= GPIO_PORT_A_BASE) && (port <= GPIO_PORT_F_BASE) && ((address & 0x3ff) == 0x10)) {
+        return gpio_port_read(port);
+    }
+    fprintf(stderr, "sim: DMA read from unmodelled register 0x%08x\n", address);
+    abort();
+}
+
+static void sim_periph_write(uint32_t address, uint32_t value) {
+    uint32_t port = address & ~(uint32_t)0x3ff;
+    if ((port >= GPIO_PORT_A_BASE) && (port <= GPIO_PORT_F_BASE) && ((address & 0x3ff) == 0x18)) {
+        gpio_set(port, (uint16_t)value);
+        gpio_clear(port, (uint16_t)(value >> 16));
+        return;
+    }
+    fprintf(stderr, "sim: DMA write to unmodelled register 0x%08x\n", address);
+    abort();
+}
+
+static void sim_dma_request(uint8_t channel) {
+    struct sim_dma_channel *dma = &sim_dma_channels[channel];
+    if ((channel == 0) || !dma->enabled || (dma->remaining == 0)) {
+        return;
+    }
+
+    uint32_t size = 1 << (dma->memory_size >> 10);
+    uint32_t index = dma->memory_increment ? (dma->number_of_data - dma->remaining) : 0;
+    uintptr_t memory = (uintptr_t)dma->memory_address + (index * size);
+
+    if (dma->read_from_memory) {
+        uint32_t value = (size == 4) ? *(uint32_t *)memory : (size == 2) ? *(uint16_t *)memory : *(uint8_t *)memory;
+        sim_periph_write(dma->peripheral_address, value);
+    } else {
+        uint32_t value = sim_periph_read(dma->peripheral_address);
+        if (size == 4) {
+            *(uint32_t *)memory = value;
+        } else if (size == 2) {
+            *(uint16_t *)memory = (uint16_t)value;
+        } else {
+            *(uint8_t *)memory = (uint8_t)value;
+        }
+    }
+
+    if (--dma->remaining == 0 && dma->circular) {
+        dma->remaining = dma->number_of_data;
+    }
+}
+
+static struct sim_timer *sim_timer(uint32_t timer_peripheral) {
+    for (int i = 0; i < SIM_NUM_TIMERS; i++) {
+        if (sim_timers[i].base == timer_peripheral) {
+            return &sim_timers[i];
+        }
+    }
+    fprintf(stderr, "sim: access to invalid timer 0x%08x\n", timer_peripheral);
+    abort();
+}
+
+static void sim_timer_update(struct sim_timer *timer) {
+    timer->repetition_left = timer->repetition;
+    timer->sr |= TIM_SR_UIF;
+    if (timer->dier & TIM_DIER_UDE) {
+        sim_dma_request(timer->up_dma_channel);
+    }
+}
+
+// run the timer for one full period: compare events as the counter passes them, then the update event once the
+// repetition counter runs out
+static void sim_timer_period(struct sim_timer *timer) {
+    for (int ch = 0; ch < SIM_NUM_TIMER_CHANNELS; ch++) {
+        if ((timer->dier & (TIM_DIER_CC1DE << ch)) && (timer->oc_value[ch] <= timer->period)) {
+            sim_dma_request(timer->cc_dma_channel[ch]);
+        }
+    }
+    if (timer->repetition_left == 0) {
+        sim_timer_update(timer);
+    } else {
+        timer->repetition_left--;
+    }
+}
+
+bool sim_timer_irq_pending(uint32_t timer_peripheral) {
+    struct sim_timer *timer = sim_timer(timer_peripheral);
+    return (timer->sr & TIM_SR_UIF) && (timer->dier & TIM_DIER_UIE);
+}
+
+void sim_hw_run_us(uint32_t us) {
+    uint64_t millionths = (uint64_t)us * (rcc_ahb_frequency / 8000000) * (1000000 + sim_systick_drift_ppm)
+        + sim_systick_fraction;
+    sim_systick_ticks += millionths / 1000000;
+    sim_systick_fraction = millionths % 1000000;
+
+    for (int i = 0; i < SIM_NUM_TIMERS; i++) {
+        struct sim_timer *timer = &sim_timers[i];
+        if (!timer->enabled) {
+            continue;
+        }
+
+        uint64_t period_ticks = (uint64_t)(timer->prescaler + 1) * (timer->period + 1);
+        timer->counter += (uint64_t)rcc_apb1_frequency / 1000000 * us;
+        while (timer->counter >= period_ticks) {
+            timer->counter -= period_ticks;
+            sim_timer_period(timer);
+        }
+    }
+}
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction) {
+    (void)sim_timer(timer_peripheral);
+    (void)clock_div;
+    (void)alignment;
+    (void)direction;
+}
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value) {
+    sim_timer(timer_peripheral)->prescaler = value;
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period) {
+    sim_timer(timer_peripheral)->period = period;
+}
+
+// takes effect at the next update event, like on the real timer
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value) {
+    sim_timer(timer_peripheral)->repetition = value;
+}
+
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode) {
+    sim_timer(timer_peripheral)->oc_mode[oc_id / 2] = oc_mode;
+}
+
+void timer_set_oc_polarity_high(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+    (void)sim_timer(timer_peripheral);
+    (void)oc_id;
+}
+
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+    sim_timer(timer_peripheral)->oc_enabled |= 1 << (oc_id / 2);
+}
+
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+    sim_timer(timer_peripheral)->oc_enabled &= ~(1 << (oc_id / 2));
+}
+
+void timer_enable_break_main_output(uint32_t timer_peripheral) {
+    sim_timer(timer_peripheral)->main_output = true;
+}
+
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value) {
+    sim_timer(timer_peripheral)->oc_value[oc_id / 2] = value;
+}
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq) {
+    sim_timer(timer_peripheral)->dier |= irq;
+}
+
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq) {
+    sim_timer(timer_peripheral)->dier &= ~irq;
+}
+
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event) {
+    struct sim_timer *timer = sim_timer(timer_peripheral);
+    if (event & TIM_EGR_UG) {
+        timer->counter = 0;
+        sim_timer_update(timer);
+    }
+}
+
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag) {
+    sim_timer(timer_peripheral)->sr &= ~flag;
+}
+
+void timer_enable_counter(uint32_t timer_peripheral) {
+    sim_timer(timer_peripheral)->enabled = true;
+}
+
+void timer_disable_counter(uint32_t timer_peripheral) {
+    sim_timer(timer_peripheral)->enabled = false;
+}
+
+uint32_t timer_get_counter(uint32_t timer_peripheral) {
+    struct sim_timer *timer = sim_timer(timer_peripheral);
+    return (uint32_t)(timer->counter / (timer->prescaler + 1));
+}
+
+static struct sim_dma_channel *sim_dma_channel(uint32_t dma, uint8_t channel) {
+    if ((dma != DMA1) || (channel == 0) || (channel > SIM_NUM_DMA_CHANNELS)) {
+        fprintf(stderr, "sim: access to invalid DMA channel %u\n", channel);
+        abort();
+    }
+    return &sim_dma_channels[channel];
+}
+
+void dma_channel_reset(uint32_t dma, uint8_t channel) {
+    memset(sim_dma_channel(dma, channel), 0, sizeof(struct sim_dma_channel));
+}
+
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio) {
+    (void)sim_dma_channel(dma, channel);
+    (void)prio;
+}
+
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size) {
+    sim_dma_channel(dma, channel)->memory_size = mem_size;
+}
+
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t peripheral_size) {
+    (void)sim_dma_channel(dma, channel);
+    (void)peripheral_size;
+}
+
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->memory_increment = true;
+}
+
+void dma_enable_circular_mode(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->circular = true;
+}
+
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->read_from_memory = false;
+}
+
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->read_from_memory = true;
+}
+
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uint32_t address) {
+    sim_dma_channel(dma, channel)->peripheral_address = address;
+}
+
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uint32_t address) {
+    sim_dma_channel(dma, channel)->memory_address = address;
+}
+
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number) {
+    struct sim_dma_channel *dma_channel = sim_dma_channel(dma, channel);
+    dma_channel->number_of_data = number;
+    dma_channel->remaining = number;
+}
+
+uint16_t dma_get_number_of_data(uint32_t dma, uint8_t channel) {
+    return sim_dma_channel(dma, channel)->remaining;
+}
+
+void dma_enable_channel(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->enabled = true;
+}
+
+void dma_disable_channel(uint32_t dma, uint8_t channel) {
+    sim_dma_channel(dma, channel)->enabled = false;
+}
+
+static bool sim_flash_check(uint32_t address, uint32_t alignment) {
+    if (sim_flash_locked) {
+        fprintf(stderr, "sim: flash write to 0x%08x while locked\n", address);
+        sim_flash_stats.errors++;
+        return false;
+    }
+    if ((address < FLASH_BASE) || (address >= FLASH_BASE + SIM_FLASH_SIZE) || (address % alignment)) {
+        fprintf(stderr, "sim: invalid flash address 0x%08x\n", address);
+        sim_flash_stats.errors++;
+        return false;
+    }
+    return true;
+}
+
+void flash_prefetch_enable(void) {}
+
+void flash_prefetch_disable(void) {}
+
+void flash_set_ws(uint32_t ws) {
+    (void)ws;
+}
+
+void flash_unlock(void) {
+    sim_flash_locked = false;
+}
+
+void flash_lock(void) {
+    sim_flash_locked = true;
+}
+
+void flash_erase_page(uint32_t page_address) {
+    if (!sim_flash_check(page_address, 1)) {
+        return;
+    }
+    page_address -= (page_address - FLASH_BASE) % SIM_FLASH_PAGE_SIZE;
+    memset((uint8_t *)(uintptr_t)page_address, 0xff, SIM_FLASH_PAGE_SIZE);
+    sim_flash_stats.erases++;
+    sim_flash_stats.busy_us += SIM_FLASH_ERASE_TIME_US;
+}
+
+void flash_program_half_word(uint32_t address, uint16_t data) {
+    if (!sim_flash_check(address, sizeof(uint16_t))) {
+        return;
+    }
+
+    // PGERR: the F0 refuses to program a half-word that is not erased, unless it is being cleared to zero
+    uint16_t *cell = (uint16_t *)(uintptr_t)address;
+    if ((*cell != 0xffff) && (data != 0x0000)) {
+        fprintf(stderr, "sim: programming non-erased flash at 0x%08x\n", address);
+        sim_flash_stats.errors++;
+        return;
+    }
+    *cell = data;
+    sim_flash_stats.programs++;
+    sim_flash_stats.busy_us += SIM_FLASH_PROGRAM_TIME_US;
+}
+
+void flash_program_word(uint32_t address, uint32_t data) {
+    flash_program_half_word(address, (uint16_t)data);
+    flash_program_half_word(address + sizeof(uint16_t), (uint16_t)(data >> 16));
+}
+
+void rcc_osc_on(enum rcc_osc osc) {
+    (void)osc;
+}
+
+void rcc_wait_for_osc_ready(enum rcc_osc osc) {
+    (void)osc;
+}
+
+void rcc_set_sysclk_source(enum rcc_osc clk) {
+    (void)clk;
+}
+
+void rcc_set_usbclk_source(enum rcc_osc clk) {
+    (void)clk;
+}
+
+void rcc_set_hpre(uint32_t hpre) {
+    (void)hpre;
+}
+
+void rcc_set_ppre(uint32_t ppre) {
+    (void)ppre;
+}
+
+void rcc_set_pll_multiplication_factor(uint32_t mul) {
+    (void)mul;
+}
+
+void rcc_set_pll_source(uint32_t pllsrc) {
+    (void)pllsrc;
+}
+
+void rcc_set_pllxtpre(uint32_t pllxtpre) {
+    (void)pllxtpre;
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken) {
+    (void)clken;
+}
+
+void rcc_periph_clock_disable(enum rcc_periph_clken clken) {
+    (void)clken;
+}
+
+static uint32_t sim_systick_reload;
+
+void systick_set_reload(uint32_t value) {
+    sim_systick_reload = value;
+}
+
+uint32_t systick_get_reload(void) {
+    return sim_systick_reload;
+}
+
+bool systick_set_frequency(uint32_t freq, uint32_t ahb) {
+    sim_systick_reload = (ahb / 8 / freq) - 1;
+    return true;
+}
+
+// counts down to 0 and takes the reload value the tick after, which is when the interrupt goes off
+uint32_t systick_get_value(void) {
+    if (!sim_systick_counter_enabled) {
+        return (sim_systick_remaining > 0) ? (uint32_t)(sim_systick_remaining - 1) : 0;
+    }
+    if (sim_systick_next_wrap <= sim_systick_ticks) {
+        return 0;
+    }
+    return (uint32_t)(sim_systick_next_wrap - sim_systick_ticks - 1);
+}
+
+bool sim_systick_irq_pending(void) {
+    if (!sim_systick_running() || (sim_systick_next_wrap > sim_systick_ticks)) {
+        return false;
+    }
+    // the period that starts now is the reload value as it is at the wrap
+    sim_systick_next_wrap += (uint64_t)sim_systick_reload + 1;
+    return true;
+}
+
+int64_t sim_systick_ticks_to_wrap(void) {
+    return (int64_t)(sim_systick_next_wrap - sim_systick_ticks);
+}
+
+void systick_set_clocksource(uint8_t clocksource) {
+    (void)clocksource;
+}
+
+void systick_interrupt_enable(void) {
+    sim_systick_interrupt_enabled = true;
+}
+
+void systick_interrupt_disable(void) {
+    sim_systick_interrupt_enabled = false;
+}
+
+void systick_counter_enable(void) {
+    if (!sim_systick_counter_enabled) {
+        uint64_t remaining = sim_systick_remaining ? sim_systick_remaining : ((uint64_t)sim_systick_reload + 1);
+        sim_systick_next_wrap = sim_systick_ticks + remaining;
+    }
+    sim_systick_counter_enabled = true;
+}
+
+// the counter holds its value while stopped
+void systick_counter_disable(void) {
+    if (sim_systick_counter_enabled) {
+        sim_systick_remaining =
+            (sim_systick_next_wrap > sim_systick_ticks) ? (sim_systick_next_wrap - sim_systick_ticks) : 0;
+    }
+    sim_systick_counter_enabled = false;
+}
+
+void nvic_enable_irq(uint8_t irqn) {
+    sim_nvic_enabled |= (uint64_t)1 << irqn;
+}
+
+void nvic_disable_irq(uint8_t irqn) {
+    sim_nvic_enabled &= ~((uint64_t)1 << irqn);
+}
+
+bool sim_nvic_irq_enabled(uint8_t irqn) {
+    return sim_nvic_enabled & ((uint64_t)1 << irqn);
+}
+
+void nvic_clear_pending_irq(uint8_t irqn) {
+    (void)irqn;
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority) {
+    (void)irqn;
+    (void)priority;
+}
@@ -0,0 +1,953 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulator entry point - boots the firmware, plays a short typing scenario through the simulated matrix, checks
+ * what the host received and benchmarks a scan tick followed by a main loop pass.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "config.h"
+#include "event_queue.h"
+#include "flash_store.h"
+#include "hid_codes.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "latency.h"
+#include "macro.h"
+#include "trace.h"
+#include "usb_hid.h"
+
+#define SIM_KEY_TIMEOUT_MS 100
+#define SIM_BOUNCE_MS 5
+#define SIM_HOLD_MS 10  // long enough for any debounce mode to see the key settle
+#define SIM_DECISION_MS 16  // from the event that decides a dual-role key to the host, debounce included
+#define SIM_BENCH_POLLS 1000000
+#define SIM_SOF_DRIFT_PPM 300  // the board's crystal against the host's, each way
+#define SIM_SOF_SETTLE_MS 20
+#define SIM_SOF_LOCK_MS 500
+#define SIM_SOF_TOLERANCE_US 2
+
+// flash store area hammered by the scenario, clear of the macros, key map and settings
+#define SIM_STORE_TEST_ADDR 960
+#define SIM_STORE_TEST_SIZE 64
+#define SIM_STORE_TEST_WRITES 1000
+
+// typed by the snippet macro
+#define SIM_SNIPPET "Hello, World! The quick brown fox jumps over the lazy dog 1234567890 times... (really)"
+#define SIM_MACRO_TIMEOUT_MS 2000
+#define SIM_MACRO_CHUNK_SIZE 64  // within what the flash store batches in one write
+#define SIM_COMMIT_MS (KEYBOARD_COMMIT_IDLE_MS + 500)  // the main loop commits everything waiting once idle
+
+#define SIM_LED_PINS (GPIO7 | GPIO8 | GPIO9)
+#define SIM_CAPLK_LED_PIN GPIO8
+#define SIM_ROW_PINS 0x7f
+
+#define SIM_CHECK(cond, ...) do {           \
+        if (!(cond)) {                      \
+            printf("FAIL: " __VA_ARGS__);   \
+            printf("\n");                   \
+            sim_failures++;                 \
+        }                                   \
+    } while (0)
+
+struct sim_key {
+    uint8_t row;
+    uint8_t col;
+    uint8_t key_code;
+};
+
+static const struct sim_key sim_key_a = {.row = 2, .col = 1, .key_code = KEY_A};
+static const struct sim_key sim_key_1 = {.row = 0, .col = 1, .key_code = KEY_1};
+static const struct sim_key sim_key_fn_1 = {.row = 0, .col = 1, .key_code = KEY_F1};
+static const struct sim_key sim_key_fn_macro = {.row = 1, .col = 1, .key_code = KEY_A};
+static const struct sim_key sim_key_fn_snippet = {.row = 1, .col = 2, .key_code = KEY_NONE};
+static const struct sim_key sim_key_nav_w = {.row = 1, .col = 2, .key_code = KEY_UP};
+static const struct sim_key sim_key_fn = {.row = 0, .col = 14, .key_code = KEY_NONE};
+static const struct sim_key sim_key_fn_one_shot = {.row = 0, .col = 15, .key_code = KEY_NONE};
+static const struct sim_key sim_key_nav_toggle = {.row = 1, .col = 14, .key_code = KEY_NONE};
+static const struct sim_key sim_key_lshift = {.row = 3, .col = 0, .key_code = KEY_LEFTSHIFT};
+static const struct sim_key sim_key_caps = {.row = 2, .col = 0, .key_code = KEY_CAPSLOCK};
+static const struct sim_key sim_rollover_keys[] = {
+    {.row = 1, .col = 1, .key_code = KEY_Q},
+    {.row = 1, .col = 2, .key_code = KEY_W},
+    {.row = 1, .col = 3, .key_code = KEY_E},
+    {.row = 1, .col = 4, .key_code = KEY_R},
+    {.row = 1, .col = 5, .key_code = KEY_T},
+    {.row = 1, .col = 6, .key_code = KEY_Y},
+    {.row = 1, .col = 7, .key_code = KEY_U},
+};
+
+static int sim_failures;
+
+// run until the host sees the key in the given state, returns the time it took or -1 on timeout
+static int sim_wait_for_key(uint8_t key_code, bool down) {
+    for (int ms = 0; ms <= SIM_KEY_TIMEOUT_MS; ms++) {
+        if (sim_host_key_down(key_code) == down) {
+            return ms;
+        }
+        sim_run_ms(1);
+    }
+    return -1;
+}
+
+// run until the host has seen the key pressed the given number of times, returns the time it took or -1 on timeout
+static int sim_wait_for_presses(uint8_t key_code, uint32_t presses) {
+    for (int ms = 0; ms <= SIM_KEY_TIMEOUT_MS; ms++) {
+        if (sim_host_key_presses(key_code) >= presses) {
+            return ms;
+        }
+        sim_run_ms(1);
+    }
+    return -1;
+}
+
+// press or release a key and give it time to settle
+static void sim_hold(const struct sim_key *key, bool pressed) {
+    if (pressed) {
+        sim_key_press(key->row, key->col);
+    } else {
+        sim_key_release(key->row, key->col);
+    }
+    sim_run_ms(SIM_HOLD_MS);
+}
+
+static int sim_tap(const struct sim_key *key) {
+    sim_key_press(key->row, key->col);
+    int latency_ms = sim_wait_for_key(key->key_code, true);
+    SIM_CHECK(latency_ms >= 0, "key %02x (%u, %u) never reported as pressed", key->key_code, key->row, key->col);
+    sim_key_release(key->row, key->col);
+    SIM_CHECK(sim_wait_for_key(key->key_code, false) >= 0, "key %02x never reported as released", key->key_code);
+    return latency_ms;
+}
+
+// toggle the key every other millisecond for the bounce time before it settles in the new state
+static void sim_bounce(const struct sim_key *key, bool pressed) {
+    for (int ms = 0; ms < SIM_BOUNCE_MS; ms++) {
+        if (((ms / 2) % 2 == 0) == pressed) {
+            sim_key_press(key->row, key->col);
+        } else {
+            sim_key_release(key->row, key->col);
+        }
+        sim_run_ms(1);
+    }
+
+    if (pressed) {
+        sim_key_press(key->row, key->col);
+    } else {
+        sim_key_release(key->row, key->col);
+    }
+}
+
+// encode text as macro steps, returns the number of bytes
+static size_t sim_macro_text(uint8_t *steps, const char *text) {
+    size_t len = 0;
+    for (; *text; text++) {
+        uint8_t key_code;
+        bool shifted;
+        if (!sim_char_to_key(*text, &key_code, &shifted)) {
+            continue;
+        }
+        if (shifted) {
+            steps[len++] = MACRO_SHIFT;
+        }
+        steps[len++] = key_code;
+    }
+    return len;
+}
+
+// run until a macro has started and finished again, returns the time it played for or -1 on timeout
+static int sim_wait_for_macro(void) {
+    for (int ms = 0; (ms <= SIM_KEY_TIMEOUT_MS) && !macro_playing(); ms++) {
+        sim_run_ms(1);
+    }
+    for (int ms = 0; ms <= SIM_MACRO_TIMEOUT_MS; ms++) {
+        if (!macro_playing()) {
+            // the last reports are still on their way to the host
+            sim_run_ms(SIM_HOLD_MS);
+            return ms;
+        }
+        sim_run_ms(1);
+    }
+    return -1;
+}
+
+// send a request to the config interface and wait for the response, returns the time it took or -1 on timeout
+static int sim_config(const uint8_t *request, size_t len, uint8_t *response) {
+    uint8_t report[USB_HID_CONFIG_REPORT_SIZE] = {0};
+    memcpy(report, request, len);
+    sim_host_send_config_request(report);
+    for (int ms = 0; ms <= SIM_KEY_TIMEOUT_MS; ms++) {
+        if (sim_host_get_config_response(response)) {
+            return ms;
+        }
+        sim_run_ms(1);
+    }
+    memset(response, 0, USB_HID_CONFIG_REPORT_SIZE);
+    return -1;
+}
+
+#if TRACE_EVENTS
+// read the trace over the config interface from the given sequence number on, returns the number of events read and
+// sets the sequence number to that of the first one, or -1 on error
+static int sim_read_trace(uint32_t *sequence, struct trace_entry *entries) {
+    uint8_t request[] = {CONFIG_CMD_GET_TRACE, 5, *sequence, *sequence >> 8, *sequence >> 16, *sequence >> 24,
+        (USB_HID_CONFIG_REPORT_SIZE - 7) / 8};
+    uint8_t response[USB_HID_CONFIG_REPORT_SIZE];
+    if ((sim_config(request, sizeof(request), response) < 0) || (response[1] != CONFIG_STATUS_OK)) {
+        return -1;
+    }
+
+    *sequence = response[3] | (response[4] << 8) | (response[5] << 16) | ((uint32_t)response[6] << 24);
+    int count = (response[2] - 4) / 8;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *entry = &response[7 + (8 * i)];
+        entries[i].time_us = entry[0] | (entry[1] << 8) | (entry[2] << 16) | ((uint32_t)entry[3] << 24);
+        entries[i].event = entry[4];
+        entries[i].arg = entry[5];
+        entries[i].value = entry[6] | (entry[7] << 8);
+    }
+    return count;
+}
+
+// index of the first traced event of the given kind from the given index on, or -1
+static int sim_find_trace(const struct trace_entry *entries, int num_entries, int from, uint8_t event, uint8_t arg) {
+    for (int i = (from < 0) ? num_entries : from; i < num_entries; i++) {
+        if ((entries[i].event == event) && (entries[i].arg == arg)) {
+            return i;
+        }
+    }
+    return -1;
+}
+#endif
+
+static void sim_scenario(void) {
+    sim_boot();
+
+    // LED self test
+    sim_run_ms(100);
+    SIM_CHECK((sim_gpio_output(GPIOA) & SIM_LED_PINS) == SIM_LED_PINS, "LEDs are not lit during the self test");
+    sim_run_ms(1000);
+    SIM_CHECK((sim_gpio_output(GPIOA) & SIM_LED_PINS) == 0, "LEDs are still lit after the self test");
+
+    // plain key tap
+    sim_tap(&sim_key_a);
+
+    // Fn held: its own keys, a macro slot (default macro, nothing stored in flash yet) and a transparent key
+    sim_hold(&sim_key_fn, true);
+    sim_tap(&sim_key_fn_1);
+    sim_tap(&sim_key_fn_macro);
+    sim_tap(&sim_key_a);
+    sim_hold(&sim_key_fn, false);
+    sim_tap(&sim_key_1);
+
+    // a key pressed on the Fn layer is released as the same key, even if Fn goes up first
+    sim_hold(&sim_key_fn, true);
+    sim_hold(&sim_key_fn_1, true);
+    sim_hold(&sim_key_fn, false);
+    SIM_CHECK(sim_host_key_down(KEY_F1) && !sim_host_key_down(KEY_1), "key changed when its layer went away");
+    sim_hold(&sim_key_fn_1, false);
+    SIM_CHECK(sim_wait_for_key(KEY_F1, false) >= 0, "key stuck after its layer went away");
+
+    // one-shot Fn only lasts for the next key press
+    sim_hold(&sim_key_fn_one_shot, true);
+    sim_hold(&sim_key_fn_one_shot, false);
+    sim_tap(&sim_key_fn_1);
+    sim_tap(&sim_key_1);
+
+    // toggled Nav layer stays on until toggled off again
+    sim_hold(&sim_key_nav_toggle, true);
+    sim_hold(&sim_key_nav_toggle, false);
+    sim_tap(&sim_key_nav_w);
+    sim_tap(&sim_key_nav_w);
+    sim_hold(&sim_key_nav_toggle, true);
+    sim_hold(&sim_key_nav_toggle, false);
+    sim_tap(&sim_rollover_keys[1]);
+
+    // Caps Lock is Caps Lock by default, and Esc when tapped and Ctrl when held once remapped to a dual-role key - a
+    // tap goes out right on the release, a hold once the tapping term is over
+    sim_tap(&sim_key_caps);
+    uint8_t config_response[USB_HID_CONFIG_REPORT_SIZE];
+    uint16_t dual_role = MT(KEY_MOD_LCTRL, KEY_ESC);
+    uint8_t dual_role_request[] = {CONFIG_CMD_SET_KEYMAP, 5, 0, sim_key_caps.row, sim_key_caps.col,
+        (uint8_t)dual_role, (uint8_t)(dual_role >> 8)};
+    sim_config(dual_role_request, sizeof(dual_role_request), config_response);
+    SIM_CHECK(config_response[1] == CONFIG_STATUS_OK, "Caps Lock not remapped to a dual-role key");
+    uint32_t esc_presses = sim_host_key_presses(KEY_ESC);
+    uint32_t a_presses = sim_host_key_presses(KEY_A);
+    sim_key_press(sim_key_caps.row, sim_key_caps.col);
+    sim_run_ms(KEYBOARD_TAPPING_TERM_MS / 2);
+    SIM_CHECK(!sim_host_key_down(KEY_ESC) && !sim_host_key_down(KEY_LEFTCTRL),
+        "dual-role key decided while held within its tapping term");
+    sim_key_release(sim_key_caps.row, sim_key_caps.col);
+    int decision_ms = sim_wait_for_presses(KEY_ESC, esc_presses + 1);
+    SIM_CHECK((decision_ms >= 0) && (decision_ms <= SIM_DECISION_MS), "dual-role key tap sent after %d ms",
+        decision_ms);
+    SIM_CHECK(sim_wait_for_key(KEY_ESC, false) >= 0, "dual-role key tap not released");
+
+    sim_key_press(sim_key_caps.row, sim_key_caps.col);
+    sim_run_ms(KEYBOARD_TAPPING_TERM_MS - SIM_HOLD_MS);
+    SIM_CHECK(!sim_host_key_down(KEY_LEFTCTRL), "dual-role key held before its tapping term");
+    decision_ms = sim_wait_for_key(KEY_LEFTCTRL, true);
+    SIM_CHECK((decision_ms >= 0) && (decision_ms <= SIM_HOLD_MS + SIM_DECISION_MS),
+        "dual-role key not held after its tapping term");
+    sim_hold(&sim_key_caps, false);
+    SIM_CHECK(!sim_host_key_down(KEY_LEFTCTRL) && (sim_host_key_presses(KEY_ESC) == esc_presses + 1),
+        "held dual-role key not released");
+
+    // another key tapped while it is down makes it a hold right away (permissive hold)
+    sim_hold(&sim_key_caps, true);
+    sim_hold(&sim_key_a, true);
+    SIM_CHECK(!sim_host_key_down(KEY_LEFTCTRL) && !sim_host_key_down(KEY_A), "key not held back");
+    sim_key_release(sim_key_a.row, sim_key_a.col);
+    decision_ms = sim_wait_for_presses(KEY_A, a_presses + 1);
+    SIM_CHECK((decision_ms >= 0) && (decision_ms <= SIM_DECISION_MS) && sim_host_key_down(KEY_LEFTCTRL),
+        "dual-role key not held after another key was tapped");
+    sim_hold(&sim_key_caps, false);
+    SIM_CHECK(!sim_host_key_down(KEY_LEFTCTRL) && !sim_host_key_down(KEY_A), "keys stuck after a permissive hold");
+
+    // rolling over to the next key is still a tap, sent before it
+    sim_hold(&sim_key_caps, true);
+    sim_hold(&sim_key_a, true);
+    sim_key_release(sim_key_caps.row, sim_key_caps.col);
+    decision_ms = sim_wait_for_presses(KEY_A, a_presses + 2);
+    SIM_CHECK((decision_ms >= 0) && (decision_ms <= SIM_DECISION_MS)
+        && (sim_host_key_presses(KEY_ESC) == esc_presses + 2) && !sim_host_key_down(KEY_LEFTCTRL),
+        "roll from a dual-role key not sent as a tap");
+    sim_hold(&sim_key_a, false);
+
+    // with interrupt resolution, any other key press makes it a hold
+    keyboard_set_tap_hold(KEYBOARD_TAP_HOLD_INTERRUPT, KEYBOARD_TAPPING_TERM_MS);
+    sim_hold(&sim_key_caps, true);
+    sim_key_press(sim_key_a.row, sim_key_a.col);
+    decision_ms = sim_wait_for_presses(KEY_A, a_presses + 3);
+    SIM_CHECK((decision_ms >= 0) && (decision_ms <= SIM_DECISION_MS) && sim_host_key_down(KEY_LEFTCTRL),
+        "dual-role key not held when interrupted");
+    sim_hold(&sim_key_a, false);
+    sim_hold(&sim_key_caps, false);
+    keyboard_set_tap_hold(KEYBOARD_TAP_HOLD_DEFAULT_MODE, KEYBOARD_TAPPING_TERM_MS);
+    uint8_t caps_reset_request[] = {CONFIG_CMD_RESET_KEYMAP, 0};
+    sim_config(caps_reset_request, sizeof(caps_reset_request), config_response);
+    sim_tap(&sim_key_caps);
+
+    // a stored text snippet plays back at one character per report, with a held Shift neither leaking into it nor
+    // getting lost
+    uint8_t macros[MACRO_STORE_SIZE];
+    size_t macros_len = 0;
+    macros[macros_len++] = KEY_A;
+    macros[macros_len++] = MACRO_END;
+    macros_len += sim_macro_text(&macros[macros_len], SIM_SNIPPET);
+    macros[macros_len++] = MACRO_END;
+    uint8_t copy_paste[] = {MACRO_PRESS, KEY_LEFTCTRL, KEY_C, MACRO_DELAY, 50, KEY_V, MACRO_RELEASE, KEY_LEFTCTRL,
+        MACRO_END, MACRO_END};
+    memcpy(&macros[macros_len], copy_paste, sizeof(copy_paste));
+    macros_len += sizeof(copy_paste);
+    memset(&macros[macros_len], MACRO_END, sizeof(macros) - macros_len);
+    for (uint16_t offset = 0; offset < sizeof(macros); offset += SIM_MACRO_CHUNK_SIZE) {
+        uint16_t chunk_size = ((sizeof(macros) - offset) < SIM_MACRO_CHUNK_SIZE) ? (sizeof(macros) - offset)
+            : SIM_MACRO_CHUNK_SIZE;
+        SIM_CHECK(macro_write(offset, &macros[offset], chunk_size), "macros not stored at %u", offset);
+    }
+    SIM_CHECK(macro_load(), "stored macros not loaded");
+
+    sim_host_clear_text();
+    sim_hold(&sim_key_lshift, true);
+    sim_hold(&sim_key_fn, true);
+    uint32_t reports_before = sim_host_num_reports();
+    sim_key_press(sim_key_fn_snippet.row, sim_key_fn_snippet.col);
+    int snippet_ms = sim_wait_for_macro();
+    SIM_CHECK(snippet_ms >= 0, "snippet macro still playing after %u ms", SIM_MACRO_TIMEOUT_MS);
+    SIM_CHECK(strcmp(sim_host_get_text(), SIM_SNIPPET) == 0, "snippet macro typed \"%s\"", sim_host_get_text());
+    SIM_CHECK(sim_host_key_down(KEY_LEFTSHIFT), "Shift released by the snippet macro");
+    printf("macro playback: %zu characters in %d ms, %u reports\n", strlen(SIM_SNIPPET), snippet_ms,
+        sim_host_num_reports() - reports_before);
+    sim_hold(&sim_key_fn_snippet, false);
+    sim_hold(&sim_key_fn, false);
+    sim_hold(&sim_key_lshift, false);
+
+    // held modifiers and delays
+    sim_host_clear_text();
+    sim_hold(&sim_key_fn, true);
+    sim_key_press(1, 3);
+    SIM_CHECK(sim_wait_for_macro() >= 50, "macro delay skipped");
+    SIM_CHECK((strcmp(sim_host_get_text(), "cv") == 0) && !sim_host_key_down(KEY_LEFTCTRL),
+        "copy and paste macro typed \"%s\"", sim_host_get_text());
+    sim_key_release(1, 3);
+    sim_hold(&sim_key_fn, false);
+
+    // modifier held while another key is tapped
+    sim_key_press(sim_key_lshift.row, sim_key_lshift.col);
+    SIM_CHECK(sim_wait_for_key(KEY_LEFTSHIFT, true) >= 0, "left shift never reported as pressed");
+    sim_tap(&sim_key_a);
+    SIM_CHECK(sim_host_key_down(KEY_LEFTSHIFT), "left shift released while tapping A");
+    sim_key_release(sim_key_lshift.row, sim_key_lshift.col);
+    SIM_CHECK(sim_wait_for_key(KEY_LEFTSHIFT, false) >= 0, "left shift never reported as released");
+
+    // more keys than the boot report can hold - all of them reach the host in report protocol
+    size_t num_rollover_keys = sizeof(sim_rollover_keys) / sizeof(sim_rollover_keys[0]);
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        sim_key_press(sim_rollover_keys[i].row, sim_rollover_keys[i].col);
+    }
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        SIM_CHECK(sim_wait_for_key(sim_rollover_keys[i].key_code, true) >= 0, "key %02x lost in NKRO roll over",
+            sim_rollover_keys[i].key_code);
+    }
+
+    // while the BIOS uses the boot protocol, the same keys are a roll over error
+    sim_host_set_boot_protocol(true);
+    sim_run_ms(SIM_KEY_TIMEOUT_MS);
+    SIM_CHECK(sim_host_rollover_error(), "no roll over error with %zu keys held", num_rollover_keys);
+    sim_key_release(sim_rollover_keys[0].row, sim_rollover_keys[0].col);
+    sim_run_ms(SIM_KEY_TIMEOUT_MS);
+    SIM_CHECK(!sim_host_rollover_error(), "roll over error still reported with 6 keys held");
+    for (size_t i = 1; i < num_rollover_keys; i++) {
+        SIM_CHECK(sim_host_key_down(sim_rollover_keys[i].key_code), "key %02x missing from the boot report",
+            sim_rollover_keys[i].key_code);
+    }
+    sim_key_release_all();
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        SIM_CHECK(sim_wait_for_key(sim_rollover_keys[i].key_code, false) >= 0, "key %02x stuck after roll over",
+            sim_rollover_keys[i].key_code);
+    }
+    sim_host_set_boot_protocol(false);
+    sim_run_ms(10);
+
+    // switch chatter on press and release must still give exactly one press and one release
+    for (int i = 0; i < 2 * KEYBOARD_POLL_INTERVAL_MS * NUM_ROWS; i++) {
+        uint32_t num_reports = sim_host_num_reports();
+        sim_bounce(&sim_key_a, true);
+        SIM_CHECK(sim_wait_for_key(KEY_A, true) >= 0, "bouncing key never reported as pressed");
+        sim_run_ms(30);
+        sim_bounce(&sim_key_a, false);
+        SIM_CHECK(sim_wait_for_key(KEY_A, false) >= 0, "bouncing key never reported as released");
+        sim_run_ms(30 + i);
+        SIM_CHECK(sim_host_num_reports() - num_reports == 2, "bouncing key sent %u reports",
+            sim_host_num_reports() - num_reports);
+    }
+
+    // taps while the host isn't polling are queued and all reach it, in order, once it catches up
+    uint32_t presses[4];
+    sim_host_set_paused(true);
+    for (size_t i = 0; i < 4; i++) {
+        presses[i] = sim_host_key_presses(sim_rollover_keys[i].key_code);
+        sim_key_press(sim_rollover_keys[i].row, sim_rollover_keys[i].col);
+        sim_run_ms(SIM_HOLD_MS);
+        sim_key_release(sim_rollover_keys[i].row, sim_rollover_keys[i].col);
+        sim_run_ms(SIM_HOLD_MS);
+    }
+    sim_host_set_paused(false);
+    sim_run_ms(SIM_KEY_TIMEOUT_MS);
+    for (size_t i = 0; i < 4; i++) {
+        SIM_CHECK(sim_host_key_presses(sim_rollover_keys[i].key_code) == presses[i] + 1,
+            "key %02x tapped while the host was busy arrived %u times", sim_rollover_keys[i].key_code,
+            sim_host_key_presses(sim_rollover_keys[i].key_code) - presses[i]);
+    }
+    SIM_CHECK(usb_hid_get_report_overflows() == 0, "%u reports overwritten", usb_hid_get_report_overflows());
+
+    // while the host takes no reports, the releases merge into the report still waiting for the endpoint - the
+    // presses before them don't, the host sees them in order, and neither does the release of the key pressed last
+    reports_before = sim_host_num_reports();
+    sim_host_set_paused(true);
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        sim_key_press(sim_rollover_keys[i].row, sim_rollover_keys[i].col);
+        sim_run_ms(SIM_HOLD_MS);
+    }
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        sim_key_release(sim_rollover_keys[i].row, sim_rollover_keys[i].col);
+        sim_run_ms(SIM_HOLD_MS);
+    }
+    sim_host_set_paused(false);
+    sim_run_ms(SIM_KEY_TIMEOUT_MS);
+    SIM_CHECK(sim_host_num_reports() - reports_before == num_rollover_keys + 1, "%u reports for %zu keys pressed and "
+        "released", sim_host_num_reports() - reports_before, num_rollover_keys);
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        SIM_CHECK(sim_host_key_presses(sim_rollover_keys[i].key_code) > 0, "key %02x lost while the host paused",
+            sim_rollover_keys[i].key_code);
+        SIM_CHECK(!sim_host_key_down(sim_rollover_keys[i].key_code), "key %02x stuck after merged reports",
+            sim_rollover_keys[i].key_code);
+    }
+    SIM_CHECK(usb_hid_get_report_overflows() == 0, "%u reports overwritten", usb_hid_get_report_overflows());
+
+    // a tap takes two reports even then, so a few rounds are more changes than the queue holds - some intermediate
+    // states are lost, but never the final one
+    sim_host_set_paused(true);
+    for (size_t i = 0; i < 2 * num_rollover_keys; i++) {
+        sim_hold(&sim_rollover_keys[i % num_rollover_keys], true);
+        sim_hold(&sim_rollover_keys[i % num_rollover_keys], false);
+    }
+    sim_host_set_paused(false);
+    sim_run_ms(SIM_KEY_TIMEOUT_MS);
+    SIM_CHECK(usb_hid_get_report_overflows() > 0, "report queue never overflowed");
+    for (size_t i = 0; i < num_rollover_keys; i++) {
+        SIM_CHECK(!sim_host_key_down(sim_rollover_keys[i].key_code), "key %02x stuck after a report queue overflow",
+            sim_rollover_keys[i].key_code);
+    }
+
+    // LED state from the host
+    sim_host_set_leds(0x02);
+    sim_run_ms(10);
+    SIM_CHECK((sim_gpio_output(GPIOA) & SIM_LED_PINS) == SIM_CAPLK_LED_PIN, "Caps Lock LED not lit by Set_Report");
+
+    // brightness is gamma corrected, a quarter of full scale comes out well under a tenth of the on time
+    uint8_t dim_request[] = {CONFIG_CMD_SET_SETTING, 2, CONFIG_SETTING_LED_BRIGHTNESS, 64};
+    uint8_t dim_response[USB_HID_CONFIG_REPORT_SIZE];
+    sim_config(dim_request, sizeof(dim_request), dim_response);
+    uint32_t dim_permille = sim_gpio_duty_permille(GPIOA, SIM_CAPLK_LED_PIN);
+    SIM_CHECK((dim_response[1] == CONFIG_STATUS_OK) && (dim_permille > 0) && (dim_permille < 100),
+        "Caps Lock LED at %u per mille for brightness 64", dim_permille);
+    dim_request[3] = 0xff;
+    sim_config(dim_request, sizeof(dim_request), dim_response);
+    SIM_CHECK(sim_gpio_duty_permille(GPIOA, SIM_CAPLK_LED_PIN) > dim_permille, "LED brightness not restored");
+    sim_host_set_leds(0x00);
+    sim_run_ms(10);
+
+#if TRACE_EVENTS
+    // the trace follows the LED state from the host and a key tap from the matrix to the host, in order
+    uint8_t trace_clear_request[] = {CONFIG_CMD_CLEAR_TRACE, 0};
+    uint8_t trace_response[USB_HID_CONFIG_REPORT_SIZE];
+    sim_config(trace_clear_request, sizeof(trace_clear_request), trace_response);
+    sim_host_set_leds(0x04);
+    sim_run_ms(10);
+    sim_tap(&sim_key_a);
+    sim_run_ms(SIM_HOLD_MS);
+    struct trace_entry trace[64];
+    int num_trace = 0;
+    bool trace_ok = true;
+    for (uint32_t sequence = 0; num_trace <= (int)(sizeof(trace) / sizeof(trace[0])) - 3;) {
+        uint32_t first = sequence;
+        int count = sim_read_trace(&first, &trace[num_trace]);
+        trace_ok = trace_ok && (count >= 0) && (first == sequence);
+        if (count <= 0) {
+            break;
+        }
+        num_trace += count;
+        sequence += count;
+    }
+    for (int i = 1; i < num_trace; i++) {
+        trace_ok = trace_ok && (trace[i].time_us >= trace[i - 1].time_us);
+    }
+    int trace_leds = sim_find_trace(trace, num_trace, 0, TRACE_EVENT_LEDS, 0x04);
+    int trace_raw = sim_find_trace(trace, num_trace, trace_leds, TRACE_EVENT_MATRIX, sim_key_a.row);
+    int trace_down = sim_find_trace(trace, num_trace, trace_raw, TRACE_EVENT_KEY_DOWN, sim_key_a.row);
+    int trace_report =
+        sim_find_trace(trace, num_trace, trace_down, TRACE_EVENT_REPORT, sizeof(struct usb_hid_nkro_report));
+    int trace_sent = sim_find_trace(trace, num_trace, trace_report, TRACE_EVENT_REPORT_SENT, 0);
+    int trace_up = sim_find_trace(trace, num_trace, trace_sent, TRACE_EVENT_KEY_UP, sim_key_a.row);
+    SIM_CHECK(trace_ok && (trace_up >= 0) && (trace[trace_raw].value & (1 << sim_key_a.col))
+        && (trace[trace_down].value == sim_key_a.col) && (trace[trace_sent].value == trace[trace_report].value)
+        && (trace[trace_up].value == sim_key_a.col), "trace of a key tap wrong, %d events", num_trace);
+    if (trace_up >= 0) {
+        printf("trace of a key press: debounced after %u us, queued after %u us, taken by the host after %u us\n",
+            trace[trace_down].time_us - trace[trace_raw].time_us,
+            trace[trace_report].time_us - trace[trace_raw].time_us,
+            trace[trace_sent].time_us - trace[trace_raw].time_us);
+    }
+    sim_host_set_leds(0x00);
+    sim_run_ms(10);
+#endif
+
+    // press-to-host latency of a key tapped at every possible phase of the scan
+    int min_latency = SIM_KEY_TIMEOUT_MS;
+    int max_latency = 0;
+    int total_latency = 0;
+    int num_taps = 50;
+    latency_reset();
+    for (int i = 0; i < num_taps; i++) {
+        int latency = sim_tap(&sim_key_a);
+        min_latency = (latency < min_latency) ? latency : min_latency;
+        max_latency = (latency > max_latency) ? latency : max_latency;
+        total_latency += latency;
+        sim_run_ms(1 + i % 7);
+    }
+    printf("press-to-host latency: min %d ms, avg %.2f ms, max %d ms\n", min_latency,
+        (double)total_latency / num_taps, max_latency);
+
+#if TRACE_EVENTS
+    // that was more than the trace holds, reading from the start gets the oldest event still kept
+    uint32_t trace_first = 0;
+    SIM_CHECK((sim_read_trace(&trace_first, trace) > 0)
+        && (trace_first == trace_next_sequence() - TRACE_BUFFER_SIZE), "trace read from %u of %u events",
+        trace_first, trace_next_sequence());
+
+    // asking for more events than fit in a response gets as many as fit
+    uint8_t trace_full_request[] = {CONFIG_CMD_GET_TRACE, 5, 0, 0, 0, 0, 0xff};
+    SIM_CHECK((sim_config(trace_full_request, sizeof(trace_full_request), trace_response) >= 0)
+        && (trace_response[1] == CONFIG_STATUS_OK)
+        && (trace_response[2] == 4 + (8 * ((USB_HID_CONFIG_REPORT_SIZE - 7) / 8))),
+        "trace read of 255 events answered with status %02x, %u bytes", trace_response[1], trace_response[2]);
+#endif
+
+#if LATENCY_PROBES
+    // the end-to-end latency probe timed the report of every press and release, from the scan that saw it
+    uint8_t latency_response[USB_HID_CONFIG_REPORT_SIZE];
+    uint8_t latency_request[] = {CONFIG_CMD_GET_LATENCY, 1, LATENCY_PROBE_END_TO_END};
+    sim_config(latency_request, sizeof(latency_request), latency_response);
+    uint32_t probe_count = latency_response[3] | (latency_response[4] << 8) | (latency_response[5] << 16)
+        | ((uint32_t)latency_response[6] << 24);
+    uint16_t probe_min_us = latency_response[7] | (latency_response[8] << 8);
+    uint16_t probe_avg_us = latency_response[9] | (latency_response[10] << 8);
+    uint16_t probe_max_us = latency_response[11] | (latency_response[12] << 8);
+    SIM_CHECK((latency_response[1] == CONFIG_STATUS_OK) && (probe_count == 2 * (uint32_t)num_taps)
+        && (probe_min_us <= probe_avg_us) && (probe_avg_us <= probe_max_us) && (probe_max_us <= max_latency * 1000),
+        "end-to-end latency probe: %u reports, min %u us, avg %u us, max %u us", probe_count, probe_min_us,
+        probe_avg_us, probe_max_us);
+    uint8_t histogram_request[] = {CONFIG_CMD_GET_LATENCY_HISTOGRAM, 1, LATENCY_PROBE_END_TO_END};
+    sim_config(histogram_request, sizeof(histogram_request), latency_response);
+    uint32_t histogram_count = 0;
+    for (int bucket = 0; bucket < LATENCY_NUM_BUCKETS; bucket++) {
+        histogram_count += latency_response[3 + (2 * bucket)] | (latency_response[4 + (2 * bucket)] << 8);
+    }
+    SIM_CHECK(histogram_count == probe_count, "latency histogram holds %u of %u reports", histogram_count,
+        probe_count);
+    printf("end-to-end latency probe: min %u us, avg %u us, max %u us\n", probe_min_us, probe_avg_us, probe_max_us);
+#endif
+
+    // config interface: a batch of commands gets a batch of results
+    uint8_t info_request[] = {CONFIG_CMD_GET_INFO, 0, CONFIG_CMD_GET_STATE, 0, 0x7f, 0};
+    SIM_CHECK(sim_config(info_request, sizeof(info_request), config_response) >= 0, "no config response");
+    SIM_CHECK((config_response[0] == CONFIG_CMD_GET_INFO) && (config_response[1] == CONFIG_STATUS_OK)
+        && (config_response[2] == 6) && (config_response[3] == CONFIG_PROTOCOL_VERSION)
+        && (config_response[4] == KEYMAP_NUM_LAYERS) && (config_response[5] == NUM_ROWS)
+        && (config_response[6] == NUM_COLS), "wrong info from the config interface");
+    SIM_CHECK((config_response[9] == CONFIG_CMD_GET_STATE) && (config_response[10] == CONFIG_STATUS_OK)
+        && (config_response[11] == 14) && (config_response[12] == 0x01), "wrong state from the config interface");
+    SIM_CHECK((config_response[26] == 0x7f) && (config_response[27] == CONFIG_STATUS_UNKNOWN_COMMAND),
+        "unknown config command not refused");
+
+    // reads larger than a whole response are refused instead of going unanswered
+    uint8_t big_read_request[] = {CONFIG_CMD_GET_KEYMAP, 4, 0, 0, 0, NUM_COLS, CONFIG_CMD_GET_MACROS, 3, 0, 0, 64};
+    SIM_CHECK((sim_config(big_read_request, sizeof(big_read_request), config_response) >= 0)
+        && (config_response[0] == CONFIG_CMD_GET_KEYMAP) && (config_response[1] == CONFIG_STATUS_INVALID)
+        && (config_response[3] == CONFIG_CMD_GET_MACROS) && (config_response[4] == CONFIG_STATUS_INVALID),
+        "%u column key map read or 64 byte macro read not refused", NUM_COLS);
+
+    // the first key map change only starts copying the layers into the flash store, nothing is committed on the spot
+    struct sim_flash_stats keymap_stats_before;
+    struct sim_flash_stats keymap_stats_after;
+    sim_flash_get_stats(&keymap_stats_before);
+    keymap_set(0, sim_key_a.row, sim_key_a.col, KEY_B);
+    sim_flash_get_stats(&keymap_stats_after);
+    SIM_CHECK((keymap_stats_after.programs == keymap_stats_before.programs)
+        && (keymap_stats_after.erases == keymap_stats_before.erases),
+        "first key map change committed %u half-words right away",
+        keymap_stats_after.programs - keymap_stats_before.programs);
+
+    // remapping a key takes effect right away, and typing keeps its latency while config traffic streams
+    uint8_t remap_request[] = {CONFIG_CMD_SET_KEYMAP, 5, 0, sim_key_a.row, sim_key_a.col, KEY_B, 0};
+    sim_config(remap_request, sizeof(remap_request), config_response);
+    SIM_CHECK(config_response[1] == CONFIG_STATUS_OK, "key not remapped");
+    uint8_t get_keymap_request[USB_HID_CONFIG_REPORT_SIZE] = {CONFIG_CMD_GET_KEYMAP, 4, 0, 2, 0, NUM_COLS / 2};
+    uint32_t config_responses = 0;
+    int config_max_latency = 0;
+    sim_host_send_config_request(get_keymap_request);
+    for (int i = 0; i < 20; i++) {
+        for (int down = 1; down >= 0; down--) {
+            if (down) {
+                sim_key_press(sim_key_a.row, sim_key_a.col);
+            } else {
+                sim_key_release(sim_key_a.row, sim_key_a.col);
+            }
+            int ms = 0;
+            for (; (ms <= SIM_KEY_TIMEOUT_MS) && (sim_host_key_down(KEY_B) != down); ms++) {
+                if (sim_host_get_config_response(config_response)) {
+                    config_responses++;
+                    sim_host_send_config_request(get_keymap_request);
+                }
+                sim_run_ms(1);
+            }
+            config_max_latency = (down && (ms > config_max_latency)) ? ms : config_max_latency;
+        }
+        sim_run_ms(1 + i % 7);
+    }
+    sim_run_ms(SIM_HOLD_MS);
+    sim_host_get_config_response(config_response);
+    SIM_CHECK(config_max_latency <= max_latency, "press-to-host latency %d ms during config traffic",
+        config_max_latency);
+    printf("press-to-host latency during config traffic: max %d ms, %u config requests answered\n",
+        config_max_latency, config_responses);
+
+    // the new key map is stored, until it is reset
+    sim_run_ms(SIM_COMMIT_MS);
+    keymap_init();
+    SIM_CHECK(keymap_layers[0][sim_key_a.row][sim_key_a.col] == KEY_B, "remapped key not stored");
+    uint8_t reset_request[] = {CONFIG_CMD_RESET_KEYMAP, 0};
+    sim_config(reset_request, sizeof(reset_request), config_response);
+    sim_tap(&sim_key_a);
+    keymap_init();
+    SIM_CHECK(keymap_layers[0][sim_key_a.row][sim_key_a.col] == KEY_A, "key map not reset");
+
+    // the flash store image of the built in layers from the key map compiler uploads row by row, and matches them
+    uint8_t keymap_image[KEYMAP_STORE_LAYERS_ADDR - KEYMAP_FLASH_STORE_ADDR + sizeof(keymap_layers) + 1];
+    FILE *image_file = fopen(SIM_KEYMAP_IMAGE, "rb");
+    size_t image_size = image_file ? fread(keymap_image, 1, sizeof(keymap_image), image_file) : 0;
+    if (image_file) {
+        fclose(image_file);
+    }
+    SIM_CHECK((image_size == sizeof(keymap_image) - 1)
+        && ((keymap_image[0] | (keymap_image[1] << 8)) == KEYMAP_STORE_MAGIC), "no key map image in " SIM_KEYMAP_IMAGE);
+    const uint8_t *image_layers = &keymap_image[KEYMAP_STORE_LAYERS_ADDR - KEYMAP_FLASH_STORE_ADDR];
+    keymap_set(0, sim_key_a.row, sim_key_a.col, KEY_B);
+    for (uint8_t layer = 0; (layer < KEYMAP_NUM_LAYERS) && (image_size == sizeof(keymap_image) - 1); layer++) {
+        for (uint8_t row = 0; row < NUM_ROWS; row++) {
+            for (uint8_t col = 0; col < NUM_COLS; col += NUM_COLS / 2) {
+                uint8_t upload_request[5 + NUM_COLS] = {CONFIG_CMD_SET_KEYMAP, 3 + NUM_COLS, layer, row, col};
+                memcpy(&upload_request[5], &image_layers[(((layer * NUM_ROWS) + row) * NUM_COLS + col) * 2], NUM_COLS);
+                sim_config(upload_request, sizeof(upload_request), config_response);
+            }
+        }
+    }
+    sim_run_ms(SIM_COMMIT_MS);
+    keymap_init();
+    SIM_CHECK(memcmp(keymap_layers, image_layers, sizeof(keymap_layers)) == 0, "key map image differs from the layers");
+    keymap_reset();
+    keymap_init();
+    SIM_CHECK(memcmp(keymap_layers, image_layers, sizeof(keymap_layers)) == 0,
+        "key map image differs from the built in layers");
+
+    // settings are checked, read back and applied
+    uint8_t setting_request[] = {CONFIG_CMD_SET_SETTING, 2, CONFIG_SETTING_DEBOUNCE_MODE, 0x10,
+        CONFIG_CMD_SET_SETTING, 2, CONFIG_SETTING_DEBOUNCE_TIME, 8, CONFIG_CMD_GET_SETTING, 1,
+        CONFIG_SETTING_DEBOUNCE_TIME};
+    sim_config(setting_request, sizeof(setting_request), config_response);
+    SIM_CHECK((config_response[1] == CONFIG_STATUS_INVALID) && (config_response[4] == CONFIG_STATUS_OK)
+        && (config_response[7] == CONFIG_STATUS_OK) && (config_response[9] == 8), "settings not changed");
+    sim_tap(&sim_key_a);
+    uint8_t default_setting_request[] = {CONFIG_CMD_SET_SETTING, 2, CONFIG_SETTING_DEBOUNCE_TIME, 0xff};
+    sim_config(default_setting_request, sizeof(default_setting_request), config_response);
+
+    // stored macros are only used once they are complete
+    uint8_t bad_macro_request[] = {CONFIG_CMD_SET_MACROS, 3, 0, 0, 0xf8, CONFIG_CMD_LOAD_MACROS, 0,
+        CONFIG_CMD_GET_MACROS, 3, 0, 0, 1};
+    sim_config(bad_macro_request, sizeof(bad_macro_request), config_response);
+    SIM_CHECK((config_response[1] == CONFIG_STATUS_OK) && (config_response[4] == CONFIG_STATUS_INVALID)
+        && (config_response[9] == KEY_A), "invalid macros used");
+    uint8_t bad_key_request[] = {CONFIG_CMD_SET_MACROS, 4, 0, 0, MACRO_PRESS, KEY_RIGHTMETA + 1,
+        CONFIG_CMD_LOAD_MACROS, 0, CONFIG_CMD_GET_MACROS, 3, 0, 0, 1};
+    sim_config(bad_key_request, sizeof(bad_key_request), config_response);
+    SIM_CHECK((config_response[1] == CONFIG_STATUS_OK) && (config_response[4] == CONFIG_STATUS_INVALID)
+        && (config_response[9] == KEY_A), "macros pressing a key past the modifiers used");
+    uint8_t macro_request[] = {CONFIG_CMD_SET_MACROS, 4, 0, 0, KEY_Z, MACRO_END, CONFIG_CMD_LOAD_MACROS, 0};
+    sim_config(macro_request, sizeof(macro_request), config_response);
+    SIM_CHECK(config_response[4] == CONFIG_STATUS_OK, "macros not loaded");
+    sim_hold(&sim_key_fn, true);
+    sim_tap(&(struct sim_key){.row = sim_key_fn_macro.row, .col = sim_key_fn_macro.col, .key_code = KEY_Z});
+    sim_hold(&sim_key_fn, false);
+
+    // an idle matrix stops scanning with every row driven, and its first key press still reaches the host
+    sim_run_ms(KEYBOARD_IDLE_TIMEOUT_MS + 100);
+    SIM_CHECK(!sim_systick_running(), "still scanning after %u ms idle", KEYBOARD_IDLE_TIMEOUT_MS + 100);
+    SIM_CHECK((sim_gpio_output(GPIOA) & SIM_ROW_PINS) == SIM_ROW_PINS, "rows not driven while asleep");
+    int wake_latency = sim_tap(&sim_key_a);
+    SIM_CHECK(wake_latency <= max_latency, "first key press after sleeping took %d ms", wake_latency);
+    printf("press-to-host latency from sleep: %d ms\n", wake_latency);
+    SIM_CHECK(sim_systick_running(), "not scanning after a key press");
+
+    // the scan locks on to the host's frames again, landing KEYBOARD_SOF_LEAD_US ahead of each one the keyboard is
+    // polled in, and stays there with the two clocks drifting apart
+    sim_hold(&sim_key_a, true);
+    int32_t ticks_per_us = rcc_ahb_frequency / 8000000;
+    int32_t min_lead_us = INT32_MAX;
+    int32_t max_lead_us = INT32_MIN;
+    for (int drift = -1; drift <= 1; drift += 2) {
+        sim_systick_set_drift_ppm(drift * SIM_SOF_DRIFT_PPM);
+        sim_run_ms(SIM_SOF_SETTLE_MS);
+        for (int ms = 0; ms < SIM_SOF_LOCK_MS; ms++) {
+            sim_run_ms(1);
+            if ((sim_time_us() / 1000) % KEYBOARD_POLL_INTERVAL_MS) {
+                continue;
+            }
+            int32_t lead_us = (KEYBOARD_POLL_INTERVAL_MS * 1000) - (sim_systick_ticks_to_wrap() / ticks_per_us);
+            min_lead_us = (lead_us < min_lead_us) ? lead_us : min_lead_us;
+            max_lead_us = (lead_us > max_lead_us) ? lead_us : max_lead_us;
+        }
+    }
+    sim_systick_set_drift_ppm(0);
+    sim_hold(&sim_key_a, false);
+    SIM_CHECK((min_lead_us >= KEYBOARD_SOF_LEAD_US - SIM_SOF_TOLERANCE_US)
+        && (max_lead_us <= KEYBOARD_SOF_LEAD_US + SIM_SOF_TOLERANCE_US),
+        "scan %d..%d us ahead of the frames, not %u us", min_lead_us, max_lead_us, KEYBOARD_SOF_LEAD_US);
+    printf("scan lead on the host's frames at +/-%u ppm: %d..%d us\n", SIM_SOF_DRIFT_PPM, min_lead_us, max_lead_us);
+
+    // pressing a key while the host is suspended wakes the host up, and the key press gets through afterwards
+    uint8_t device_status[2];
+    sim_host_set_remote_wakeup(true);
+    sim_run_ms(10);
+    SIM_CHECK(sim_host_control_result(device_status) == 0, "Set_Feature(DEVICE_REMOTE_WAKEUP) STALLed");
+    sim_host_get_device_status();
+    sim_run_ms(10);
+    SIM_CHECK((sim_host_control_result(device_status) == 2) && (device_status[0] & 0x02),
+        "Get_Status does not report remote wakeup enabled");
+    sim_host_suspend();
+    sim_run_ms(KEYBOARD_IDLE_TIMEOUT_MS + 100);
+    SIM_CHECK(!sim_systick_running(), "still scanning while suspended");
+    printf("press-to-host latency from suspend: %d ms\n", sim_tap(&sim_key_a));
+    SIM_CHECK(!sim_host_is_suspended(), "host still suspended after a key press");
+    SIM_CHECK(sim_host_num_remote_wakeups() == 1, "%u remote wakeups", sim_host_num_remote_wakeups());
+
+    // lots of small writes to the flash store, each committed right away: the newest value of every byte wins, also
+    // after remounting, and pages are only erased when a bank fills up
+    struct sim_flash_stats store_stats_before;
+    sim_flash_get_stats(&store_stats_before);
+    uint8_t store_expected[SIM_STORE_TEST_SIZE];
+    memset(store_expected, 0xff, sizeof(store_expected));
+    for (uint32_t i = 0; i < SIM_STORE_TEST_WRITES; i++) {
+        uint16_t offset = (i * 7) % (SIM_STORE_TEST_SIZE - 1);
+        uint8_t value[2] = {(uint8_t)i, (uint8_t)(i >> 8)};
+        SIM_CHECK(flash_store_write(SIM_STORE_TEST_ADDR + offset, value, sizeof(value)), "flash store write %u failed",
+            i);
+        flash_store_flush();
+        memcpy(&store_expected[offset], value, sizeof(value));
+    }
+    for (int mount = 0; mount < 2; mount++) {
+        uint8_t store_data[SIM_STORE_TEST_SIZE];
+        flash_store_read(SIM_STORE_TEST_ADDR, store_data, sizeof(store_data));
+        SIM_CHECK(memcmp(store_data, store_expected, sizeof(store_data)) == 0, "flash store contents wrong%s",
+            mount ? " after remounting" : "");
+        flash_store_flush();
+        flash_store_init();
+    }
+    struct sim_flash_stats store_stats;
+    sim_flash_get_stats(&store_stats);
+    SIM_CHECK(store_stats.erases - store_stats_before.erases < SIM_STORE_TEST_WRITES / 20, "%u pages erased",
+        store_stats.erases - store_stats_before.erases);
+    printf("flash store: %u writes, %u pages erased, %u half-words programmed\n", SIM_STORE_TEST_WRITES,
+        store_stats.erases - store_stats_before.erases, store_stats.programs - store_stats_before.programs);
+
+    // a write only reaches the flash once the matrix has been idle for a while, and keys still get through while
+    // it is being committed
+    uint8_t store_value[SIM_STORE_TEST_SIZE];
+    memset(store_value, 0x5a, sizeof(store_value));
+    flash_store_write(SIM_STORE_TEST_ADDR, store_value, sizeof(store_value));
+    sim_run_ms(KEYBOARD_COMMIT_IDLE_MS / 2);
+    sim_flash_get_stats(&store_stats_before);
+    SIM_CHECK(store_stats_before.programs == store_stats.programs, "flash programmed while typing");
+    uint32_t commit_ms = 0;
+    for (; (commit_ms < KEYBOARD_IDLE_TIMEOUT_MS) && (store_stats.programs == store_stats_before.programs);
+        commit_ms++) {
+        sim_run_ms(1);
+        sim_flash_get_stats(&store_stats);
+    }
+    int commit_latency = sim_tap(&sim_key_a);
+    SIM_CHECK(commit_latency <= max_latency, "key press during a commit took %d ms", commit_latency);
+    sim_run_ms(KEYBOARD_IDLE_TIMEOUT_MS);
+    SIM_CHECK(!flash_store_busy(), "flash store writes not committed after %u ms idle", KEYBOARD_IDLE_TIMEOUT_MS);
+    printf("flash store commit started after %u ms idle\n", KEYBOARD_COMMIT_IDLE_MS / 2 + commit_ms);
+
+    // losing power halfway through a commit keeps the previous contents, the next commit goes through
+    uint8_t store_data[SIM_STORE_TEST_SIZE];
+    uint8_t store_half[SIM_STORE_TEST_SIZE / 2];
+    memset(store_half, 0xa5, sizeof(store_half));
+    flash_store_write(SIM_STORE_TEST_ADDR, store_half, sizeof(store_half));
+    flash_store_write(SIM_STORE_TEST_ADDR + sizeof(store_half), store_half, sizeof(store_half));
+    for (int step = 0; step < 2; step++) {
+        flash_store_step();
+    }
+    flash_store_init();
+    flash_store_read(SIM_STORE_TEST_ADDR, store_data, sizeof(store_data));
+    SIM_CHECK(memcmp(store_data, store_value, sizeof(store_data)) == 0, "torn commit changed the flash store");
+    flash_store_write(SIM_STORE_TEST_ADDR, store_half, sizeof(store_half));
+    flash_store_flush();
+    flash_store_init();
+    flash_store_read(SIM_STORE_TEST_ADDR, store_data, sizeof(store_data));
+    SIM_CHECK((memcmp(store_data, store_half, sizeof(store_half)) == 0)
+        && (memcmp(&store_data[sizeof(store_half)], &store_value[sizeof(store_half)], sizeof(store_half)) == 0),
+        "flash store contents wrong after a torn commit");
+
+    // the macros saved earlier survive all of that
+    macro_init();
+    sim_host_clear_text();
+    sim_hold(&sim_key_fn, true);
+    sim_key_press(sim_key_fn_snippet.row, sim_key_fn_snippet.col);
+    sim_wait_for_macro();
+    sim_key_release(sim_key_fn_snippet.row, sim_key_fn_snippet.col);
+    sim_hold(&sim_key_fn, false);
+    SIM_CHECK(strcmp(sim_host_get_text(), SIM_SNIPPET) == 0, "snippet macro typed \"%s\" after remounting",
+        sim_host_get_text());
+
+    // a macro started after 2^31 ms (24.8 days) of uptime plays right away, and its delays still end
+    uint32_t uptime_ms = 0x80000000u;
+    macro_play(0);
+    SIM_CHECK(macro_ready(uptime_ms), "macro not ready when started after %u ms", uptime_ms);
+    for (int i = 0; (i < 1000) && macro_playing(); i++, uptime_ms += 256) {
+        macro_step(uptime_ms);
+    }
+    SIM_CHECK(!macro_playing(), "macro still playing after %u ms", uptime_ms);
+
+    struct sim_flash_stats flash_stats;
+    sim_flash_get_stats(&flash_stats);
+    SIM_CHECK(flash_stats.errors == 0, "%u flash programming errors", flash_stats.errors);
+    SIM_CHECK(event_queue_overflows() == 0, "%u key event queue overflows", event_queue_overflows());
+    printf("host received %u reports\n", sim_host_num_reports());
+}
+
+static double sim_bench_ns(bool typing) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < SIM_BENCH_POLLS; i++) {
+        if (typing && (i % 64 == 0)) {
+            if (i % 128 == 0) {
+                sim_key_press(sim_key_a.row, sim_key_a.col);
+            } else {
+                sim_key_release(sim_key_a.row, sim_key_a.col);
+            }
+        }
+        keyboard_scan();
+        keyboard_poll();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return elapsed_ns / SIM_BENCH_POLLS;
+}
+
+static void sim_benchmark(void) {
+    sim_boot();
+    sim_run_ms(1100);
+    printf("scan + poll idle: %.1f ns/call\n", sim_bench_ns(false));
+    printf("scan + poll typing: %.1f ns/call\n", sim_bench_ns(true));
+}
+
+int main(int argc, char **argv) {
+    sim_host_set_verbose((argc > 1) && (strcmp(argv[1], "-v") == 0));
+
+    sim_scenario();
+    sim_host_set_verbose(false);
+    sim_benchmark();
+
+    if (sim_failures) {
+        printf("%d check(s) failed\n", sim_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulated time - boots the firmware and runs it a millisecond at a time, interleaving the SysTick scan, the USB
+ * host's frames and interrupt and the firmware main loop the way they would on the board.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sim.h"
+
+#include <time.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "config.h"
+#include "flash_store.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "latency.h"
+#include "trace.h"
+#include "usb_hid.h"
+
+static uint64_t sim_now_us;
+static bool sim_sleeping;
+
+static struct sim_timing sim_timing;
+static uint64_t sim_clock_overhead_ns;
+
+uint64_t sim_time_us(void) {
+    return sim_now_us;
+}
+
+static uint64_t sim_clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+// host time spent in a call, less what reading the clock around it costs
+static uint64_t sim_elapsed_ns(uint64_t start_ns) {
+    uint64_t elapsed_ns = sim_clock_ns() - start_ns;
+    return (elapsed_ns > sim_clock_overhead_ns) ? (elapsed_ns - sim_clock_overhead_ns) : 0;
+}
+
+// one pass of the firmware main loop, up to the point where it goes back to sleep
+static void sim_main_loop(void) {
+    if (sim_sleeping) {
+        return;
+    }
+
+    uint64_t start_ns = sim_clock_ns();
+    keyboard_poll();
+    sim_timing.poll_ns += sim_elapsed_ns(start_ns);
+    sim_timing.polls++;
+
+    config_poll();
+    keymap_step();
+    if (keyboard_can_commit() && flash_store_step()) {
+        // the firmware goes round again right away, the sim does one commit step per pass
+        return;
+    }
+    if (!keyboard_has_work() && !usb_hid_config_request_pending() && keyboard_can_sleep()) {
+        sim_sleeping = keyboard_sleep();
+    }
+}
+
+// an interrupt that ends a sleep
+static void sim_wake(void) {
+    if (sim_sleeping) {
+        sim_sleeping = false;
+        keyboard_wake();
+    }
+}
+
+void sim_run_ms(uint32_t ms) {
+    while (ms--) {
+        sim_now_us += 1000;
+        sim_hw_run_us(1000);
+
+        if (sim_exti_irq_pending()) {
+            sim_wake();
+            sim_main_loop();
+        }
+
+        // a scan for every counter wrap during the millisecond, which puts them all ahead of the frame at its end
+        while (sim_systick_irq_pending()) {
+            uint64_t start_ns = sim_clock_ns();
+            sys_tick_handler();
+            sim_timing.scan_ns += sim_elapsed_ns(start_ns);
+            sim_timing.scans++;
+
+            // the real main loop spins continuously, so it picks up the scan long before the next frame
+            sim_main_loop();
+        }
+
+        // the LED effects step at most once a millisecond
+        if (sim_nvic_irq_enabled(NVIC_TIM1_BRK_UP_TRG_COM_IRQ) && sim_timer_irq_pending(TIM1)) {
+            tim1_brk_up_trg_com_isr();
+            sim_wake();
+        }
+
+        sim_host_frame();
+        if (sim_nvic_irq_enabled(NVIC_USB_IRQ) && sim_usb_irq_pending()) {
+            usb_isr();
+            sim_wake();
+        }
+        sim_main_loop();
+    }
+}
+
+void sim_boot(void) {
+    sim_now_us = 0;
+    sim_sleeping = false;
+    sim_hw_init();
+
+    // the scan tick as started by setup_clock()
+    systick_set_frequency(1000 / KEYBOARD_POLL_INTERVAL_MS, rcc_ahb_frequency);
+    systick_counter_enable();
+    systick_interrupt_enable();
+
+    // zeroed along with the rest of RAM on a real boot
+    latency_reset();
+    trace_clear();
+
+    flash_store_init();
+    usb_hid_init();
+    keyboard_init();
+    config_init();
+    sim_host_enumerate();
+    sim_reset_timing();
+}
+
+void sim_reset_timing(void) {
+    sim_timing = (struct sim_timing){0};
+
+    // the cheapest of a few back to back clock reads
+    sim_clock_overhead_ns = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start_ns = sim_clock_ns();
+        uint64_t overhead_ns = sim_clock_ns() - start_ns;
+        sim_clock_overhead_ns = (overhead_ns < sim_clock_overhead_ns) ? overhead_ns : sim_clock_overhead_ns;
+    }
+}
+
+void sim_get_timing(struct sim_timing *timing) {
+    *timing = sim_timing;
+}
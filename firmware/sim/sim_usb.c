@@ -0,0 +1,725 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Simulated USB device peripheral and host. The host polls IN endpoints every bInterval frames, decodes the
+ * keyboard reports it receives and can issue control requests to the device. It also talks to the config interface
+ * through its interrupt OUT and IN endpoints.
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/stm32/st_usbfs.h>
+#include <libopencm3/usb/hid.h>
+#include <libopencm3/usb/usbd.h>
+
+#include "hid_codes.h"
+#include "usb_hid.h"
+
+#define SIM_USB_NUM_ENDPOINTS 8
+#define SIM_USB_MAX_PACKET_SIZE 64
+#define SIM_USB_MAX_CALLBACKS 4
+
+// endpoint number of the config interface, both ways
+#define SIM_USB_CONFIG_EP 2
+
+// remote wakeup signalling the host accepts (USB 2.0 7.1.7.7)
+#define SIM_USB_RESUME_MIN_US 1000
+#define SIM_USB_RESUME_MAX_US 15000
+
+
+struct _usbd_driver {
+    const char *name;
+};
+
+const usbd_driver st_usbfs_v2_usb_driver = {
+    .name = "st_usbfs_v2",
+};
+
+struct sim_usb_in_ep {
+    usbd_endpoint_callback callback;
+    uint8_t interval;
+    uint16_t max_size;
+    bool tx_pending;     // packet written by the firmware, waiting for the host to poll
+    bool tx_complete;    // packet taken by the host, completion callback not yet run
+    uint16_t tx_len;
+    uint8_t tx_buf[SIM_USB_MAX_PACKET_SIZE];
+};
+
+struct sim_usb_out_ep {
+    usbd_endpoint_callback callback;
+    uint8_t interval;
+    bool nak;            // set by the firmware, the host's packets are refused
+    bool rx_full;        // packet received, not read by the firmware yet (the hardware NAKs further ones)
+    bool rx_complete;    // packet received, completion callback not yet run
+    uint16_t rx_len;
+    uint8_t rx_buf[SIM_USB_MAX_PACKET_SIZE];
+};
+
+struct sim_usb_control_cb {
+    usbd_control_callback callback;
+    uint8_t type;
+    uint8_t type_mask;
+};
+
+struct _usbd_device {
+    const struct usb_config_descriptor *config;
+    uint8_t *control_buf;
+    uint16_t control_buf_size;
+
+    void (*reset_cb)(void);
+    void (*suspend_cb)(void);
+    void (*resume_cb)(void);
+    usbd_set_config_callback set_config_cb[SIM_USB_MAX_CALLBACKS];
+    struct sim_usb_control_cb control_cb[SIM_USB_MAX_CALLBACKS];
+    struct sim_usb_in_ep in_ep[SIM_USB_NUM_ENDPOINTS];
+    struct sim_usb_out_ep out_ep[SIM_USB_NUM_ENDPOINTS];
+
+    bool setup_pending;
+    struct usb_setup_data setup;
+    uint8_t setup_data[SIM_USB_MAX_PACKET_SIZE];
+    bool control_stalled;  // outcome of the last control request
+    uint16_t control_in_len;
+    uint8_t control_in[SIM_USB_MAX_PACKET_SIZE];
+
+    bool suspend_pending;
+    bool resume_pending;
+
+    void (*sof_cb)(void);
+    bool sof_pending;
+};
+
+volatile uint32_t sim_usb_cntr;
+volatile uint32_t sim_usb_fnr;
+
+static struct _usbd_device sim_usb_dev;
+
+static uint32_t sim_host_frame_num;
+static bool sim_host_verbose = false;
+static bool sim_host_boot_protocol;
+static uint32_t sim_host_reports;
+static bool sim_host_rollover;
+static uint8_t sim_host_modifiers;
+static uint8_t sim_host_keys[32];  // bitmap over key codes 0x00..0xff
+static uint32_t sim_host_presses[256];  // number of reports each key code went from up to down in
+static char sim_host_text[1024];  // characters typed since sim_host_clear_text()
+static size_t sim_host_text_len;
+static bool sim_host_paused;
+static bool sim_host_suspended;
+static bool sim_host_remote_wakeup;  // DEVICE_REMOTE_WAKEUP feature set by the host
+static uint64_t sim_host_resume_start_us;  // start of the resume signalling seen from the device, 0 if none
+static uint32_t sim_host_remote_wakeups;
+static bool sim_host_config_request_pending;  // request waiting to be accepted by the OUT endpoint
+static uint8_t sim_host_config_request[USB_HID_CONFIG_REPORT_SIZE];
+static bool sim_host_config_response_available;
+static uint8_t sim_host_config_response[USB_HID_CONFIG_REPORT_SIZE];
+
+static uint8_t sim_usb_ep_interval(const struct usb_config_descriptor *config, uint8_t addr) {
+    for (int iface = 0; iface < config->bNumInterfaces; iface++) {
+        const struct usb_interface *interface = &config->interface[iface];
+        for (int alt = 0; alt < interface->num_altsetting; alt++) {
+            const struct usb_interface_descriptor *iface_desc = &interface->altsetting[alt];
+            for (int ep = 0; ep < iface_desc->bNumEndpoints; ep++) {
+                if (iface_desc->endpoint[ep].bEndpointAddress == addr) {
+                    return iface_desc->endpoint[ep].bInterval;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+usbd_device *usbd_init(const usbd_driver *driver, const struct usb_device_descriptor *dev,
+    const struct usb_config_descriptor *conf, const char * const *strings, int num_strings,
+    uint8_t *control_buffer, uint16_t control_buffer_size) {
+
+    memset(&sim_usb_dev, 0, sizeof(sim_usb_dev));
+    sim_usb_dev.config = conf;
+    sim_usb_dev.control_buf = control_buffer;
+    sim_usb_dev.control_buf_size = control_buffer_size;
+
+    sim_host_frame_num = 0;
+    sim_host_reports = 0;
+    sim_host_rollover = false;
+    sim_host_modifiers = 0;
+    memset(sim_host_keys, 0, sizeof(sim_host_keys));
+    memset(sim_host_presses, 0, sizeof(sim_host_presses));
+    sim_host_clear_text();
+    sim_host_boot_protocol = false;
+    sim_host_paused = false;
+    sim_host_suspended = false;
+    sim_host_remote_wakeup = false;
+    sim_host_resume_start_us = 0;
+    sim_host_remote_wakeups = 0;
+    sim_host_config_request_pending = false;
+    sim_host_config_response_available = false;
+    sim_usb_cntr = 0;
+    sim_usb_fnr = 0;
+
+    (void)driver;
+    (void)dev;
+    (void)strings;
+    (void)num_strings;
+
+    return &sim_usb_dev;
+}
+
+void usbd_register_reset_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    usbd_dev->reset_cb = callback;
+}
+
+void usbd_register_suspend_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    usbd_dev->suspend_cb = callback;
+}
+
+void usbd_register_resume_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    usbd_dev->resume_cb = callback;
+}
+
+void usbd_register_sof_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    usbd_dev->sof_cb = callback;
+}
+
+int usbd_register_control_callback(usbd_device *usbd_dev, uint8_t type, uint8_t type_mask,
+    usbd_control_callback callback) {
+
+    for (int i = 0; i < SIM_USB_MAX_CALLBACKS; i++) {
+        if (usbd_dev->control_cb[i].callback == NULL) {
+            usbd_dev->control_cb[i].callback = callback;
+            usbd_dev->control_cb[i].type = type;
+            usbd_dev->control_cb[i].type_mask = type_mask;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int usbd_register_set_config_callback(usbd_device *usbd_dev, usbd_set_config_callback callback) {
+    for (int i = 0; i < SIM_USB_MAX_CALLBACKS; i++) {
+        if (usbd_dev->set_config_cb[i] == NULL) {
+            usbd_dev->set_config_cb[i] = callback;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// the standard requests libopencm3 answers itself (usb_standard.c), it STALLs every other one
+static bool sim_usb_standard_request(const struct usb_setup_data *setup, uint8_t *buf, uint16_t *len) {
+    switch (setup->bmRequestType & USB_REQ_TYPE_RECIPIENT) {
+        case USB_REQ_TYPE_DEVICE:
+            switch (setup->bRequest) {
+                case USB_REQ_GET_STATUS:
+                    // neither self powered nor remote wakeup, whatever the configuration says
+                    buf[0] = 0;
+                    buf[1] = 0;
+                    *len = 2;
+                    return true;
+                case USB_REQ_SET_ADDRESS:
+                case USB_REQ_GET_DESCRIPTOR:
+                case USB_REQ_GET_CONFIGURATION:
+                case USB_REQ_SET_CONFIGURATION:
+                    *len = 0;
+                    return true;
+                default:
+                    // Set_Feature/Clear_Feature(DEVICE_REMOTE_WAKEUP) among them
+                    return false;
+            }
+        case USB_REQ_TYPE_INTERFACE:
+            *len = 0;
+            return (setup->bRequest == USB_REQ_GET_STATUS) || (setup->bRequest == USB_REQ_GET_INTERFACE)
+                || (setup->bRequest == USB_REQ_SET_INTERFACE);
+        case USB_REQ_TYPE_ENDPOINT:
+            *len = 0;
+            return (setup->bRequest == USB_REQ_GET_STATUS) || (setup->bRequest == USB_REQ_SET_FEATURE)
+                || (setup->bRequest == USB_REQ_CLEAR_FEATURE);
+        default:
+            return false;
+    }
+}
+
+// the host takes the result of a request: the data stage, up to wLength, or a STALL
+static void sim_usb_control_done(usbd_device *usbd_dev, bool stalled, const uint8_t *buf, uint16_t len) {
+    const struct usb_setup_data *setup = &usbd_dev->setup;
+    usbd_dev->control_stalled = stalled;
+    usbd_dev->control_in_len = 0;
+    if (!stalled && (setup->bmRequestType & USB_REQ_TYPE_IN)) {
+        usbd_dev->control_in_len = (len < setup->wLength) ? len : setup->wLength;
+        memcpy(usbd_dev->control_in, buf, usbd_dev->control_in_len);
+    }
+
+    // the host only counts on remote wakeup once the device accepted the feature
+    if (!stalled && (setup->bmRequestType == (USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE))
+        && ((setup->bRequest == USB_REQ_SET_FEATURE) || (setup->bRequest == USB_REQ_CLEAR_FEATURE))
+        && (setup->wValue == USB_FEAT_DEVICE_REMOTE_WAKEUP)) {
+        sim_host_remote_wakeup = (setup->bRequest == USB_REQ_SET_FEATURE);
+    }
+}
+
+static void sim_usb_dispatch_control(usbd_device *usbd_dev) {
+    usbd_dev->setup_pending = false;
+
+    uint8_t *buf = usbd_dev->control_buf;
+    uint16_t len = usbd_dev->setup.wLength;
+    memcpy(buf, usbd_dev->setup_data, len);
+
+    // like libopencm3, a callback that handles or refuses the request ends the search
+    for (int i = 0; i < SIM_USB_MAX_CALLBACKS; i++) {
+        struct sim_usb_control_cb *cb = &usbd_dev->control_cb[i];
+        if ((cb->callback == NULL) || ((usbd_dev->setup.bmRequestType & cb->type_mask) != cb->type)) {
+            continue;
+        }
+        usbd_control_complete_callback complete = NULL;
+        enum usbd_request_return_codes result = cb->callback(usbd_dev, &usbd_dev->setup, &buf, &len, &complete);
+        if (result == USBD_REQ_HANDLED) {
+            sim_usb_control_done(usbd_dev, false, buf, len);
+            if (complete != NULL) {
+                complete(usbd_dev, &usbd_dev->setup);
+            }
+            return;
+        }
+        if (result == USBD_REQ_NOTSUPP) {
+            sim_usb_control_done(usbd_dev, true, NULL, 0);
+            return;
+        }
+    }
+
+    // libopencm3 answers the standard requests the callbacks pass on, as far as it knows them
+    if ((usbd_dev->setup.bmRequestType & USB_REQ_TYPE_TYPE) == USB_REQ_TYPE_STANDARD) {
+        bool handled = sim_usb_standard_request(&usbd_dev->setup, buf, &len);
+        sim_usb_control_done(usbd_dev, !handled, buf, len);
+        return;
+    }
+
+    sim_usb_control_done(usbd_dev, true, NULL, 0);
+    fprintf(stderr, "sim: control request %02x/%02x not handled\n", usbd_dev->setup.bmRequestType,
+        usbd_dev->setup.bRequest);
+}
+
+bool sim_usb_irq_pending(void) {
+    if (sim_usb_dev.setup_pending || sim_usb_dev.suspend_pending || sim_usb_dev.resume_pending
+        || sim_usb_dev.sof_pending) {
+        return true;
+    }
+    for (int ep = 0; ep < SIM_USB_NUM_ENDPOINTS; ep++) {
+        if (sim_usb_dev.in_ep[ep].tx_complete || sim_usb_dev.out_ep[ep].rx_complete) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void usbd_poll(usbd_device *usbd_dev) {
+    if (usbd_dev->suspend_pending) {
+        usbd_dev->suspend_pending = false;
+        if (usbd_dev->suspend_cb != NULL) {
+            usbd_dev->suspend_cb();
+        }
+    }
+    if (usbd_dev->resume_pending) {
+        usbd_dev->resume_pending = false;
+        if (usbd_dev->resume_cb != NULL) {
+            usbd_dev->resume_cb();
+        }
+    }
+
+    if (usbd_dev->setup_pending) {
+        sim_usb_dispatch_control(usbd_dev);
+    }
+
+    for (int ep = 0; ep < SIM_USB_NUM_ENDPOINTS; ep++) {
+        struct sim_usb_in_ep *in_ep = &usbd_dev->in_ep[ep];
+        if (in_ep->tx_complete) {
+            in_ep->tx_complete = false;
+            if (in_ep->callback != NULL) {
+                in_ep->callback(usbd_dev, USB_ENDPOINT_ADDR_IN(ep));
+            }
+        }
+
+        struct sim_usb_out_ep *out_ep = &usbd_dev->out_ep[ep];
+        if (out_ep->rx_complete) {
+            out_ep->rx_complete = false;
+            if (out_ep->callback != NULL) {
+                out_ep->callback(usbd_dev, USB_ENDPOINT_ADDR_OUT(ep));
+            }
+        }
+    }
+
+    // libopencm3 handles the start of frame last as well
+    if (usbd_dev->sof_pending) {
+        usbd_dev->sof_pending = false;
+        if (usbd_dev->sof_cb != NULL) {
+            usbd_dev->sof_cb();
+        }
+    }
+}
+
+void usbd_disconnect(usbd_device *usbd_dev, bool disconnected) {
+    (void)usbd_dev;
+    (void)disconnected;
+}
+
+void usbd_ep_setup(usbd_device *usbd_dev, uint8_t addr, uint8_t type, uint16_t max_size,
+    usbd_endpoint_callback callback) {
+
+    uint8_t ep = addr & 0x7f;
+    if ((addr & 0x80) && (ep < SIM_USB_NUM_ENDPOINTS)) {
+        struct sim_usb_in_ep *in_ep = &usbd_dev->in_ep[ep];
+        memset(in_ep, 0, sizeof(*in_ep));
+        in_ep->callback = callback;
+        in_ep->max_size = max_size;
+        in_ep->interval = sim_usb_ep_interval(usbd_dev->config, addr);
+    } else if (ep < SIM_USB_NUM_ENDPOINTS) {
+        struct sim_usb_out_ep *out_ep = &usbd_dev->out_ep[ep];
+        memset(out_ep, 0, sizeof(*out_ep));
+        out_ep->callback = callback;
+        out_ep->interval = sim_usb_ep_interval(usbd_dev->config, addr);
+    }
+
+    (void)type;
+}
+
+uint16_t usbd_ep_write_packet(usbd_device *usbd_dev, uint8_t addr, const void *buf, uint16_t len) {
+    struct sim_usb_in_ep *in_ep = &usbd_dev->in_ep[addr & 0x7f];
+
+    // like the real peripheral, refuse the packet while the previous one has not been sent yet
+    if (in_ep->tx_pending || (in_ep->max_size == 0)) {
+        return 0;
+    }
+    if (len > in_ep->max_size) {
+        len = in_ep->max_size;
+    }
+
+    memcpy(in_ep->tx_buf, buf, len);
+    in_ep->tx_len = len;
+    in_ep->tx_pending = true;
+    return len;
+}
+
+uint16_t usbd_ep_read_packet(usbd_device *usbd_dev, uint8_t addr, void *buf, uint16_t len) {
+    struct sim_usb_out_ep *out_ep = &usbd_dev->out_ep[addr & 0x7f];
+    if (!out_ep->rx_full) {
+        return 0;
+    }
+    if (len > out_ep->rx_len) {
+        len = out_ep->rx_len;
+    }
+
+    memcpy(buf, out_ep->rx_buf, len);
+    out_ep->rx_full = false;
+    return len;
+}
+
+void usbd_ep_nak_set(usbd_device *usbd_dev, uint8_t addr, uint8_t nak) {
+    usbd_dev->out_ep[addr & 0x7f].nak = nak;
+}
+
+// characters of the key codes from KEY_A to KEY_SLASH, as typed on a US layout without and with Shift
+static const char sim_chars[] = "abcdefghijklmnopqrstuvwxyz1234567890\n\x1b\b\t -=[]\\#;'`,./";
+static const char sim_shifted_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\n\x1b\b\t _+{}||:\"~<>?";
+
+bool sim_char_to_key(char c, uint8_t *key_code, bool *shifted) {
+    for (size_t i = 0; i < sizeof(sim_chars) - 1; i++) {
+        if ((sim_chars[i] == c) || (sim_shifted_chars[i] == c)) {
+            *key_code = (uint8_t)(KEY_A + i);
+            *shifted = (sim_chars[i] != c);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void sim_host_set_keys(const uint8_t *keys) {
+    bool shifted = sim_host_modifiers & (KEY_MOD_LSHIFT | KEY_MOD_RSHIFT);
+    for (int key_code = 0; key_code < 256; key_code++) {
+        uint8_t bit = (uint8_t)(1 << (key_code % 8));
+        if ((keys[key_code / 8] & bit) && !(sim_host_keys[key_code / 8] & bit)) {
+            sim_host_presses[key_code]++;
+
+            if ((key_code >= KEY_A) && (key_code <= KEY_SLASH) && (sim_host_text_len < sizeof(sim_host_text) - 1)) {
+                sim_host_text[sim_host_text_len++] = (shifted ? sim_shifted_chars : sim_chars)[key_code - KEY_A];
+            }
+        }
+    }
+    memcpy(sim_host_keys, keys, sizeof(sim_host_keys));
+}
+
+static void sim_host_receive(const uint8_t *report, uint16_t len) {
+    uint8_t keys[sizeof(sim_host_keys)] = {0};
+
+    sim_host_reports++;
+
+    if (sim_host_verbose) {
+        printf("[%9.3f ms] report:", sim_time_us() / 1000.0);
+        for (uint16_t i = 0; i < len; i++) {
+            printf(" %02x", report[i]);
+        }
+        printf("\n");
+    }
+
+    if (!sim_host_boot_protocol) {
+        // report protocol: modifiers followed by one bit per key code
+        if (len != sizeof(struct usb_hid_nkro_report)) {
+            fprintf(stderr, "sim: unexpected report length %u\n", len);
+            return;
+        }
+        sim_host_rollover = false;
+        sim_host_modifiers = report[0];
+        memcpy(keys, &report[1], len - 1);
+        sim_host_set_keys(keys);
+        return;
+    }
+
+    if (len != sizeof(struct usb_hid_report)) {
+        fprintf(stderr, "sim: unexpected boot report length %u\n", len);
+        return;
+    }
+
+    // boot protocol: modifiers, reserved, 6 key codes - a roll over error leaves the previous state in place
+    sim_host_rollover = (report[2] == KEY_ERR_OVF);
+    if (sim_host_rollover) {
+        return;
+    }
+
+    sim_host_modifiers = report[0];
+    for (uint16_t i = 2; i < len; i++) {
+        keys[report[i] / 8] |= (uint8_t)(1 << (report[i] % 8));
+    }
+    keys[0] &= (uint8_t)~1;  // KEY_NONE
+    sim_host_set_keys(keys);
+}
+
+void sim_host_enumerate(void) {
+    sim_host_boot_protocol = false;
+    sim_host_suspended = false;
+    sim_host_remote_wakeup = false;
+
+    // bus reset
+    if (sim_usb_dev.reset_cb != NULL) {
+        sim_usb_dev.reset_cb();
+    }
+
+    // like libopencm3, drop the control callbacks of the previous configuration before setting the new one
+    memset(sim_usb_dev.control_cb, 0, sizeof(sim_usb_dev.control_cb));
+    for (int i = 0; i < SIM_USB_MAX_CALLBACKS; i++) {
+        if (sim_usb_dev.set_config_cb[i] != NULL) {
+            sim_usb_dev.set_config_cb[i](&sim_usb_dev, sim_usb_dev.config->bConfigurationValue);
+        }
+    }
+}
+
+// watch the device's resume signalling while suspended, and resume once it has been long enough
+static void sim_host_check_remote_wakeup(void) {
+    if (sim_usb_cntr & USB_CNTR_RESUME) {
+        if (sim_host_resume_start_us == 0) {
+            sim_host_resume_start_us = sim_time_us();
+        }
+        return;
+    }
+    if (sim_host_resume_start_us == 0) {
+        return;
+    }
+
+    uint64_t resume_us = sim_time_us() - sim_host_resume_start_us;
+    sim_host_resume_start_us = 0;
+    if (!sim_host_remote_wakeup) {
+        fprintf(stderr, "sim: remote wakeup signalled without the host enabling it\n");
+        return;
+    }
+    if ((resume_us < SIM_USB_RESUME_MIN_US) || (resume_us > SIM_USB_RESUME_MAX_US)) {
+        fprintf(stderr, "sim: remote wakeup signalled for %llu us\n", (unsigned long long)resume_us);
+        return;
+    }
+
+    sim_host_remote_wakeups++;
+    sim_host_suspended = false;
+    sim_usb_dev.resume_pending = true;
+}
+
+void sim_host_frame(void) {
+    sim_host_frame_num++;
+
+    // no frames on a suspended bus
+    if (sim_host_suspended) {
+        sim_host_check_remote_wakeup();
+        return;
+    }
+
+    // the start of frame goes out whether or not the host gets around to any transfers in it
+    sim_usb_fnr = sim_host_frame_num & USB_FNR_FN;
+    if ((sim_usb_dev.sof_cb != NULL) && (sim_usb_cntr & USB_CNTR_SOFM)) {
+        sim_usb_dev.sof_pending = true;
+    }
+
+    // a busy bus: the host doesn't get around to polling the interrupt endpoints
+    if (sim_host_paused) {
+        return;
+    }
+
+    for (int ep = 0; ep < SIM_USB_NUM_ENDPOINTS; ep++) {
+        struct sim_usb_in_ep *in_ep = &sim_usb_dev.in_ep[ep];
+        if ((in_ep->interval == 0) || (sim_host_frame_num % in_ep->interval) || !in_ep->tx_pending) {
+            continue;
+        }
+        in_ep->tx_pending = false;
+        in_ep->tx_complete = true;
+        if (ep == SIM_USB_CONFIG_EP) {
+            memcpy(sim_host_config_response, in_ep->tx_buf, sizeof(sim_host_config_response));
+            sim_host_config_response_available = true;
+        } else {
+            sim_host_receive(in_ep->tx_buf, in_ep->tx_len);
+        }
+    }
+
+    // the config request goes out once the device takes it
+    struct sim_usb_out_ep *out_ep = &sim_usb_dev.out_ep[SIM_USB_CONFIG_EP];
+    if (sim_host_config_request_pending && (out_ep->interval != 0) && !(sim_host_frame_num % out_ep->interval)
+        && !out_ep->nak && !out_ep->rx_full) {
+        memcpy(out_ep->rx_buf, sim_host_config_request, sizeof(sim_host_config_request));
+        out_ep->rx_len = sizeof(sim_host_config_request);
+        out_ep->rx_full = true;
+        out_ep->rx_complete = true;
+        sim_host_config_request_pending = false;
+    }
+}
+
+void sim_host_send_config_request(const uint8_t *request) {
+    memcpy(sim_host_config_request, request, sizeof(sim_host_config_request));
+    sim_host_config_request_pending = true;
+}
+
+bool sim_host_get_config_response(uint8_t *response) {
+    if (!sim_host_config_response_available) {
+        return false;
+    }
+    memcpy(response, sim_host_config_response, sizeof(sim_host_config_response));
+    sim_host_config_response_available = false;
+    return true;
+}
+
+static void sim_host_control(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wLength,
+    const uint8_t *data) {
+
+    if (sim_usb_dev.setup_pending) {
+        fprintf(stderr, "sim: control request %02x issued while another one is pending\n", bRequest);
+        abort();
+    }
+
+    sim_usb_dev.setup.bmRequestType = bmRequestType;
+    sim_usb_dev.setup.bRequest = bRequest;
+    sim_usb_dev.setup.wValue = wValue;
+    sim_usb_dev.setup.wIndex = 0;
+    sim_usb_dev.setup.wLength = wLength;
+    if (!(bmRequestType & USB_REQ_TYPE_IN)) {
+        memcpy(sim_usb_dev.setup_data, data, wLength);
+    }
+    sim_usb_dev.setup_pending = true;
+}
+
+void sim_host_set_leds(uint8_t leds) {
+    // Set_Report(Output, report ID 0)
+    sim_host_control(USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE, USB_HID_REQ_TYPE_SET_REPORT, 0x0200, 1, &leds);
+}
+
+void sim_host_set_boot_protocol(bool boot) {
+    sim_host_control(USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE, USB_HID_REQ_TYPE_SET_PROTOCOL, boot ? 0 : 1, 0,
+        NULL);
+    sim_host_boot_protocol = boot;
+}
+
+void sim_host_set_remote_wakeup(bool enable) {
+    sim_host_control(USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE,
+        enable ? USB_REQ_SET_FEATURE : USB_REQ_CLEAR_FEATURE, USB_FEAT_DEVICE_REMOTE_WAKEUP, 0, NULL);
+}
+
+void sim_host_get_device_status(void) {
+    sim_host_control(USB_REQ_TYPE_IN | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE, USB_REQ_GET_STATUS, 0, 2, NULL);
+}
+
+int sim_host_control_result(uint8_t *data) {
+    if (sim_usb_dev.setup_pending || sim_usb_dev.control_stalled) {
+        return -1;
+    }
+    memcpy(data, sim_usb_dev.control_in, sim_usb_dev.control_in_len);
+    return sim_usb_dev.control_in_len;
+}
+
+void sim_host_suspend(void) {
+    sim_host_suspended = true;
+    sim_usb_dev.suspend_pending = true;
+}
+
+void sim_host_resume(void) {
+    sim_host_suspended = false;
+    sim_usb_dev.resume_pending = true;
+}
+
+bool sim_host_is_suspended(void) {
+    return sim_host_suspended;
+}
+
+uint32_t sim_host_num_remote_wakeups(void) {
+    return sim_host_remote_wakeups;
+}
+
+void sim_host_set_paused(bool paused) {
+    sim_host_paused = paused;
+}
+
+void sim_host_set_verbose(bool verbose) {
+    sim_host_verbose = verbose;
+}
+
+bool sim_host_key_down(uint8_t key_code) {
+    if ((key_code >= KEY_LEFTCTRL) && (key_code <= KEY_RIGHTMETA)) {
+        return sim_host_modifiers & (1 << (key_code - KEY_LEFTCTRL));
+    }
+    return sim_host_keys[key_code / 8] & (1 << (key_code % 8));
+}
+
+uint32_t sim_host_key_presses(uint8_t key_code) {
+    return sim_host_presses[key_code];
+}
+
+void sim_host_clear_text(void) {
+    sim_host_text_len = 0;
+    sim_host_text[0] = '\0';
+}
+
+const char *sim_host_get_text(void) {
+    sim_host_text[sim_host_text_len] = '\0';
+    return sim_host_text;
+}
+
+bool sim_host_rollover_error(void) {
+    return sim_host_rollover;
+}
+
+uint32_t sim_host_num_reports(void) {
+    return sim_host_reports;
+}
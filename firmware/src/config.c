@@ -0,0 +1,337 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "config.h"
+#include "debounce.h"
+#include "event_queue.h"
+#include "flash_store.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "latency.h"
+#include "led.h"
+#include "macro.h"
+#include "trace.h"
+#include "usb_hid.h"
+
+#include <string.h>
+
+#define CONFIG_SETTING_DEFAULT 0xff
+
+// header in front of each command and each result
+#define CONFIG_COMMAND_HEADER_SIZE 2
+#define CONFIG_RESULT_HEADER_SIZE 3
+
+#define CONFIG_TRACE_ENTRY_SIZE 8
+
+// the most a single result can hold, in a response of its own
+#define CONFIG_MAX_RESULT_SIZE (USB_HID_CONFIG_REPORT_SIZE - CONFIG_RESULT_HEADER_SIZE)
+
+// trace entries that fit in a response after the sequence number, more are never returned at once
+#define CONFIG_TRACE_MAX_ENTRIES \
+    ((USB_HID_CONFIG_REPORT_SIZE - CONFIG_RESULT_HEADER_SIZE - 4) / CONFIG_TRACE_ENTRY_SIZE)
+
+#if CONFIG_SETTINGS_FLASH_STORE_ADDR + CONFIG_NUM_SETTINGS > FLASH_STORE_SIZE
+#error "the settings do not fit into the flash store"
+#endif
+
+static uint8_t config_settings[CONFIG_NUM_SETTINGS];
+
+static void put_u16(uint8_t *data, uint16_t value) {
+    data[0] = value & 0xff;
+    data[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *data, uint32_t value) {
+    put_u16(data, value & 0xffff);
+    put_u16(data + 2, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *data) {
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *data) {
+    return get_u16(data) | ((uint32_t)get_u16(data + 2) << 16);
+}
+
+static void apply_settings(void) {
+    uint8_t mode = config_settings[CONFIG_SETTING_DEBOUNCE_MODE];
+    uint8_t time_ms = config_settings[CONFIG_SETTING_DEBOUNCE_TIME];
+    keyboard_set_debounce((mode == CONFIG_SETTING_DEFAULT) ? DEBOUNCE_DEFAULT_MODE : (enum debounce_mode)mode,
+        (time_ms == CONFIG_SETTING_DEFAULT) ? DEBOUNCE_DEFAULT_TIME_MS : time_ms);
+
+    mode = config_settings[CONFIG_SETTING_TAP_HOLD_MODE];
+    uint8_t term = config_settings[CONFIG_SETTING_TAPPING_TERM];
+    keyboard_set_tap_hold(
+        (mode == CONFIG_SETTING_DEFAULT) ? KEYBOARD_TAP_HOLD_DEFAULT_MODE : (enum keyboard_tap_hold_mode)mode,
+        (term == CONFIG_SETTING_DEFAULT) ? KEYBOARD_TAPPING_TERM_MS : term * 10);
+
+    uint8_t brightness = config_settings[CONFIG_SETTING_LED_BRIGHTNESS];
+    led_set_brightness((brightness == CONFIG_SETTING_DEFAULT) ? LED_DEFAULT_BRIGHTNESS : brightness);
+}
+
+static bool setting_valid(uint8_t setting, uint8_t value) {
+    switch (setting) {
+        case CONFIG_SETTING_DEBOUNCE_MODE:
+            return (value <= DEBOUNCE_ROW) || (value == CONFIG_SETTING_DEFAULT);
+        case CONFIG_SETTING_DEBOUNCE_TIME:
+            return true;
+        case CONFIG_SETTING_TAP_HOLD_MODE:
+            return (value <= KEYBOARD_TAP_HOLD_INTERRUPT) || (value == CONFIG_SETTING_DEFAULT);
+        case CONFIG_SETTING_TAPPING_TERM:
+            return value != 0;
+        case CONFIG_SETTING_LED_BRIGHTNESS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// GET_TRACE returns the entries asked for, but no more than fit in the response
+static uint8_t trace_entries_wanted(const uint8_t *args) {
+    return (args[4] < CONFIG_TRACE_MAX_ENTRIES) ? args[4] : CONFIG_TRACE_MAX_ENTRIES;
+}
+
+// run a single command, returns the status and fills in the result
+static enum config_status run_command(uint8_t command, const uint8_t *args, uint8_t args_len, uint8_t *result,
+    uint8_t *result_len) {
+
+    *result_len = 0;
+    switch (command) {
+        case CONFIG_CMD_GET_INFO:
+            result[0] = CONFIG_PROTOCOL_VERSION;
+            result[1] = KEYMAP_NUM_LAYERS;
+            result[2] = NUM_ROWS;
+            result[3] = NUM_COLS;
+            put_u16(&result[4], MACRO_STORE_SIZE);
+            *result_len = 6;
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_GET_STATE:
+            result[0] = keyboard_get_layers();
+            result[1] = (macro_playing() ? CONFIG_STATE_MACRO_PLAYING : 0)
+                | (flash_store_busy() ? CONFIG_STATE_FLASH_BUSY : 0);
+            put_u32(&result[2], keyboard_get_time_ms());
+            put_u32(&result[6], event_queue_overflows());
+            put_u32(&result[10], usb_hid_get_report_overflows());
+            *result_len = 14;
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_GET_KEYMAP: {
+            if ((args_len != 4) || (args[0] >= KEYMAP_NUM_LAYERS) || (args[1] >= NUM_ROWS)
+                || (args[2] + args[3] > NUM_COLS) || (2 * args[3] > CONFIG_MAX_RESULT_SIZE)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            for (uint8_t i = 0; i < args[3]; i++) {
+                put_u16(&result[2 * i], keymap_layers[args[0]][args[1]][args[2] + i]);
+            }
+            *result_len = 2 * args[3];
+            return CONFIG_STATUS_OK;
+        }
+
+        case CONFIG_CMD_SET_KEYMAP: {
+            if ((args_len < 3) || ((args_len - 3) % 2)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            uint8_t count = (args_len - 3) / 2;
+            if ((args[0] >= KEYMAP_NUM_LAYERS) || (args[1] >= NUM_ROWS) || (args[2] + count > NUM_COLS)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            // the entries in front of one that could not be stored stay changed
+            bool stored = true;
+            for (uint8_t i = 0; (i < count) && stored; i++) {
+                stored = keymap_set(args[0], args[1], args[2] + i, get_u16(&args[3 + (2 * i)]));
+            }
+            keyboard_keymap_changed();
+            return stored ? CONFIG_STATUS_OK : CONFIG_STATUS_INVALID;
+        }
+
+        case CONFIG_CMD_RESET_KEYMAP:
+            keymap_reset();
+            keyboard_keymap_changed();
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_GET_MACROS: {
+            if ((args_len != 3) || (get_u16(args) + args[2] > MACRO_STORE_SIZE) || (args[2] > CONFIG_MAX_RESULT_SIZE)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            memcpy(result, macro_get_data() + get_u16(args), args[2]);
+            *result_len = args[2];
+            return CONFIG_STATUS_OK;
+        }
+
+        case CONFIG_CMD_SET_MACROS:
+            if ((args_len < 2) || !macro_write(get_u16(args), &args[2], args_len - 2)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_LOAD_MACROS:
+            return macro_load() ? CONFIG_STATUS_OK : CONFIG_STATUS_INVALID;
+
+        case CONFIG_CMD_GET_SETTING:
+            if ((args_len != 1) || (args[0] >= CONFIG_NUM_SETTINGS)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            result[0] = config_settings[args[0]];
+            *result_len = 1;
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_SET_SETTING:
+            if ((args_len != 2) || !setting_valid(args[0], args[1])) {
+                return CONFIG_STATUS_INVALID;
+            }
+            config_settings[args[0]] = args[1];
+            flash_store_write(CONFIG_SETTINGS_FLASH_STORE_ADDR + args[0], &args[1], 1);
+            apply_settings();
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_FLUSH:
+            flash_store_flush();
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_GET_LATENCY:
+        case CONFIG_CMD_GET_LATENCY_HISTOGRAM: {
+            if ((args_len != 1) || (args[0] >= LATENCY_NUM_PROBES)) {
+                return CONFIG_STATUS_INVALID;
+            }
+            struct latency_stats stats;
+            latency_get(args[0], &stats);
+            if (command == CONFIG_CMD_GET_LATENCY_HISTOGRAM) {
+                for (uint8_t bucket = 0; bucket < LATENCY_NUM_BUCKETS; bucket++) {
+                    put_u16(&result[2 * bucket], stats.histogram[bucket]);
+                }
+                *result_len = 2 * LATENCY_NUM_BUCKETS;
+                return CONFIG_STATUS_OK;
+            }
+            put_u32(&result[0], stats.count);
+            put_u16(&result[4], stats.min_us);
+            put_u16(&result[6], stats.count ? (stats.total_us / stats.count) : 0);
+            put_u16(&result[8], stats.max_us);
+            *result_len = 10;
+            return CONFIG_STATUS_OK;
+        }
+
+        case CONFIG_CMD_RESET_LATENCY:
+            latency_reset();
+            return CONFIG_STATUS_OK;
+
+        case CONFIG_CMD_GET_TRACE: {
+            if (args_len != 5) {
+                return CONFIG_STATUS_INVALID;
+            }
+            uint32_t sequence = get_u32(args);
+            struct trace_entry entries[CONFIG_TRACE_MAX_ENTRIES];
+            uint8_t count = trace_read(&sequence, entries, trace_entries_wanted(args));
+            put_u32(&result[0], sequence);
+            for (uint8_t i = 0; i < count; i++) {
+                uint8_t *entry = &result[4 + (CONFIG_TRACE_ENTRY_SIZE * i)];
+                put_u32(&entry[0], entries[i].time_us);
+                entry[4] = entries[i].event;
+                entry[5] = entries[i].arg;
+                put_u16(&entry[6], entries[i].value);
+            }
+            *result_len = 4 + (CONFIG_TRACE_ENTRY_SIZE * count);
+            return CONFIG_STATUS_OK;
+        }
+
+        case CONFIG_CMD_CLEAR_TRACE:
+            trace_clear();
+            return CONFIG_STATUS_OK;
+
+        default:
+            return CONFIG_STATUS_UNKNOWN_COMMAND;
+    }
+}
+
+// the largest result of a command, so it can be checked to fit before running it
+static uint16_t max_result_len(uint8_t command, const uint8_t *args, uint8_t args_len) {
+    switch (command) {
+        case CONFIG_CMD_GET_INFO:
+            return 6;
+        case CONFIG_CMD_GET_STATE:
+            return 14;
+        case CONFIG_CMD_GET_KEYMAP:
+            // a read that could never fit is refused without a result
+            return ((args_len == 4) && (2 * args[3] <= CONFIG_MAX_RESULT_SIZE)) ? 2 * args[3] : 0;
+        case CONFIG_CMD_GET_MACROS:
+            return ((args_len == 3) && (args[2] <= CONFIG_MAX_RESULT_SIZE)) ? args[2] : 0;
+        case CONFIG_CMD_GET_SETTING:
+            return 1;
+        case CONFIG_CMD_GET_LATENCY:
+            return 10;
+        case CONFIG_CMD_GET_LATENCY_HISTOGRAM:
+            return 2 * LATENCY_NUM_BUCKETS;
+        case CONFIG_CMD_GET_TRACE:
+            return (args_len == 5) ? 4 + (CONFIG_TRACE_ENTRY_SIZE * trace_entries_wanted(args)) : 0;
+        default:
+            return 0;
+    }
+}
+
+void config_init(void) {
+    flash_store_read(CONFIG_SETTINGS_FLASH_STORE_ADDR, config_settings, sizeof(config_settings));
+    for (uint8_t setting = 0; setting < CONFIG_NUM_SETTINGS; setting++) {
+        if (!setting_valid(setting, config_settings[setting])) {
+            config_settings[setting] = CONFIG_SETTING_DEFAULT;
+        }
+    }
+    apply_settings();
+}
+
+void config_poll(void) {
+    uint8_t request[USB_HID_CONFIG_REPORT_SIZE];
+    if (!usb_hid_get_config_request(request)) {
+        return;
+    }
+
+    uint8_t response[USB_HID_CONFIG_REPORT_SIZE];
+    memset(response, 0, sizeof(response));
+
+    size_t request_pos = 0;
+    size_t response_pos = 0;
+    while (request_pos + CONFIG_COMMAND_HEADER_SIZE <= sizeof(request)) {
+        uint8_t command = request[request_pos];
+        uint8_t args_len = request[request_pos + 1];
+        const uint8_t *args = &request[request_pos + CONFIG_COMMAND_HEADER_SIZE];
+        if ((command == CONFIG_CMD_END)
+            || (request_pos + CONFIG_COMMAND_HEADER_SIZE + args_len > sizeof(request))) {
+            break;
+        }
+
+        uint8_t *result = &response[response_pos + CONFIG_RESULT_HEADER_SIZE];
+        if (response_pos + CONFIG_RESULT_HEADER_SIZE + max_result_len(command, args, args_len) > sizeof(response)) {
+            break;
+        }
+
+        uint8_t result_len;
+        response[response_pos] = command;
+        response[response_pos + 1] = run_command(command, args, args_len, result, &result_len);
+        response[response_pos + 2] = result_len;
+
+        request_pos += CONFIG_COMMAND_HEADER_SIZE + args_len;
+        response_pos += CONFIG_RESULT_HEADER_SIZE + result_len;
+    }
+
+    usb_hid_send_config_response(response);
+}
@@ -0,0 +1,170 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "debounce.h"
+#include "keyboard.h"
+#include "ramfunc.h"
+
+#include <string.h>
+
+static enum debounce_mode debounce_mode = DEBOUNCE_DEFAULT_MODE;
+static uint8_t debounce_time_ms = DEBOUNCE_DEFAULT_TIME_MS;
+
+// debounced state of each key, one bit per column
+static uint16_t debounce_state[NUM_ROWS];
+
+// keys with a running timer, one bit per column
+static uint16_t debounce_active[NUM_ROWS];
+
+// remaining time of each key's timer (per-key modes) or of the row's timer (DEBOUNCE_ROW)
+static uint8_t debounce_timer[NUM_ROWS][NUM_COLS];
+
+// raw state of each row at its previous scan
+static uint16_t debounce_last_raw[NUM_ROWS];
+
+// advance the running timers of a row, returns the keys whose timer expired
+static uint16_t tick_timers(uint16_t row, uint8_t elapsed_ms) {
+    uint16_t expired = 0;
+    uint16_t active = debounce_active[row];
+
+    while (active) {
+        int col = __builtin_ctz(active);
+        active &= active - 1;
+
+        if (debounce_timer[row][col] <= elapsed_ms) {
+            debounce_timer[row][col] = 0;
+            expired |= 1 << col;
+        } else {
+            debounce_timer[row][col] -= elapsed_ms;
+        }
+    }
+
+    debounce_active[row] &= ~expired;
+    return expired;
+}
+
+static void start_timers(uint16_t row, uint16_t cols) {
+    debounce_active[row] |= cols;
+    while (cols) {
+        int col = __builtin_ctz(cols);
+        cols &= cols - 1;
+        debounce_timer[row][col] = debounce_time_ms;
+    }
+}
+
+FLASHFUNC static uint16_t debounce_eager(uint16_t row, uint16_t raw_cols, uint8_t elapsed_ms) {
+    uint16_t state = debounce_state[row];
+    uint16_t expired = tick_timers(row, elapsed_ms);
+
+    // a released key with a running timer is locked out, any other press registers immediately
+    uint16_t pressed = raw_cols & ~state & ~debounce_active[row];
+
+    // releases register once their timer runs out, and are cancelled if the key reads pressed again
+    uint16_t releasing = ~raw_cols & state;
+    uint16_t released = releasing & expired;
+    debounce_active[row] &= ~(raw_cols & state);
+    start_timers(row, releasing & ~expired & ~debounce_active[row]);
+
+    // lock out the freshly released keys
+    start_timers(row, released);
+
+    debounce_state[row] = (state | pressed) & ~released;
+    return debounce_state[row];
+}
+
+FLASHFUNC static uint16_t debounce_deferred(uint16_t row, uint16_t raw_cols, uint8_t elapsed_ms) {
+    uint16_t state = debounce_state[row];
+    uint16_t expired = tick_timers(row, elapsed_ms);
+
+    // keys that read their debounced state again cancel their timer
+    uint16_t changing = raw_cols ^ state;
+    uint16_t changed = changing & expired;
+    debounce_active[row] &= changing;
+    start_timers(row, changing & ~expired & ~debounce_active[row]);
+
+    debounce_state[row] = state ^ changed;
+    return debounce_state[row];
+}
+
+FLASHFUNC static uint16_t debounce_per_row(uint16_t row, uint16_t raw_cols, uint8_t elapsed_ms) {
+    // the whole row shares the timer of its first key
+    uint8_t *timer = &debounce_timer[row][0];
+
+    if (raw_cols != debounce_last_raw[row]) {
+        // any change restarts the row's timer
+        *timer = debounce_time_ms;
+        debounce_active[row] = 1;
+    } else if (debounce_active[row]) {
+        if (*timer > elapsed_ms) {
+            *timer -= elapsed_ms;
+        } else {
+            *timer = 0;
+            debounce_active[row] = 0;
+            debounce_state[row] = raw_cols;
+        }
+    }
+
+    return debounce_state[row];
+}
+
+void debounce_init(enum debounce_mode mode, uint8_t debounce_ms) {
+    debounce_mode = mode;
+    debounce_time_ms = debounce_ms;
+
+    memset(debounce_state, 0, sizeof(debounce_state));
+    memset(debounce_active, 0, sizeof(debounce_active));
+    memset(debounce_timer, 0, sizeof(debounce_timer));
+    memset(debounce_last_raw, 0, sizeof(debounce_last_raw));
+}
+
+void debounce_set(enum debounce_mode mode, uint8_t debounce_ms) {
+    debounce_mode = mode;
+    debounce_time_ms = debounce_ms;
+
+    // keep the debounced state, so held keys stay down - only the running timers start over
+    memset(debounce_active, 0, sizeof(debounce_active));
+    memset(debounce_timer, 0, sizeof(debounce_timer));
+}
+
+RAMFUNC uint16_t debounce_row(uint16_t row, uint16_t raw_cols, uint8_t elapsed_ms) {
+    // nothing changing and no timers running - by far the most common case
+    if ((raw_cols == debounce_state[row]) && (raw_cols == debounce_last_raw[row]) && !debounce_active[row]) {
+        return raw_cols;
+    }
+
+    uint16_t state;
+    if (debounce_time_ms == 0) {
+        debounce_state[row] = raw_cols;
+        state = raw_cols;
+    } else if (debounce_mode == DEBOUNCE_ROW) {
+        state = debounce_per_row(row, raw_cols, elapsed_ms);
+    } else if (debounce_mode == DEBOUNCE_DEFERRED) {
+        state = debounce_deferred(row, raw_cols, elapsed_ms);
+    } else {
+        state = debounce_eager(row, raw_cols, elapsed_ms);
+    }
+
+    debounce_last_raw[row] = raw_cols;
+    return state;
+}
@@ -0,0 +1,86 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "event_queue.h"
+#include "ramfunc.h"
+
+#include <string.h>
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+#if (EVENT_QUEUE_SIZE & EVENT_QUEUE_MASK) != 0
+#error "EVENT_QUEUE_SIZE must be a power of two"
+#endif
+
+// keeps the compiler from moving the slot accesses across the index updates, the M0 itself doesn't reorder them
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
+
+static struct key_event event_queue[EVENT_QUEUE_SIZE];
+
+// free running indices, only the producer writes the head and only the consumer writes the tail
+static volatile uint8_t event_queue_head = 0;
+static volatile uint8_t event_queue_tail = 0;
+
+static volatile uint32_t event_queue_num_overflows = 0;
+
+void event_queue_init(void) {
+    memset(event_queue, 0, sizeof(event_queue));
+    event_queue_head = 0;
+    event_queue_tail = 0;
+    event_queue_num_overflows = 0;
+}
+
+RAMFUNC bool event_queue_push(const struct key_event *event) {
+    uint8_t head = event_queue_head;
+    if ((uint8_t)(head - event_queue_tail) == EVENT_QUEUE_SIZE) {
+        event_queue_num_overflows++;
+        return false;
+    }
+
+    event_queue[head & EVENT_QUEUE_MASK] = *event;
+    COMPILER_BARRIER();
+    event_queue_head = head + 1;
+    return true;
+}
+
+RAMFUNC bool event_queue_pop(struct key_event *event) {
+    uint8_t tail = event_queue_tail;
+    if (tail == event_queue_head) {
+        return false;
+    }
+
+    COMPILER_BARRIER();
+    *event = event_queue[tail & EVENT_QUEUE_MASK];
+    COMPILER_BARRIER();
+    event_queue_tail = tail + 1;
+    return true;
+}
+
+bool event_queue_empty(void) {
+    return event_queue_tail == event_queue_head;
+}
+
+uint32_t event_queue_overflows(void) {
+    return event_queue_num_overflows;
+}
@@ -21,41 +21,451 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-
 #include "flash_store.h"
 
+#include <stddef.h>
 #include <string.h>
 
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/memorymap.h>
 
-#define FLASH_STORE_BASE_ADDR (FLASH_BASE + (FLASH_PAGE_SIZE * (FLASH_NUM_PAGES - 1)))
 #define HALF_WORD_SIZE sizeof(uint16_t)
 
-void flash_store_write(uint16_t addr, void *data, uint16_t size) {
-    if ((addr >= FLASH_PAGE_SIZE) || (addr + size > FLASH_PAGE_SIZE)) {
-        return;
+#define FLASH_STORE_BASE_ADDR (FLASH_BASE + (FLASH_PAGE_SIZE * (FLASH_NUM_PAGES - FLASH_STORE_NUM_PAGES)))
+#define FLASH_STORE_BANK_PAGES (FLASH_STORE_NUM_PAGES / 2)
+#define FLASH_STORE_BANK_SIZE (FLASH_STORE_BANK_PAGES * FLASH_PAGE_SIZE)
+
+#define FLASH_STORE_BANK_MAGIC 0x4b53  // "SK"
+
+// compaction copies the contents in chunks of this size, skipping the ones never written
+#define FLASH_STORE_CHUNK_SIZE 64
+
+// records with this address and no data end a batch, making the records in front of them valid
+#define FLASH_STORE_COMMIT_ADDR 0x8000
+
+#define FLASH_STORE_NO_BANK 0xff
+
+#if (FLASH_STORE_NUM_PAGES < 2) || (FLASH_STORE_NUM_PAGES % 2)
+#error "FLASH_STORE_NUM_PAGES must be an even number of at least two"
+#endif
+
+// at the start of each bank, written last when a bank is set up - a bank without it is ignored
+struct flash_store_bank_header {
+    uint16_t magic;
+    uint16_t sequence;  // incremented with every compaction, the higher one of two valid banks is the newer one
+    uint16_t sequence_inv;
+    uint16_t reserved;
+} __attribute__((packed));
+
+// in front of the data of every record, the data is padded to a whole number of half-words
+struct flash_store_record {
+    uint16_t size;  // written first, 0xFFFF marks the end of the log
+    uint16_t addr;
+    uint16_t crc;   // over addr, size and data, written last - a record with a bad CRC is skipped
+} __attribute__((packed));
+
+// in front of the data of every write waiting to be committed
+struct flash_store_pending {
+    uint16_t addr;
+    uint16_t size;
+} __attribute__((packed));
+
+#define FLASH_STORE_LOG_START sizeof(struct flash_store_bank_header)
+#define FLASH_STORE_RECORD_SPACE(size) (sizeof(struct flash_store_record) + (((size) + 1) & ~1))
+#define FLASH_STORE_PENDING_SPACE(size) (sizeof(struct flash_store_pending) + (size))
+
+// a compacted bank must always have room for the whole address space and the largest possible batch
+_Static_assert(FLASH_STORE_LOG_START
+    + (FLASH_STORE_SIZE / FLASH_STORE_CHUNK_SIZE) * FLASH_STORE_RECORD_SPACE(FLASH_STORE_CHUNK_SIZE)
+    + FLASH_STORE_RECORD_SPACE(0) + 2 * FLASH_STORE_PENDING_SIZE + FLASH_STORE_RECORD_SPACE(0)
+    <= FLASH_STORE_BANK_SIZE, "FLASH_STORE_SIZE does not fit into a bank");
+
+enum flash_store_commit_step {
+    COMMIT_IDLE,
+    COMMIT_COMPACT_ERASE,      // erase the next page of the new bank
+    COMMIT_COMPACT_COPY,       // copy the next chunk into the new bank
+    COMMIT_COMPACT_FINISH,     // commit marker and bank header, then switch to the new bank
+    COMMIT_COMPACT_ERASE_OLD,  // erase the next page of the old bank
+    COMMIT_APPEND,             // append the next write of the batch
+    COMMIT_FINISH,             // commit marker, the batch is valid from here on
+};
+
+static uint8_t flash_store_bank = FLASH_STORE_NO_BANK;
+static uint16_t flash_store_sequence = 0;
+static uint16_t flash_store_log_end = FLASH_STORE_LOG_START;      // offset of the first free byte in the active bank
+static uint16_t flash_store_committed_end = FLASH_STORE_LOG_START;  // offset after the last commit marker
+
+// writes waiting to be committed, in the order they were made
+static uint8_t flash_store_pending[FLASH_STORE_PENDING_SIZE];
+static uint16_t flash_store_pending_used = 0;
+
+// commit in progress - it covers the pending writes in front of flash_store_batch_end, later writes wait for the
+// next batch
+static enum flash_store_commit_step flash_store_step_state = COMMIT_IDLE;
+static uint16_t flash_store_batch_end = 0;
+static uint16_t flash_store_batch_pos = 0;
+static uint16_t flash_store_step_index = 0;
+static uint8_t flash_store_other_bank = 0;        // bank being compacted into, then the one being erased
+static uint16_t flash_store_other_log_end = 0;
+
+static uint32_t bank_addr(uint8_t bank) {
+    return FLASH_STORE_BASE_ADDR + (bank * FLASH_STORE_BANK_SIZE);
+}
+
+static const struct flash_store_bank_header *bank_header(uint8_t bank) {
+    return (const struct flash_store_bank_header *)bank_addr(bank);
+}
+
+static bool bank_valid(uint8_t bank) {
+    const struct flash_store_bank_header *header = bank_header(bank);
+    return (header->magic == FLASH_STORE_BANK_MAGIC) && ((header->sequence ^ header->sequence_inv) == 0xffff);
+}
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t size) {
+    // CRC-16/CCITT, bitwise to keep it small
+    while (size--) {
+        crc ^= (uint16_t)(*data++ << 8);
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
     }
+    return crc;
+}
 
-    uint32_t flash_addr = FLASH_STORE_BASE_ADDR + addr;
+static uint16_t record_crc(uint16_t addr, uint16_t size, const uint8_t *data) {
+    uint16_t crc = crc16_update(0xffff, (const uint8_t *)&addr, sizeof(addr));
+    crc = crc16_update(crc, (const uint8_t *)&size, sizeof(size));
+    return crc16_update(crc, data, size);
+}
 
-    // read the whole page before erasing
-    uint8_t buf[FLASH_PAGE_SIZE];  // temporarily allocated so that this huge buffer doesn't stick around all the time
-    flash_store_read(0, buf, FLASH_PAGE_SIZE);
-    memcpy(&buf[addr], data, size);  // copy new data into the buffer
+// returns the record at the given offset of the active bank, or NULL at the end of the log
+static const struct flash_store_record *record_at(uint16_t offset) {
+    if (offset + sizeof(struct flash_store_record) > FLASH_STORE_BANK_SIZE) {
+        return NULL;
+    }
 
-    flash_unlock();
-    flash_erase_page(FLASH_STORE_BASE_ADDR);
-    for (uint16_t write_idx = 0; write_idx < FLASH_PAGE_SIZE; write_idx += HALF_WORD_SIZE) {
-        flash_program_half_word(flash_addr + write_idx, *(uint16_t*)&buf[write_idx]);
+    const struct flash_store_record *record = (const struct flash_store_record *)(bank_addr(flash_store_bank) + offset);
+    if ((record->size == 0xffff) || (offset + FLASH_STORE_RECORD_SPACE(record->size) > FLASH_STORE_BANK_SIZE)) {
+        return NULL;
     }
+    return record;
+}
+
+static bool record_valid(const struct flash_store_record *record) {
+    return record->crc == record_crc(record->addr, record->size, (const uint8_t *)(record + 1));
+}
+
+static bool record_is_commit(const struct flash_store_record *record) {
+    return (record->size == 0) && (record->addr == FLASH_STORE_COMMIT_ADDR) && record_valid(record);
+}
+
+static void program(uint32_t flash_addr, const uint8_t *data, uint16_t size) {
+    for (uint16_t i = 0; i < size; i += HALF_WORD_SIZE) {
+        uint16_t half_word = data[i];
+        half_word |= (i + 1 < size) ? (data[i + 1] << 8) : 0xff00;
+        flash_program_half_word(flash_addr + i, half_word);
+    }
+}
+
+// append a record to the given bank, the caller checked that it fits
+static void append_record(uint8_t bank, uint16_t *log_end, uint16_t addr, const uint8_t *data, uint16_t size) {
+    uint32_t record_addr = bank_addr(bank) + *log_end;
+
+    // size first so a torn record can still be skipped, the CRC last so it is only valid once complete
+    flash_unlock();
+    flash_program_half_word(record_addr + offsetof(struct flash_store_record, size), size);
+    flash_program_half_word(record_addr + offsetof(struct flash_store_record, addr), addr);
+    program(record_addr + sizeof(struct flash_store_record), data, size);
+    flash_program_half_word(record_addr + offsetof(struct flash_store_record, crc), record_crc(addr, size, data));
+    flash_lock();
+
+    *log_end += FLASH_STORE_RECORD_SPACE(size);
+}
+
+static void append_commit_marker(uint8_t bank, uint16_t *log_end) {
+    append_record(bank, log_end, FLASH_STORE_COMMIT_ADDR, NULL, 0);
+}
+
+static void erase_page(uint8_t bank, uint16_t page) {
+    flash_unlock();
+    flash_erase_page(bank_addr(bank) + (page * FLASH_PAGE_SIZE));
     flash_lock();
 }
 
+// the bank header is the commit marker of a freshly set up bank
+static void write_bank_header(uint8_t bank, uint16_t sequence) {
+    uint32_t header_addr = bank_addr(bank);
+    flash_unlock();
+    flash_program_half_word(header_addr + offsetof(struct flash_store_bank_header, sequence), sequence);
+    flash_program_half_word(header_addr + offsetof(struct flash_store_bank_header, sequence_inv), ~sequence);
+    flash_program_half_word(header_addr + offsetof(struct flash_store_bank_header, magic), FLASH_STORE_BANK_MAGIC);
+    flash_lock();
+}
+
+// overlay the committed records of the active bank onto data
+static void read_flash(uint16_t addr, uint8_t *data, uint16_t size) {
+    if (flash_store_bank == FLASH_STORE_NO_BANK) {
+        return;
+    }
+
+    // replay the log, newer records overwrite older ones
+    uint16_t offset = FLASH_STORE_LOG_START;
+    const struct flash_store_record *record;
+    while ((offset < flash_store_committed_end) && ((record = record_at(offset)) != NULL)) {
+        offset += FLASH_STORE_RECORD_SPACE(record->size);
+
+        uint16_t start = (record->addr > addr) ? record->addr : addr;
+        uint16_t end = ((record->addr + record->size) < (addr + size)) ? (record->addr + record->size) : (addr + size);
+        if ((start >= end) || !record_valid(record)) {
+            continue;
+        }
+        memcpy(data + (start - addr), (const uint8_t *)(record + 1) + (start - record->addr), end - start);
+    }
+}
+
+// overlay the pending writes onto data
+static void read_pending(uint16_t addr, uint8_t *data, uint16_t size) {
+    uint16_t pos = 0;
+    while (pos < flash_store_pending_used) {
+        struct flash_store_pending entry;
+        memcpy(&entry, &flash_store_pending[pos], sizeof(entry));
+        const uint8_t *entry_data = &flash_store_pending[pos + sizeof(entry)];
+        pos += FLASH_STORE_PENDING_SPACE(entry.size);
+
+        uint16_t start = (entry.addr > addr) ? entry.addr : addr;
+        uint16_t end = ((entry.addr + entry.size) < (addr + size)) ? (entry.addr + entry.size) : (addr + size);
+        if (start < end) {
+            memcpy(data + (start - addr), entry_data + (start - entry.addr), end - start);
+        }
+    }
+}
+
+// the space the pending writes of the batch take up in the log, including its commit marker
+static uint16_t batch_log_space(void) {
+    uint16_t space = FLASH_STORE_RECORD_SPACE(0);
+    uint16_t pos = 0;
+    while (pos < flash_store_batch_end) {
+        struct flash_store_pending entry;
+        memcpy(&entry, &flash_store_pending[pos], sizeof(entry));
+        pos += FLASH_STORE_PENDING_SPACE(entry.size);
+        space += FLASH_STORE_RECORD_SPACE(entry.size);
+    }
+    return space;
+}
+
+static void start_commit(void) {
+    flash_store_batch_end = flash_store_pending_used;
+    flash_store_batch_pos = 0;
+    flash_store_step_index = 0;
+
+    if ((flash_store_bank != FLASH_STORE_NO_BANK) && (flash_store_log_end == flash_store_committed_end)
+        && (flash_store_log_end + batch_log_space() <= FLASH_STORE_BANK_SIZE)) {
+        flash_store_step_state = COMMIT_APPEND;
+        return;
+    }
+
+    // out of room, no bank at all yet or a torn batch at the end of the log - compact into the other bank first,
+    // which leaves plenty of room
+    flash_store_other_bank = (flash_store_bank == FLASH_STORE_NO_BANK) ? 0 : (flash_store_bank ^ 1);
+    flash_store_other_log_end = FLASH_STORE_LOG_START;
+    flash_store_step_state = COMMIT_COMPACT_ERASE;
+}
+
+static void finish_commit(void) {
+    // the writes of the batch are in flash now, keep the ones made since the commit started
+    memmove(flash_store_pending, &flash_store_pending[flash_store_batch_end],
+        flash_store_pending_used - flash_store_batch_end);
+    flash_store_pending_used -= flash_store_batch_end;
+    flash_store_batch_end = 0;
+    flash_store_step_state = COMMIT_IDLE;
+}
+
+void flash_store_init(void) {
+    bool valid_0 = bank_valid(0);
+    bool valid_1 = bank_valid(1);
+
+    flash_store_bank = FLASH_STORE_NO_BANK;
+    flash_store_sequence = 0;
+    flash_store_log_end = FLASH_STORE_LOG_START;
+    flash_store_committed_end = FLASH_STORE_LOG_START;
+    flash_store_pending_used = 0;
+    flash_store_batch_end = 0;
+    flash_store_step_state = COMMIT_IDLE;
+
+    if (valid_0 && valid_1) {
+        // power was lost between completing a compaction and erasing the old bank
+        int16_t age = (int16_t)(bank_header(1)->sequence - bank_header(0)->sequence);
+        flash_store_bank = (age > 0) ? 1 : 0;
+    } else if (valid_0 || valid_1) {
+        flash_store_bank = valid_0 ? 0 : 1;
+    } else {
+        // nothing stored yet, the first commit sets up a bank
+        return;
+    }
+    flash_store_sequence = bank_header(flash_store_bank)->sequence;
+
+    const struct flash_store_record *record;
+    while ((record = record_at(flash_store_log_end)) != NULL) {
+        flash_store_log_end += FLASH_STORE_RECORD_SPACE(record->size);
+        if (record_is_commit(record)) {
+            flash_store_committed_end = flash_store_log_end;
+        }
+    }
+
+    // power was lost during a commit - the records of the torn batch would count as part of the next one, so move
+    // the committed contents into the other bank without them
+    if (flash_store_log_end != flash_store_committed_end) {
+        flash_store_flush();
+    }
+}
+
+bool flash_store_step(void) {
+    switch (flash_store_step_state) {
+        case COMMIT_IDLE:
+            if ((flash_store_pending_used == 0) && (flash_store_log_end == flash_store_committed_end)) {
+                return false;
+            }
+            start_commit();
+            break;
+
+        case COMMIT_COMPACT_ERASE:
+            erase_page(flash_store_other_bank, flash_store_step_index++);
+            if (flash_store_step_index == FLASH_STORE_BANK_PAGES) {
+                flash_store_step_index = 0;
+                flash_store_step_state = COMMIT_COMPACT_COPY;
+            }
+            break;
+
+        case COMMIT_COMPACT_COPY: {
+            uint16_t addr = flash_store_step_index * FLASH_STORE_CHUNK_SIZE;
+            uint8_t chunk[FLASH_STORE_CHUNK_SIZE];
+            memset(chunk, 0xff, sizeof(chunk));
+            read_flash(addr, chunk, sizeof(chunk));
+
+            bool erased = true;
+            for (uint16_t i = 0; i < sizeof(chunk); i++) {
+                erased &= (chunk[i] == 0xff);
+            }
+            if (!erased) {
+                append_record(flash_store_other_bank, &flash_store_other_log_end, addr, chunk, sizeof(chunk));
+            }
+
+            if (++flash_store_step_index == FLASH_STORE_SIZE / FLASH_STORE_CHUNK_SIZE) {
+                flash_store_step_state = COMMIT_COMPACT_FINISH;
+            }
+            break;
+        }
+
+        case COMMIT_COMPACT_FINISH: {
+            append_commit_marker(flash_store_other_bank, &flash_store_other_log_end);
+            write_bank_header(flash_store_other_bank, flash_store_sequence + 1);
+
+            // the new bank is complete, the old one is erased next
+            uint8_t old_bank = flash_store_bank;
+            flash_store_bank = flash_store_other_bank;
+            flash_store_other_bank = old_bank;
+            flash_store_sequence++;
+            flash_store_log_end = flash_store_other_log_end;
+            flash_store_committed_end = flash_store_other_log_end;
+            flash_store_step_index = 0;
+            flash_store_step_state = (old_bank == FLASH_STORE_NO_BANK) ? COMMIT_APPEND : COMMIT_COMPACT_ERASE_OLD;
+            break;
+        }
+
+        case COMMIT_COMPACT_ERASE_OLD:
+            erase_page(flash_store_other_bank, flash_store_step_index++);
+            if (flash_store_step_index == FLASH_STORE_BANK_PAGES) {
+                flash_store_step_state = COMMIT_APPEND;
+            }
+            break;
+
+        case COMMIT_APPEND: {
+            if (flash_store_batch_pos == flash_store_batch_end) {
+                flash_store_step_state = COMMIT_FINISH;
+                break;
+            }
+
+            struct flash_store_pending entry;
+            memcpy(&entry, &flash_store_pending[flash_store_batch_pos], sizeof(entry));
+            append_record(flash_store_bank, &flash_store_log_end, entry.addr,
+                &flash_store_pending[flash_store_batch_pos + sizeof(entry)], entry.size);
+            flash_store_batch_pos += FLASH_STORE_PENDING_SPACE(entry.size);
+            break;
+        }
+
+        case COMMIT_FINISH:
+            // an empty batch only compacted away a torn one
+            if (flash_store_batch_end != 0) {
+                append_commit_marker(flash_store_bank, &flash_store_log_end);
+                flash_store_committed_end = flash_store_log_end;
+            }
+            finish_commit();
+            break;
+    }
+    return true;
+}
+
+void flash_store_flush(void) {
+    while (flash_store_step()) {
+    }
+}
+
+bool flash_store_busy(void) {
+    return (flash_store_pending_used != 0) || (flash_store_step_state != COMMIT_IDLE);
+}
+
+bool flash_store_write(uint16_t addr, const void *data, uint16_t size) {
+    if ((size == 0) || (size > FLASH_STORE_PENDING_SIZE - sizeof(struct flash_store_pending))
+        || (addr >= FLASH_STORE_SIZE) || (addr + size > FLASH_STORE_SIZE)) {
+        return false;
+    }
+
+    // unchanged data costs nothing
+    uint8_t current[FLASH_STORE_CHUNK_SIZE];
+    bool changed = false;
+    for (uint16_t offset = 0; (offset < size) && !changed; offset += FLASH_STORE_CHUNK_SIZE) {
+        uint16_t chunk_size = ((size - offset) < FLASH_STORE_CHUNK_SIZE) ? (size - offset) : FLASH_STORE_CHUNK_SIZE;
+        flash_store_read(addr + offset, current, chunk_size);
+        changed = memcmp(current, (const uint8_t *)data + offset, chunk_size) != 0;
+    }
+    if (!changed) {
+        return true;
+    }
+
+    // a rewrite of the same range replaces the pending write, unless a running commit already covers it
+    uint16_t pos = flash_store_batch_end;
+    while (pos < flash_store_pending_used) {
+        struct flash_store_pending entry;
+        memcpy(&entry, &flash_store_pending[pos], sizeof(entry));
+        if ((entry.addr == addr) && (entry.size == size)) {
+            memcpy(&flash_store_pending[pos + sizeof(entry)], data, size);
+            return true;
+        }
+        pos += FLASH_STORE_PENDING_SPACE(entry.size);
+    }
+
+    // no room left to batch this write - commit what is there right away
+    if (!flash_store_has_room(size)) {
+        flash_store_flush();
+    }
+
+    struct flash_store_pending entry = {.addr = addr, .size = size};
+    memcpy(&flash_store_pending[flash_store_pending_used], &entry, sizeof(entry));
+    memcpy(&flash_store_pending[flash_store_pending_used + sizeof(entry)], data, size);
+    flash_store_pending_used += FLASH_STORE_PENDING_SPACE(size);
+    return true;
+}
+
+bool flash_store_has_room(uint16_t size) {
+    return flash_store_pending_used + FLASH_STORE_PENDING_SPACE(size) <= FLASH_STORE_PENDING_SIZE;
+}
+
 void flash_store_read(uint16_t addr, void *data, uint16_t size) {
-    if ((addr >= FLASH_PAGE_SIZE) || (addr + size > FLASH_PAGE_SIZE)) {
+    if ((addr >= FLASH_STORE_SIZE) || (addr + size > FLASH_STORE_SIZE)) {
         return;
     }
-    uint32_t flash_addr = FLASH_STORE_BASE_ADDR + addr;
-    memcpy(data, (uint32_t*)flash_addr, size);
+
+    memset(data, 0xff, size);
+    read_flash(addr, data, size);
+    read_pending(addr, data, size);
 }
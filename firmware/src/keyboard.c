@@ -23,300 +23,699 @@
  */
 
 #include "keyboard.h"
-#include "flash_store.h"
+#include "debounce.h"
+#include "event_queue.h"
 #include "hid_codes.h"
+#include "keymap.h"
+#include "latency.h"
+#include "led.h"
+#include "macro.h"
+#include "matrix.h"
+#include "ramfunc.h"
+#include "trace.h"
 #include "usb_hid.h"
 
 #include <string.h>
 
-#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/rcc.h>
 
-#define ROW_GPIO_PORT GPIOA
-#define COL_GPIO_PORT GPIOB
-
-#define ROW_START_PIN 0
-#define COL_START_PIN 0
-
-#define NUM_ROWS (uint16_t)7
-#define NUM_COLS (uint16_t)16
-
-#define NUMLK_LED_PORT GPIOA
-#define NUMLK_LED_PIN GPIO7
-
-#define CAPLK_LED_PORT GPIOA
-#define CAPLK_LED_PIN GPIO8
-
-#define SCRLK_LED_PORT GPIOA
-#define SCRLK_LED_PIN GPIO9
-
-#define HID_LED_NUMLK 0x1
-#define HID_LED_CAPLK 0x2
-#define HID_LED_SCRLK 0x4
-
-#define LED_SELF_TEST_PERIOD_MS 1000
-#define LED_SELF_TEST_CYCLES (LED_SELF_TEST_PERIOD_MS / KEYBOARD_POLL_INTERVAL_MS)
-
-#define MACRO_FLASH_STORE_ADDR 0
-#define NUM_MACROS 4
-
-enum keyboard_led {
-    KB_LED_NUMLK,
-    KB_LED_CAPLK,
-    KB_LED_SCRLK,
-};
-
-// mapping of (row, column) to key code
-static const uint8_t keyboard_key_map[NUM_ROWS][NUM_COLS] = {
-    {KEY_GRAVE, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0, KEY_MINUS, KEY_EQUAL, KEY_BACKSPACE, 0, 0},
-    {KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P, KEY_LEFTBRACE, KEY_RIGHTBRACE, KEY_BACKSLASH, 0, 0},
-    {KEY_CAPSLOCK, KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON, KEY_APOSTROPHE, KEY_ENTER, KEY_SYSRQ, KEY_SCROLLLOCK, KEY_PAUSE},
-    {0, KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B, KEY_N, KEY_M, KEY_COMMA, KEY_DOT, KEY_SLASH, 0, KEY_INSERT, KEY_HOME, KEY_PAGEUP, KEY_DELETE},
-    {0, 0, 0, KEY_SPACE, 0, 0, KEY_PROPS, 0, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12, KEY_END, KEY_PAGEDOWN},
-    {KEY_NUMLOCK, KEY_KPSLASH, KEY_KPASTERISK, KEY_KPMINUS, KEY_KP7, KEY_KP8, KEY_KP9, KEY_KPPLUS, KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KPENTER, KEY_KP0},
-    {KEY_KPDOT, KEY_UP, KEY_LEFT, KEY_DOWN, KEY_RIGHT, KEY_ESC, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, 0, 0, 0, 0},
-};
-
-// mapping of (row, column) to modifier
-static const uint8_t keyboard_modifier_map[NUM_ROWS][NUM_COLS] = {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {KEY_MOD_LSHIFT, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, KEY_MOD_RSHIFT, 0, 0, 0, 0},
-    {KEY_MOD_LCTRL, KEY_MOD_LMETA, KEY_MOD_LALT, 0, KEY_MOD_RALT, KEY_MOD_RMETA, 0, KEY_MOD_RCTRL, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-};
-
-static uint8_t keyboard_key_pressed[NUM_ROWS][NUM_COLS] = {0};
-
-struct keyboard_macro_key {
-    uint8_t row;
-    uint8_t col;
-    uint8_t key_code;
-};
-
-static struct keyboard_macro_key keyboard_macros[NUM_MACROS] = {
-    {.row = 0, .col = 14, .key_code = KEY_A},
-    {.row = 0, .col = 15, .key_code = KEY_S},
-    {.row = 1, .col = 14, .key_code = KEY_D},
-    {.row = 1, .col = 15, .key_code = KEY_F},
-};
-
-static uint16_t keyboard_poll_row = 0;
-
-static struct usb_hid_report keyboard_hid_report;
+// SysTick runs off the AHB clock divided by 8
+#define KEYBOARD_TICKS_PER_US (rcc_ahb_frequency / 8000000)
+
+// once locked on, a start of frame moves the scan by this much at most, enough to follow the two clocks drifting
+// apart - an SOF interrupt held up by another one doesn't throw the scan off
+#define KEYBOARD_SOF_SLEW_US 2
+
+// start of frames in a row further off than that before the scan gets moved all the way again
+#define KEYBOARD_SOF_UNLOCK_COUNT 8
+
+#if KEYBOARD_COMMIT_IDLE_MS > KEYBOARD_IDLE_TIMEOUT_MS
+#error "config changes must be committed before the keyboard goes to sleep"
+#endif
+
+// pressed state of each key as passed on to the main loop, one bit per column (scan side only)
+static uint16_t keyboard_key_pressed[NUM_ROWS] = {0};
+
+#if TRACE_EVENTS
+// raw state of each row as last read, to trace its changes before the debounce (scan side only)
+static uint16_t keyboard_raw_cols[NUM_ROWS] = {0};
+#endif
+
+// time of the current scan, advanced by the SysTick interrupt
+static volatile uint32_t keyboard_time_ms = 0;
+
+// time since a key was last down, saturates at KEYBOARD_IDLE_TIMEOUT_MS
+static volatile uint32_t keyboard_idle_ms = 0;
+
+// SysTick reload of a scan period - the start of frame trims the reload of a single period to move the ones after it
+static uint32_t keyboard_scan_reload = 0;
+static bool keyboard_scan_trimmed = false;
+static bool keyboard_sof_locked = false;
+static uint8_t keyboard_sof_misses = 0;
+
+// layers switched on by held, toggled and one-shot layer keys - layer 0 is always on
+static uint8_t keyboard_layers_momentary = 0;
+static uint8_t keyboard_layers_toggled = 0;
+static uint8_t keyboard_layers_one_shot = 0;
+static uint8_t keyboard_layers_active = 1;
+
+// effective mapping of (row, column) to action for the active layers - rebuilt when the active layers change, so a
+// key event is a single lookup
+static uint16_t keyboard_effective_map[NUM_ROWS][NUM_COLS];
+
+// action each key got when pressed, so its release undoes that even if the layers changed in between
+static uint16_t keyboard_pressed_action[NUM_ROWS][NUM_COLS];
+
+// a dual-role key that is down but not yet decided between tap and hold, with the events behind it: the first
+// keyboard_num_deferred are held back until the decision, the keyboard_num_replay after them are waiting to be run
+// again now that it has been made
+static bool keyboard_tap_hold_pending = false;
+static struct key_event keyboard_tap_hold_press;
+static uint16_t keyboard_tap_hold_action;
+static struct key_event keyboard_deferred_events[KEYBOARD_TAP_HOLD_MAX_DEFERRED];
+static uint8_t keyboard_num_deferred = 0;
+static uint8_t keyboard_num_replay = 0;
+
+static enum keyboard_tap_hold_mode keyboard_tap_hold_mode = KEYBOARD_TAP_HOLD_DEFAULT_MODE;
+static uint16_t keyboard_tapping_term_ms = KEYBOARD_TAPPING_TERM_MS;
+
+// keys currently pressed, in the layout of the NKRO report
+static struct usb_hid_nkro_report keyboard_hid_report;
+static enum usb_hid_protocol keyboard_hid_protocol = USB_HID_PROTOCOL_REPORT;
 
 static bool keyboard_data_updated = false;
-static bool keyboard_overflow = false;
 
-static uint32_t keyboard_led_self_test_counter = 0;
-static bool keyboard_led_self_test_done = false;
+// the keys of the last report handed to the USB side and of the one before it, to only send real changes and to
+// tell whether a report still waiting for the endpoint can take in the next one - invalid until the first report in
+// the current protocol
+static struct usb_hid_nkro_report keyboard_sent_keys;
+static struct usb_hid_nkro_report keyboard_prev_sent_keys;
+static bool keyboard_sent_keys_valid = false;
 
-static void add_key(uint8_t key_code) {
-    // don't bother trying if this key doesn't have a key code (i.e. it's a modifier key)
-    if (key_code == KEY_NONE) {
-        return;
+// scan time of the oldest key change not sent yet, and of the event being handled - for the end-to-end latency probe
+static bool keyboard_change_pending = false;
+static uint32_t keyboard_change_ms = 0;
+static uint32_t keyboard_event_ms = 0;
+
+
+static void key_data_changed(void) {
+    if (!keyboard_change_pending) {
+        keyboard_change_pending = true;
+        keyboard_change_ms = keyboard_event_ms;
     }
-    
-    int free_slot = -1;
-    for (int slot = 0; slot < MAX_NUM_KEY_CODES; slot++) {
-        // do not add a key multiple times
-        if (keyboard_hid_report.key_codes[slot] == key_code) {
-            return;
+    keyboard_data_updated = true;
+}
+
+// fill a boot protocol report with the pressed keys, returns false if they do not all fit
+static bool build_boot_report(struct usb_hid_report *report, const struct usb_hid_nkro_report *keys) {
+    memset(report, 0, sizeof(*report));
+    report->modifiers = keys->modifiers;
+
+    int slot = 0;
+    for (size_t byte = 0; byte < sizeof(keys->key_bits); byte++) {
+        uint8_t key_bits = keys->key_bits[byte];
+        while (key_bits) {
+            if (slot == MAX_NUM_KEY_CODES) {
+                return false;
+            }
+            report->key_codes[slot++] = (byte * 8) + __builtin_ctz(key_bits);
+            key_bits &= key_bits - 1;
         }
+    }
+    return true;
+}
 
-        // find the next free slot, add the key code
-        if (keyboard_hid_report.key_codes[slot] == KEY_NONE) {
-            free_slot = slot;
+// true if the host doesn't need to see the keys of the report queued last before the new ones, so the new report can
+// replace it. It does if a key it changed changes back, like a quick tap, or if it pressed keys and the new one
+// presses others or changes the modifiers, which could change what they type.
+static bool can_merge(const struct usb_hid_nkro_report *prev, const struct usb_hid_nkro_report *queued,
+    const struct usb_hid_nkro_report *keys) {
+
+    const uint8_t *prev_bytes = (const uint8_t *)prev;
+    const uint8_t *queued_bytes = (const uint8_t *)queued;
+    const uint8_t *key_bytes = (const uint8_t *)keys;
+    uint8_t queued_presses = 0;
+    uint8_t new_presses = 0;
+    for (size_t i = 0; i < sizeof(*keys); i++) {
+        uint8_t queued_changes = prev_bytes[i] ^ queued_bytes[i];
+        uint8_t new_changes = queued_bytes[i] ^ key_bytes[i];
+        if (queued_changes & new_changes) {
+            return false;
         }
+        queued_presses |= queued_changes & queued_bytes[i];
+        new_presses |= new_changes & key_bytes[i];
     }
+    return !queued_presses || (!new_presses && (queued->modifiers == keys->modifiers));
+}
 
-    if (free_slot != -1) {
-        keyboard_hid_report.key_codes[free_slot] = key_code;
-        keyboard_data_updated = true;
+FLASHFUNC static void send_key_data(void) {
+    uint32_t probe_start = latency_start();
+
+    // the keys of a playing macro go on top of the ones held - with its own modifiers, so the user's don't change
+    // what it types
+    struct usb_hid_nkro_report keys = keyboard_hid_report;
+    const struct usb_hid_nkro_report *macro_keys = macro_get_keys();
+    if (macro_playing()) {
+        keys.modifiers = macro_keys->modifiers;
+    }
+    for (size_t byte = 0; byte < sizeof(keys.key_bits); byte++) {
+        keys.key_bits[byte] |= macro_keys->key_bits[byte];
+    }
+
+    // the keys can end up the way they were last sent, like a key pressed while a macro holds it
+    bool changed = !keyboard_sent_keys_valid || (memcmp(&keys, &keyboard_sent_keys, sizeof(keys)) != 0);
+    if (keyboard_change_pending) {
+        if (changed) {
+            usb_hid_stamp_report(keyboard_change_ms);
+        }
+        keyboard_change_pending = false;
+    }
+    if (!changed) {
+        latency_end(LATENCY_PROBE_REPORT, probe_start);
+        return;
+    }
+
+    bool merge = keyboard_sent_keys_valid && can_merge(&keyboard_prev_sent_keys, &keyboard_sent_keys, &keys);
+    bool merged;
+    if (keyboard_hid_protocol == USB_HID_PROTOCOL_REPORT) {
+        latency_end(LATENCY_PROBE_REPORT, probe_start);
+        merged = usb_hid_send_nkro_report(&keys, merge);
     } else {
-        // overflow - indicate this to the host
-        keyboard_overflow = true;
+        struct usb_hid_report boot_report;
+        if (!build_boot_report(&boot_report, &keys)) {
+            // in case of an overflow, set all key slots to KEY_ERR_OVF
+            memset(boot_report.key_codes, KEY_ERR_OVF, sizeof(boot_report.key_codes));
+        }
+        latency_end(LATENCY_PROBE_REPORT, probe_start);
+        merged = usb_hid_send_report(&boot_report, merge);
+    }
+
+    if (!merged) {
+        // the first report in this protocol is taken as what the host had before
+        keyboard_prev_sent_keys = keyboard_sent_keys_valid ? keyboard_sent_keys : keys;
     }
+    keyboard_sent_keys = keys;
+    keyboard_sent_keys_valid = true;
 }
 
-static void remove_key(uint8_t key_code) {
+// send what changed so far as a report of its own, so the next change doesn't merge with it
+static void flush_key_data(void) {
+    if (keyboard_data_updated) {
+        send_key_data();
+        keyboard_data_updated = false;
+    }
+}
+
+// set or clear bits of the report - a key changing back before its last change has been sent makes that change go
+// out in a report of its own first, so the host sees a press or release however short
+static void change_key_bits(uint8_t *bits, const uint8_t *sent_bits, uint8_t mask, bool set) {
+    uint8_t changes = set ? (mask & ~*bits) : (mask & *bits);
+    if (!changes) {
+        return;
+    }
+
+    if (keyboard_sent_keys_valid && ((*bits ^ *sent_bits) & changes)) {
+        flush_key_data();
+    }
+    *bits ^= changes;
+    key_data_changed();
+}
+
+static void add_key(uint8_t key_code) {
     // don't bother trying if this key doesn't have a key code (i.e. it's a modifier key)
-    if (key_code == KEY_NONE) {
+    if ((key_code == KEY_NONE) || (key_code >= NKRO_NUM_KEY_CODES)) {
         return;
     }
 
-    for (int slot = 0; slot < MAX_NUM_KEY_CODES; slot++) {
-        // reset slot to zero
-        if (keyboard_hid_report.key_codes[slot] == key_code) {
-            keyboard_hid_report.key_codes[slot] = KEY_NONE;
-            keyboard_data_updated = true;
-            keyboard_overflow = false;
-            // don't immediately return in case the key is in multiple slots (shouldn't happen)
-        }
+    change_key_bits(&keyboard_hid_report.key_bits[key_code / 8], &keyboard_sent_keys.key_bits[key_code / 8],
+        1 << (key_code % 8), true);
+}
+
+static void remove_key(uint8_t key_code) {
+    // don't bother trying if this key doesn't have a key code (i.e. it's a modifier key)
+    if ((key_code == KEY_NONE) || (key_code >= NKRO_NUM_KEY_CODES)) {
+        return;
     }
+
+    change_key_bits(&keyboard_hid_report.key_bits[key_code / 8], &keyboard_sent_keys.key_bits[key_code / 8],
+        1 << (key_code % 8), false);
 }
 
 static void add_modifier(uint8_t mod_mask) {
-    keyboard_hid_report.modifiers |= mod_mask;
-    keyboard_data_updated = true;
+    change_key_bits(&keyboard_hid_report.modifiers, &keyboard_sent_keys.modifiers, mod_mask, true);
 }
 
 static void remove_modifier(uint8_t mod_mask) {
-    keyboard_hid_report.modifiers &= ~mod_mask;
-    keyboard_data_updated = true;
+    change_key_bits(&keyboard_hid_report.modifiers, &keyboard_sent_keys.modifiers, mod_mask, false);
+}
+
+static void get_host_state(void) {
+    // the LEDs only change when the host sends a new state
+    if (usb_hid_leds_pending()) {
+        uint8_t leds = 0;
+        usb_hid_get_leds(&leds);
+        led_set(leds);
+    }
+
+    // resend the pressed keys in the new format when the host switches protocol
+    enum usb_hid_protocol protocol = usb_hid_get_protocol();
+    if (protocol != keyboard_hid_protocol) {
+        keyboard_hid_protocol = protocol;
+        keyboard_data_updated = true;
+        keyboard_sent_keys_valid = false;
+    }
+}
+
+// highest active layer with an entry for the key that doesn't fall through
+static uint8_t resolve_layer(uint16_t row, uint16_t col) {
+    uint8_t layers = keyboard_layers_active;
+    while (layers > 1) {
+        uint8_t layer = 31 - __builtin_clz(layers);
+        if (keymap_layers[layer][row][col] != KEYMAP_TRANSPARENT) {
+            return layer;
+        }
+        layers &= ~(1 << layer);
+    }
+    return 0;
+}
+
+static void build_effective_map(void) {
+    for (uint16_t row = 0; row < NUM_ROWS; row++) {
+        for (uint16_t col = 0; col < NUM_COLS; col++) {
+            keyboard_effective_map[row][col] = keymap_layers[resolve_layer(row, col)][row][col];
+        }
+    }
+}
+
+static void update_layers(void) {
+    uint8_t layers = 1 | keyboard_layers_momentary | keyboard_layers_toggled | keyboard_layers_one_shot;
+    if (layers != keyboard_layers_active) {
+        keyboard_layers_active = layers;
+        build_effective_map();
+    }
+}
+
+void keyboard_init(void) {
+    matrix_init();
+
+    led_init();
+
+    // ensure keyboard data is zeroed out
+    memset(&keyboard_hid_report, 0, sizeof(keyboard_hid_report));
+
+    debounce_init(DEBOUNCE_DEFAULT_MODE, DEBOUNCE_DEFAULT_TIME_MS);
+    event_queue_init();
+    memset(keyboard_key_pressed, 0, sizeof(keyboard_key_pressed));
+#if TRACE_EVENTS
+    memset(keyboard_raw_cols, 0, sizeof(keyboard_raw_cols));
+#endif
+    keyboard_time_ms = 0;
+    keyboard_idle_ms = 0;
+    keyboard_layers_momentary = 0;
+    keyboard_layers_toggled = 0;
+    keyboard_layers_one_shot = 0;
+    keyboard_layers_active = 1;
+    keyboard_tap_hold_pending = false;
+    keyboard_num_deferred = 0;
+    keyboard_num_replay = 0;
+    keyboard_change_pending = false;
+    keyboard_sent_keys_valid = false;
+
+    keymap_init();
+    macro_init();
+    build_effective_map();
+
+    // the scan tick is already running, set up by setup_clock()
+    keyboard_scan_reload = systick_get_reload();
+    keyboard_scan_trimmed = false;
+    keyboard_sof_locked = false;
+    keyboard_sof_misses = 0;
+    usb_hid_set_sof_enabled(true);
 }
 
-static void set_led(enum keyboard_led led, bool state) {
-    uint32_t led_port;
-    uint16_t led_pin;
-    
-    switch (led) {
-        case KB_LED_NUMLK:
-            led_port = NUMLK_LED_PORT;
-            led_pin = NUMLK_LED_PIN;
+static void scan_row(uint16_t row, uint16_t raw_cols, uint32_t time_ms) {
+#if TRACE_EVENTS
+    if (raw_cols != keyboard_raw_cols[row]) {
+        keyboard_raw_cols[row] = raw_cols;
+        trace_record(TRACE_EVENT_MATRIX, row, raw_cols);
+    }
+#endif
+
+    uint16_t col_states = debounce_row(row, raw_cols, KEYBOARD_POLL_INTERVAL_MS);
+
+    // only visit the keys that changed since this row was last scanned (usually none)
+    uint16_t changed_cols = col_states ^ keyboard_key_pressed[row];
+
+    while (changed_cols) {
+        int col = __builtin_ctz(changed_cols);
+        changed_cols &= changed_cols - 1;
+
+        struct key_event event = {
+            .time_ms = time_ms,
+            .row = row,
+            .col = col,
+            .pressed = col_states & (1 << col),
+        };
+
+        // with the queue full, leave the key in its old state so the change is picked up again by the next scan
+        if (!event_queue_push(&event)) {
+            trace_record(TRACE_EVENT_OVERFLOW, TRACE_OVERFLOW_EVENT_QUEUE, (row << 8) | col);
+            return;
+        }
+        keyboard_key_pressed[row] ^= 1 << col;
+        trace_record(event.pressed ? TRACE_EVENT_KEY_DOWN : TRACE_EVENT_KEY_UP, row, col);
+    }
+}
+
+static void run_action(uint16_t action, bool pressed) {
+    uint8_t arg = KEYMAP_ACTION_ARG(action);
+    uint8_t layer_bit = (arg < KEYMAP_NUM_LAYERS) ? (1 << arg) : 0;
+    switch (KEYMAP_ACTION_TYPE(action)) {
+        case KEYMAP_ACTION_KEY:
+            if (pressed) {
+                add_key(arg);
+            } else {
+                remove_key(arg);
+            }
             break;
-        case KB_LED_CAPLK:
-            led_port = CAPLK_LED_PORT;
-            led_pin = CAPLK_LED_PIN;
+        case KEYMAP_ACTION_MODIFIER:
+            if (pressed) {
+                add_modifier(arg);
+            } else {
+                remove_modifier(arg);
+            }
             break;
-        case KB_LED_SCRLK:
-            led_port = SCRLK_LED_PORT;
-            led_pin = SCRLK_LED_PIN;
+        case KEYMAP_ACTION_LAYER_MOMENTARY:
+            if (pressed) {
+                keyboard_layers_momentary |= layer_bit;
+            } else {
+                keyboard_layers_momentary &= ~layer_bit;
+            }
             break;
-        default:
+        case KEYMAP_ACTION_LAYER_TOGGLE:
+            if (pressed) {
+                keyboard_layers_toggled ^= layer_bit;
+            }
+            break;
+        case KEYMAP_ACTION_MACRO:
+            if (pressed) {
+                macro_play(arg);
+            }
+            break;
+        case KEYMAP_ACTION_LAYER_ONE_SHOT:
+            if (pressed) {
+                keyboard_layers_one_shot |= layer_bit;
+            }
+            update_layers();
             return;
+        default:
+            break;
     }
 
-    if (state) {
-        gpio_set(led_port, led_pin);
+    // a one-shot layer lasts until the next key press that isn't a one-shot layer key itself
+    if (pressed) {
+        keyboard_layers_one_shot = 0;
+    }
+    update_layers();
+}
+
+static bool is_tap_hold(uint16_t action) {
+    return KEYMAP_ACTION_IS_MOD_TAP(action) || KEYMAP_ACTION_IS_LAYER_TAP(action);
+}
+
+static void process_event(const struct key_event *event) {
+    // a release undoes whatever the press did, the press takes the action of the active layers
+    uint16_t action;
+    if (event->pressed) {
+        action = keyboard_effective_map[event->row][event->col];
+        if (is_tap_hold(action)) {
+            // nothing to send until it is known what the key does
+            keyboard_tap_hold_pending = true;
+            keyboard_tap_hold_press = *event;
+            keyboard_tap_hold_action = action;
+            return;
+        }
+        keyboard_pressed_action[event->row][event->col] = action;
     } else {
-        gpio_clear(led_port, led_pin);
+        action = keyboard_pressed_action[event->row][event->col];
     }
+
+    run_action(action, event->pressed);
 }
 
-static void send_key_data(void) {
-    if (!keyboard_overflow) {
-        usb_hid_send_report(&keyboard_hid_report);
+// settle the pending dual-role key and let the held back events through
+static void tap_hold_decide(bool hold) {
+    uint16_t action = keyboard_tap_hold_action;
+    if (hold && KEYMAP_ACTION_IS_LAYER_TAP(action)) {
+        action = MO(KEYMAP_LAYER_TAP_LAYER(action));
+    } else if (hold) {
+        action = MOD(KEYMAP_MOD_TAP_MASK(action));
     } else {
-        // in case of an overflow, set all key slots to KEY_ERR_OVF
-        struct usb_hid_report ovf_report;
-        memcpy(&ovf_report, &keyboard_hid_report, sizeof(ovf_report));
-        memset(ovf_report.key_codes, KEY_ERR_OVF, sizeof(ovf_report.key_codes));
-        usb_hid_send_report(&ovf_report);
+        action = KEYMAP_ACTION(KEYMAP_ACTION_KEY, KEYMAP_ACTION_ARG(action));
+    }
+    keyboard_tap_hold_pending = false;
+    keyboard_pressed_action[keyboard_tap_hold_press.row][keyboard_tap_hold_press.col] = action;
+    run_action(action, true);
+
+    if (!hold) {
+        // the key has been released already, the tap goes out as a press and a release of its own
+        flush_key_data();
+        run_action(action, false);
     }
+
+    keyboard_num_replay += keyboard_num_deferred;
+    keyboard_num_deferred = 0;
 }
 
-static void get_status_leds(void) {
-    usb_hid_get_leds(&keyboard_hid_report);
+static bool tap_hold_timed_out(uint32_t time_ms) {
+    return keyboard_tap_hold_pending && (time_ms - keyboard_tap_hold_press.time_ms >= keyboard_tapping_term_ms);
 }
 
-static void load_macros() {
-    for (size_t i = 0; i < NUM_MACROS; i++) {
-        flash_store_read(MACRO_FLASH_STORE_ADDR + i, &keyboard_macros[i].key_code, 1);
+// true if the key of a release was pressed after the pending dual-role key
+static bool is_deferred_press(const struct key_event *event) {
+    for (uint8_t i = 0; i < keyboard_num_deferred; i++) {
+        const struct key_event *deferred = &keyboard_deferred_events[i];
+        if (deferred->pressed && (deferred->row == event->row) && (deferred->col == event->col)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FLASHFUNC static void handle_event(const struct key_event *event) {
+    if (!keyboard_tap_hold_pending) {
+        process_event(event);
+        return;
+    }
+
+    // the release of the dual-role key within its tapping term is a tap, and everything else that doesn't decide it
+    // right away is held back - there is always room, see next_event()
+    bool hold = tap_hold_timed_out(event->time_ms);
+    if (!hold && !event->pressed && (event->row == keyboard_tap_hold_press.row)
+        && (event->col == keyboard_tap_hold_press.col)) {
+        tap_hold_decide(false);
+        return;
+    }
+    if (!hold && event->pressed) {
+        hold = keyboard_tap_hold_mode & KEYBOARD_TAP_HOLD_INTERRUPT;
+    }
+    if (!hold && !event->pressed) {
+        hold = (keyboard_tap_hold_mode & KEYBOARD_TAP_HOLD_PERMISSIVE) && is_deferred_press(event);
+    }
+
+    // held back in front of the events still to be replayed, which came after it
+    struct key_event *slot = &keyboard_deferred_events[keyboard_num_deferred];
+    memmove(slot + 1, slot, keyboard_num_replay * sizeof(*slot));
+    *slot = *event;
+    keyboard_num_deferred++;
+
+    if (hold) {
+        tap_hold_decide(true);
     }
 }
 
-static void save_macros() {
-    uint8_t macro_data[NUM_MACROS] __attribute__((__packed__)) = {0};
-    for (size_t i = 0; i < NUM_MACROS; i++) {
-        macro_data[i] = keyboard_macros[i].key_code;
+// the next event to handle - the ones replayed after a dual-role key has been decided come before new ones
+static bool next_event(struct key_event *event) {
+    // with no room left to hold back another event, the dual-role key can only be held
+    if (keyboard_tap_hold_pending && !keyboard_num_replay
+        && (keyboard_num_deferred == KEYBOARD_TAP_HOLD_MAX_DEFERRED)) {
+        tap_hold_decide(true);
     }
-    flash_store_write(MACRO_FLASH_STORE_ADDR, macro_data, sizeof(macro_data));
+
+    if (keyboard_num_replay) {
+        // each one in a report of its own, the way they came in
+        flush_key_data();
+        struct key_event *slot = &keyboard_deferred_events[keyboard_num_deferred];
+        *event = *slot;
+        keyboard_num_replay--;
+        memmove(slot, slot + 1, keyboard_num_replay * sizeof(*slot));
+        return true;
+    }
+    return event_queue_pop(event);
 }
 
-static uint8_t get_macro_code(uint8_t row, uint8_t col) {
-    for (size_t i = 0; i < NUM_MACROS; i++) {
-        if (keyboard_macros[i].row == row && keyboard_macros[i].col == col) {
-            return keyboard_macros[i].key_code;
+RAMFUNC void keyboard_scan(void) {
+    uint32_t probe_start = latency_start();
+
+    // the period a start of frame trimmed has just begun, the ones after it are back to normal
+    if (keyboard_scan_trimmed) {
+        systick_set_reload(keyboard_scan_reload);
+        keyboard_scan_trimmed = false;
+    }
+
+    uint32_t time_ms = keyboard_time_ms + KEYBOARD_POLL_INTERVAL_MS;
+    keyboard_time_ms = time_ms;
+
+    uint16_t matrix[NUM_ROWS];
+    matrix_scan(matrix);
+
+    uint16_t any_down = 0;
+    for (uint16_t row = 0; row < NUM_ROWS; row++) {
+        scan_row(row, matrix[row], time_ms);
+        any_down |= matrix[row] | keyboard_key_pressed[row];
+    }
+
+    if (any_down) {
+        keyboard_idle_ms = 0;
+    } else if (keyboard_idle_ms < KEYBOARD_IDLE_TIMEOUT_MS) {
+        keyboard_idle_ms += KEYBOARD_POLL_INTERVAL_MS;
+    }
+
+    latency_end(LATENCY_PROBE_SCAN, probe_start);
+}
+
+void keyboard_sof(void) {
+    // a scan in between reading the counter and trimming the reload would take the trim a period late
+    uint32_t masked = cm_mask_interrupts(1);
+
+    // how much later than wanted the period after the coming one starts, either way round
+    int32_t period = keyboard_scan_reload + 1;
+    int32_t target = period - (int32_t)(KEYBOARD_SOF_LEAD_US * KEYBOARD_TICKS_PER_US);
+    int32_t error = (int32_t)systick_get_value() - target;
+    if (error > period / 2) {
+        error -= period;
+    } else if (error <= -period / 2) {
+        error += period;
+    }
+
+    int32_t slew = KEYBOARD_SOF_SLEW_US * KEYBOARD_TICKS_PER_US;
+    if (!keyboard_sof_locked) {
+        // first frame since scanning started, move the scan all the way in one go
+        keyboard_sof_locked = true;
+        keyboard_sof_misses = 0;
+    } else if ((error > slew) || (error < -slew)) {
+        // a late interrupt once in a while, or the frames really moved if it keeps happening
+        if (++keyboard_sof_misses >= KEYBOARD_SOF_UNLOCK_COUNT) {
+            keyboard_sof_locked = false;
         }
+        error = (error > 0) ? slew : -slew;
+    } else {
+        keyboard_sof_misses = 0;
     }
-    return KEY_NONE;
+
+    // loaded into the counter when the coming period ends, the scan puts the reload back after that
+    systick_set_reload(keyboard_scan_reload - error);
+    keyboard_scan_trimmed = (error != 0);
+
+    cm_mask_interrupts(masked);
 }
 
-void keyboard_init(void) {
-    rcc_periph_clock_enable(RCC_GPIOA);
-    rcc_periph_clock_enable(RCC_GPIOB);
-
-    // Set rows as outputs
-    uint16_t row_pins = ~(uint16_t)((uint16_t)0xFFFF << NUM_ROWS) << ROW_START_PIN;
-    gpio_mode_setup(ROW_GPIO_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, row_pins);
-    gpio_set_output_options(ROW_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, row_pins);
-
-    // Set columns as inputs
-    uint16_t col_pins = ~(uint16_t)((uint16_t)0xFFFF << NUM_COLS) << COL_START_PIN;
-    gpio_mode_setup(COL_GPIO_PORT, GPIO_MODE_INPUT, GPIO_PUPD_NONE, col_pins);
-
-    // Set LEDs as outputs
-    gpio_mode_setup(NUMLK_LED_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, NUMLK_LED_PIN);
-    gpio_set_output_options(NUMLK_LED_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, NUMLK_LED_PIN);
-    gpio_mode_setup(CAPLK_LED_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, CAPLK_LED_PIN);
-    gpio_set_output_options(CAPLK_LED_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, CAPLK_LED_PIN);
-    gpio_mode_setup(SCRLK_LED_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SCRLK_LED_PIN);
-    gpio_set_output_options(SCRLK_LED_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, SCRLK_LED_PIN);
+bool keyboard_can_sleep(void) {
+    return (keyboard_idle_ms >= KEYBOARD_IDLE_TIMEOUT_MS) && !macro_playing();
+}
 
-    // ensure keyboard data is zeroed out
-    memset(&keyboard_hid_report, 0, sizeof(keyboard_hid_report));
+bool keyboard_can_commit(void) {
+    return (keyboard_idle_ms >= KEYBOARD_COMMIT_IDLE_MS) && !macro_playing();
+}
 
-    // select first row
-    gpio_set(ROW_GPIO_PORT, (1 << ++keyboard_poll_row) << ROW_START_PIN);
+void keyboard_keymap_changed(void) {
+    build_effective_map();
+}
 
-    // load macros from flash
-    load_macros();
+uint8_t keyboard_get_layers(void) {
+    return keyboard_layers_active;
 }
 
-void keyboard_poll(void) {
-    uint16_t col_states = gpio_port_read(COL_GPIO_PORT) >> COL_START_PIN;
+uint32_t keyboard_get_time_ms(void) {
+    return keyboard_time_ms;
+}
 
-    for (int col = 0; col < NUM_COLS; col++) {
-        // get key code and modifier mask for this key
-        uint8_t key_code = keyboard_key_map[keyboard_poll_row][col];
-        uint8_t modifier_mask = keyboard_modifier_map[keyboard_poll_row][col];
+void keyboard_set_debounce(enum debounce_mode mode, uint8_t debounce_ms) {
+    // the scan runs the debounce from the SysTick interrupt
+    systick_interrupt_disable();
+    debounce_set(mode, debounce_ms);
+    systick_interrupt_enable();
+}
 
-        uint8_t macro_code = get_macro_code(keyboard_poll_row, col);
-        if (macro_code != KEY_NONE) {
-            key_code = macro_code;
-        }
+bool keyboard_sleep(void) {
+    systick_interrupt_disable();
+    systick_counter_disable();
+    usb_hid_set_sof_enabled(false);
 
-        // add and remove key codes and modifier masks when keys are pressed and released
-        if ((col_states & (1 << col)) && !keyboard_key_pressed[keyboard_poll_row][col]) {
-            // key pressed
-            keyboard_key_pressed[keyboard_poll_row][col] = 1;
-            add_modifier(modifier_mask);
-            add_key(key_code);
-        } else if ((col_states & (1 << col)) == 0 && keyboard_key_pressed[keyboard_poll_row][col]) {
-            // key released
-            keyboard_key_pressed[keyboard_poll_row][col] = 0;
-            remove_modifier(modifier_mask);
-            remove_key(key_code);
+    if (!matrix_sleep()) {
+        keyboard_wake();
+        return false;
+    }
+    return true;
+}
+
+void keyboard_wake(void) {
+    matrix_wake();
+
+    // scan right away instead of a tick later, the key that woke the keyboard up is down now
+    keyboard_scan();
+
+    // the counter stood still while the frames went on, lock on to them again
+    keyboard_sof_locked = false;
+    systick_counter_enable();
+    systick_interrupt_enable();
+    usb_hid_set_sof_enabled(true);
+}
+
+void keyboard_set_tap_hold(enum keyboard_tap_hold_mode mode, uint16_t tapping_term_ms) {
+    keyboard_tap_hold_mode = mode;
+    keyboard_tapping_term_ms = tapping_term_ms;
+}
+
+bool keyboard_has_work(void) {
+    return !event_queue_empty() || usb_hid_leds_pending() || (usb_hid_get_protocol() != keyboard_hid_protocol)
+        || tap_hold_timed_out(keyboard_time_ms)
+        || (macro_ready(keyboard_time_ms) && !usb_hid_reports_queued());
+}
+
+RAMFUNC void keyboard_poll(void) {
+    uint32_t probe_start = latency_start();
+
+    // every event of a scan up to now is in the queue, so the tapping term can be checked against it once they are
+    // all handled - then there is nothing left that could make the dual-role key a tap
+    uint32_t time_ms = keyboard_time_ms;
+    struct key_event event;
+    for (;;) {
+        while (next_event(&event)) {
+            keyboard_event_ms = event.time_ms;
+            handle_event(&event);
         }
+        if (!tap_hold_timed_out(time_ms)) {
+            break;
+        }
+        keyboard_event_ms = time_ms;
+        tap_hold_decide(true);
+    }
+
+    // a macro plays one step per report, as fast as the host takes them
+    if (!usb_hid_reports_queued() && macro_step(keyboard_time_ms)) {
+        keyboard_data_updated = true;
     }
 
-    get_status_leds();
+    get_host_state();
+    usb_hid_update(keyboard_time_ms);
 
     if (keyboard_data_updated) {
         send_key_data();
         keyboard_data_updated = false;
     }
 
-    // deselect this row
-    gpio_clear(ROW_GPIO_PORT, (1 << keyboard_poll_row) << ROW_START_PIN);
-
-    // select the next row
-    if (++keyboard_poll_row == NUM_ROWS) {
-        keyboard_poll_row = 0;
-    }
-    gpio_set(ROW_GPIO_PORT, (1 << keyboard_poll_row) << ROW_START_PIN);
-
-    // During LED self test, keep all LEDs on. Otherwise, set based on HID report
-    if (!keyboard_led_self_test_done && (keyboard_led_self_test_counter++ < LED_SELF_TEST_CYCLES)) {
-        set_led(KB_LED_NUMLK, true);
-        set_led(KB_LED_CAPLK, true);
-        set_led(KB_LED_SCRLK, true);
-    } else {
-        set_led(KB_LED_NUMLK, keyboard_hid_report.leds & HID_LED_NUMLK);
-        set_led(KB_LED_CAPLK, keyboard_hid_report.leds & HID_LED_CAPLK);
-        set_led(KB_LED_SCRLK, keyboard_hid_report.leds & HID_LED_SCRLK);
-    }
+    latency_end(LATENCY_PROBE_POLL, probe_start);
 }
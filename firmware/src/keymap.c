@@ -0,0 +1,119 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "keymap.h"
+#include "flash_store.h"
+
+#include <string.h>
+
+// keymap_default_layers, compiled from the layout by tools/keymapc.c
+#include "keymap_layers.h"
+
+uint16_t keymap_layers[KEYMAP_NUM_LAYERS][NUM_ROWS][NUM_COLS];
+
+_Static_assert(KEYMAP_STORE_LAYERS_ADDR + sizeof(keymap_layers) <= FLASH_STORE_SIZE,
+    "the layers do not fit into the flash store");
+
+// rows of all layers, copied into the flash store one at a time
+#define KEYMAP_STORE_ROWS (KEYMAP_NUM_LAYERS * NUM_ROWS)
+#define KEYMAP_COPY_IDLE 0xff
+
+_Static_assert(KEYMAP_STORE_ROWS < KEYMAP_COPY_IDLE, "too many rows to copy");
+
+// next row to copy before the marker goes in, KEYMAP_COPY_IDLE if no copy is in progress
+static uint8_t keymap_copy_row = KEYMAP_COPY_IDLE;
+
+// flash store address of an entry
+static uint16_t entry_addr(uint8_t layer, uint8_t row, uint8_t col) {
+    return KEYMAP_STORE_LAYERS_ADDR + ((((layer * NUM_ROWS) + row) * NUM_COLS) + col) * sizeof(uint16_t);
+}
+
+static bool keymap_stored(void) {
+    uint16_t magic;
+    flash_store_read(KEYMAP_FLASH_STORE_ADDR, &magic, sizeof(magic));
+    return magic == KEYMAP_STORE_MAGIC;
+}
+
+void keymap_init(void) {
+    keymap_copy_row = KEYMAP_COPY_IDLE;
+    if (keymap_stored()) {
+        flash_store_read(KEYMAP_STORE_LAYERS_ADDR, keymap_layers, sizeof(keymap_layers));
+    } else {
+        memcpy(keymap_layers, keymap_default_layers, sizeof(keymap_layers));
+    }
+}
+
+bool keymap_set(uint8_t layer, uint8_t row, uint8_t col, uint16_t action) {
+    if ((layer >= KEYMAP_NUM_LAYERS) || (row >= NUM_ROWS) || (col >= NUM_COLS)) {
+        return false;
+    }
+
+    // the first change starts copying all layers, which picks the entry up from RAM along with its row
+    if ((keymap_copy_row == KEYMAP_COPY_IDLE) && !keymap_stored()) {
+        keymap_layers[layer][row][col] = action;
+        keymap_copy_row = 0;
+        keymap_step();
+        return true;
+    }
+    if ((keymap_copy_row != KEYMAP_COPY_IDLE) && ((layer * NUM_ROWS) + row >= keymap_copy_row)) {
+        keymap_layers[layer][row][col] = action;
+        return true;
+    }
+
+    // later ones only store the entry - and only change it in RAM once it is stored, so both stay the same
+    if (!flash_store_write(entry_addr(layer, row, col), &action, sizeof(action))) {
+        return false;
+    }
+    keymap_layers[layer][row][col] = action;
+    return true;
+}
+
+void keymap_step(void) {
+    if (keymap_copy_row == KEYMAP_COPY_IDLE) {
+        return;
+    }
+
+    // only as much as waits for the next commit - a write that does not fit would commit right away, on the main loop
+    while ((keymap_copy_row < KEYMAP_STORE_ROWS) && flash_store_has_room(sizeof(keymap_layers[0][0]))) {
+        uint8_t layer = keymap_copy_row / NUM_ROWS;
+        uint8_t row = keymap_copy_row % NUM_ROWS;
+        flash_store_write(entry_addr(layer, row, 0), keymap_layers[layer][row], sizeof(keymap_layers[layer][row]));
+        keymap_copy_row++;
+    }
+
+    // the marker goes in behind the last row, so the layers only count once all of them are committed
+    uint16_t magic = KEYMAP_STORE_MAGIC;
+    if ((keymap_copy_row == KEYMAP_STORE_ROWS) && flash_store_has_room(sizeof(magic))) {
+        flash_store_write(KEYMAP_FLASH_STORE_ADDR, &magic, sizeof(magic));
+        keymap_copy_row = KEYMAP_COPY_IDLE;
+    }
+}
+
+void keymap_reset(void) {
+    memcpy(keymap_layers, keymap_default_layers, sizeof(keymap_layers));
+    keymap_copy_row = KEYMAP_COPY_IDLE;
+
+    // the stored layers are ignored without the marker
+    uint16_t magic = 0;
+    flash_store_write(KEYMAP_FLASH_STORE_ADDR, &magic, sizeof(magic));
+}
@@ -0,0 +1,109 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "latency.h"
+#include "keyboard.h"
+
+#include <string.h>
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/rcc.h>
+
+// SysTick runs off the AHB clock divided by 8
+#define LATENCY_TICKS_PER_US (rcc_ahb_frequency / 8000000)
+
+static struct latency_stats latency_stats[LATENCY_NUM_PROBES];
+
+// the M0 has no divider, so ticks become us with a multiply and a shift
+static uint32_t ticks_to_us(uint32_t ticks) {
+    static uint32_t scale = 0;
+    if (!scale) {
+        scale = 65536 / LATENCY_TICKS_PER_US;
+    }
+    return (ticks * scale) >> 16;
+}
+
+#if LATENCY_PROBES
+uint32_t latency_start(void) {
+    return systick_get_value();
+}
+
+void latency_end(enum latency_probe probe, uint32_t start) {
+    // the counter counts down and wraps around to the reload value
+    uint32_t now = systick_get_value();
+    uint32_t ticks = (start >= now) ? (start - now) : (start + systick_get_reload() + 1 - now);
+    latency_record(probe, ticks_to_us(ticks));
+}
+
+void latency_record(enum latency_probe probe, uint32_t span_us) {
+    struct latency_stats *stats = &latency_stats[probe];
+    uint16_t us = (span_us > 0xffff) ? 0xffff : span_us;
+
+    stats->count++;
+    stats->total_us += us;
+    if ((stats->count == 1) || (us < stats->min_us)) {
+        stats->min_us = us;
+    }
+    if (us > stats->max_us) {
+        stats->max_us = us;
+    }
+
+    uint8_t bucket = (us < 2) ? 0 : (31 - __builtin_clz(us));
+    if (bucket >= LATENCY_NUM_BUCKETS) {
+        bucket = LATENCY_NUM_BUCKETS - 1;
+    }
+    if (stats->histogram[bucket] != 0xffff) {
+        stats->histogram[bucket]++;
+    }
+}
+#endif
+
+uint32_t latency_now_us(void) {
+    // a scan in between the two reads means the counter may have wrapped after the time was read - try again. That
+    // can't happen in an interrupt that holds off the SysTick one, where the result may be a scan period short.
+    uint32_t time_ms;
+    uint32_t value;
+    do {
+        time_ms = keyboard_get_time_ms();
+        value = systick_get_value();
+    } while (time_ms != keyboard_get_time_ms());
+
+    // the reload may already be trimmed for the next period (see keyboard_sof()), below where this one started
+    uint32_t reload = systick_get_reload();
+    value = (value > reload) ? reload : value;
+
+    return (time_ms * 1000) + ticks_to_us(reload - value);
+}
+
+void latency_reset(void) {
+    cm_disable_interrupts();
+    memset(latency_stats, 0, sizeof(latency_stats));
+    cm_enable_interrupts();
+}
+
+void latency_get(enum latency_probe probe, struct latency_stats *stats) {
+    cm_disable_interrupts();
+    *stats = latency_stats[probe];
+    cm_enable_interrupts();
+}
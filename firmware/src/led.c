@@ -0,0 +1,154 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "led.h"
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#define LED_PORT GPIOA
+#define NUMLK_LED_PIN GPIO7
+#define CAPLK_LED_PIN GPIO8
+#define SCRLK_LED_PIN GPIO9
+
+// PA8 and PA9 are TIM1 CH1 and CH2. PA7 could be TIM1 CH1N, but that shares its compare value with CH1 - it gets
+// TIM14 CH1 instead, set up the same way.
+#define LED_TIMER TIM1
+#define NUMLK_LED_TIMER TIM14
+#define LED_AF GPIO_AF2
+#define NUMLK_LED_AF GPIO_AF4
+
+// duty cycle steps - a compare value of LED_PWM_STEPS is past the end of the period and keeps the LED on throughout
+#define LED_PWM_STEPS 255
+#define LED_PWM_HZ 2000
+
+// effects step once every LED_EFFECT_PERIODS PWM periods, counted by TIM1's repetition counter
+#define LED_EFFECT_TICK_MS 10
+#define LED_EFFECT_PERIODS (LED_PWM_HZ * LED_EFFECT_TICK_MS / 1000)
+
+// below the scan and USB, an effect step is never urgent
+#define LED_IRQ_PRIORITY 0x80
+
+#if LED_EFFECT_PERIODS > 256
+#error "LED_EFFECT_TICK_MS is too long for the repetition counter"
+#endif
+
+// state sent by the host, shown whenever no effect runs
+static volatile uint8_t led_state = 0;
+
+// compare value of a lit LED
+static uint8_t led_level = 0;
+
+// time left of the running effect, 0 if there is none (the self test is the only one so far)
+static volatile uint16_t led_effect_ms = 0;
+
+static void led_show(uint8_t leds) {
+    timer_set_oc_value(NUMLK_LED_TIMER, TIM_OC1, (leds & LED_NUM_LOCK) ? led_level : 0);
+    timer_set_oc_value(LED_TIMER, TIM_OC1, (leds & LED_CAPS_LOCK) ? led_level : 0);
+    timer_set_oc_value(LED_TIMER, TIM_OC2, (leds & LED_SCROLL_LOCK) ? led_level : 0);
+}
+
+static void setup_timer(uint32_t timer) {
+    timer_set_mode(timer, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(timer, (rcc_apb1_frequency / (LED_PWM_HZ * LED_PWM_STEPS)) - 1);
+    timer_set_period(timer, LED_PWM_STEPS - 1);
+}
+
+// without preload, a new compare value takes effect right away - one odd PWM period doesn't show
+static void setup_channel(uint32_t timer, enum tim_oc_id oc_id) {
+    timer_set_oc_mode(timer, oc_id, TIM_OCM_PWM1);
+    timer_set_oc_polarity_high(timer, oc_id);
+    timer_set_oc_value(timer, oc_id, 0);
+    timer_enable_oc_output(timer, oc_id);
+}
+
+void led_init(void) {
+    rcc_periph_clock_enable(RCC_GPIOA);
+    rcc_periph_clock_enable(RCC_TIM1);
+    rcc_periph_clock_enable(RCC_TIM14);
+
+    setup_timer(LED_TIMER);
+    setup_channel(LED_TIMER, TIM_OC1);
+    setup_channel(LED_TIMER, TIM_OC2);
+    timer_set_repetition_counter(LED_TIMER, LED_EFFECT_PERIODS - 1);
+    timer_enable_break_main_output(LED_TIMER);
+
+    setup_timer(NUMLK_LED_TIMER);
+    setup_channel(NUMLK_LED_TIMER, TIM_OC1);
+
+    led_state = 0;
+    led_effect_ms = LED_SELF_TEST_PERIOD_MS;
+    led_set_brightness(LED_DEFAULT_BRIGHTNESS);
+
+    // load the prescalers and the repetition counter, the update that does it is not an effect step
+    timer_generate_event(LED_TIMER, TIM_EGR_UG);
+    timer_generate_event(NUMLK_LED_TIMER, TIM_EGR_UG);
+    timer_clear_flag(LED_TIMER, TIM_SR_UIF);
+    timer_enable_irq(LED_TIMER, TIM_DIER_UIE);
+    nvic_set_priority(NVIC_TIM1_BRK_UP_TRG_COM_IRQ, LED_IRQ_PRIORITY);
+    nvic_enable_irq(NVIC_TIM1_BRK_UP_TRG_COM_IRQ);
+
+    timer_enable_counter(LED_TIMER);
+    timer_enable_counter(NUMLK_LED_TIMER);
+
+    // hand the pins over to the timers once they drive them
+    gpio_mode_setup(LED_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, NUMLK_LED_PIN | CAPLK_LED_PIN | SCRLK_LED_PIN);
+    gpio_set_output_options(LED_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, NUMLK_LED_PIN | CAPLK_LED_PIN | SCRLK_LED_PIN);
+    gpio_set_af(LED_PORT, LED_AF, CAPLK_LED_PIN | SCRLK_LED_PIN);
+    gpio_set_af(LED_PORT, NUMLK_LED_AF, NUMLK_LED_PIN);
+}
+
+void led_set(uint8_t leds) {
+    // the effect interrupt shows the state once the effect is over
+    uint32_t masked = cm_mask_interrupts(1);
+    led_state = leds;
+    if (!led_effect_ms) {
+        led_show(leds);
+    }
+    cm_mask_interrupts(masked);
+}
+
+void led_set_brightness(uint8_t brightness) {
+    // perceived brightness goes with the square of the duty cycle, roughly - 255 still comes out as LED_PWM_STEPS
+    uint32_t masked = cm_mask_interrupts(1);
+    led_level = (((uint16_t)brightness * brightness) + LED_PWM_STEPS) >> 8;
+    led_show(led_effect_ms ? LED_ALL : led_state);
+    cm_mask_interrupts(masked);
+}
+
+void tim1_brk_up_trg_com_isr(void) {
+    timer_clear_flag(LED_TIMER, TIM_SR_UIF);
+
+    if (led_effect_ms > LED_EFFECT_TICK_MS) {
+        led_effect_ms -= LED_EFFECT_TICK_MS;
+        return;
+    }
+
+    // the effect is over, back to the host's state - and no more interrupts until the next one
+    led_effect_ms = 0;
+    timer_disable_irq(LED_TIMER, TIM_DIER_UIE);
+    led_show(led_state);
+}
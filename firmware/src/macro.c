@@ -0,0 +1,257 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "macro.h"
+#include "flash_store.h"
+#include "hid_codes.h"
+
+#include <string.h>
+
+#define MACRO_NOT_PLAYING 0xffff
+
+#if MACRO_FLASH_STORE_ADDR + MACRO_STORE_SIZE > FLASH_STORE_SIZE
+#error "MACRO_STORE_SIZE does not fit into the flash store"
+#endif
+
+// a tap of each of A, S, D and F, used until other macros are stored
+static const uint8_t macro_defaults[] = {
+    KEY_A, MACRO_END,
+    KEY_S, MACRO_END,
+    KEY_D, MACRO_END,
+    KEY_F, MACRO_END,
+};
+
+static uint8_t macro_data[MACRO_STORE_SIZE];
+
+// playback state - position of the next step, or MACRO_NOT_PLAYING
+static uint16_t macro_pos = MACRO_NOT_PLAYING;
+
+// end of the running delay step, only compared while macro_delaying is set - a delay is short, so the difference to
+// the time stays well within int32_t however long the keyboard has been running
+static bool macro_delaying = false;
+static uint32_t macro_resume_ms = 0;
+
+// key of a tap waiting for its release, and the modifiers held for it
+static uint8_t macro_tap_key = KEY_NONE;
+static uint8_t macro_tap_modifiers = 0;
+
+static struct usb_hid_nkro_report macro_keys;
+
+static void set_key(uint8_t usage, bool pressed) {
+    if (usage >= KEY_LEFTCTRL) {
+        uint8_t mask = 1 << (usage - KEY_LEFTCTRL);
+        macro_keys.modifiers = pressed ? (macro_keys.modifiers | mask) : (macro_keys.modifiers & ~mask);
+    } else if (usage != KEY_NONE) {
+        uint8_t bit = 1 << (usage % 8);
+        macro_keys.key_bits[usage / 8] = pressed ? (macro_keys.key_bits[usage / 8] | bit)
+            : (macro_keys.key_bits[usage / 8] & ~bit);
+    }
+}
+
+static bool keys_held(void) {
+    uint8_t held = macro_keys.modifiers;
+    for (size_t i = 0; i < sizeof(macro_keys.key_bits); i++) {
+        held |= macro_keys.key_bits[i];
+    }
+    return held != 0;
+}
+
+// true if the data is a sequence of NUM_MACROS macros that all end within it, with every step argument inside it and
+// every key a key code set_key() can hold
+static bool macros_valid(const uint8_t *data, uint16_t size) {
+    uint8_t num_macros = 0;
+    for (uint16_t pos = 0; (pos < size) && (num_macros < NUM_MACROS); pos++) {
+        switch (data[pos]) {
+            case MACRO_END:
+                num_macros++;
+                break;
+            case MACRO_PRESS:
+            case MACRO_RELEASE:
+            case MACRO_SHIFT:
+                if ((pos + 1 >= size) || (data[pos + 1] > KEY_RIGHTMETA)) {
+                    return false;
+                }
+                pos++;
+                break;
+            case MACRO_DELAY:
+                if (pos + 1 >= size) {
+                    return false;
+                }
+                pos++;
+                break;
+            default:
+                if (data[pos] > KEY_RIGHTMETA) {
+                    return false;
+                }
+                break;
+        }
+    }
+    return num_macros == NUM_MACROS;
+}
+
+static void stop(void) {
+    macro_pos = MACRO_NOT_PLAYING;
+    macro_delaying = false;
+    macro_tap_key = KEY_NONE;
+    macro_tap_modifiers = 0;
+    memset(&macro_keys, 0, sizeof(macro_keys));
+}
+
+void macro_init(void) {
+    stop();
+    if (!macro_load()) {
+        memset(macro_data, MACRO_END, sizeof(macro_data));
+        memcpy(macro_data, macro_defaults, sizeof(macro_defaults));
+    }
+}
+
+bool macro_load(void) {
+    uint8_t data[MACRO_STORE_SIZE];
+    flash_store_read(MACRO_FLASH_STORE_ADDR, data, sizeof(data));
+    if (!macros_valid(data, sizeof(data))) {
+        return false;
+    }
+
+    stop();
+    memcpy(macro_data, data, sizeof(macro_data));
+    return true;
+}
+
+bool macro_write(uint16_t offset, const uint8_t *data, uint16_t size) {
+    if (offset + size > MACRO_STORE_SIZE) {
+        return false;
+    }
+    return flash_store_write(MACRO_FLASH_STORE_ADDR + offset, data, size);
+}
+
+const uint8_t *macro_get_data(void) {
+    return macro_data;
+}
+
+void macro_play(uint8_t index) {
+    if (index >= NUM_MACROS) {
+        return;
+    }
+
+    // skip to the start of the macro
+    uint16_t pos = 0;
+    for (uint8_t skipped = 0; skipped < index; pos++) {
+        switch (macro_data[pos]) {
+            case MACRO_END:
+                skipped++;
+                break;
+            case MACRO_PRESS:
+            case MACRO_RELEASE:
+            case MACRO_SHIFT:
+            case MACRO_DELAY:
+                pos++;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // keys of a macro cut short are released along with the first step of the new one
+    memset(&macro_keys, 0, sizeof(macro_keys));
+    macro_tap_key = KEY_NONE;
+    macro_tap_modifiers = 0;
+    macro_pos = pos;
+    macro_delaying = false;
+}
+
+bool macro_playing(void) {
+    return macro_pos != MACRO_NOT_PLAYING;
+}
+
+bool macro_ready(uint32_t time_ms) {
+    return (macro_pos != MACRO_NOT_PLAYING) && (!macro_delaying || ((int32_t)(time_ms - macro_resume_ms) >= 0));
+}
+
+bool macro_step(uint32_t time_ms) {
+    if (!macro_ready(time_ms)) {
+        return false;
+    }
+    macro_delaying = false;
+
+    // second half of the last tap
+    bool changed = false;
+    uint8_t released_key = macro_tap_key;
+    uint8_t released_modifiers = macro_tap_modifiers;
+    if (macro_tap_key != KEY_NONE) {
+        set_key(macro_tap_key, false);
+        macro_keys.modifiers &= ~macro_tap_modifiers;
+        macro_tap_key = KEY_NONE;
+        macro_tap_modifiers = 0;
+        changed = true;
+    }
+
+    // macros_valid() made sure every step has its argument
+    uint8_t step = macro_data[macro_pos];
+    switch (step) {
+        case MACRO_END:
+            // anything still held by the macro goes up with the last report
+            changed |= keys_held();
+            memset(&macro_keys, 0, sizeof(macro_keys));
+            macro_pos = MACRO_NOT_PLAYING;
+            return changed;
+
+        case MACRO_DELAY:
+            if (changed) {
+                return true;
+            }
+            macro_resume_ms = time_ms + macro_data[macro_pos + 1];
+            macro_delaying = true;
+            macro_pos += 2;
+            return false;
+
+        case MACRO_PRESS:
+        case MACRO_RELEASE:
+            if (changed) {
+                return true;
+            }
+            set_key(macro_data[macro_pos + 1], step == MACRO_PRESS);
+            macro_pos += 2;
+            return true;
+
+        default: {
+            bool shifted = (step == MACRO_SHIFT);
+            uint8_t key_code = shifted ? macro_data[macro_pos + 1] : step;
+            uint8_t modifiers = shifted ? KEY_MOD_LSHIFT : 0;
+
+            // the host must see a key go up before it goes down again, and Shift must not change under a key
+            if (changed && ((key_code == released_key) || (modifiers != released_modifiers))) {
+                return true;
+            }
+            set_key(key_code, true);
+            macro_keys.modifiers |= modifiers;
+            macro_tap_key = key_code;
+            macro_tap_modifiers = modifiers;
+            macro_pos += shifted ? 2 : 1;
+            return true;
+        }
+    }
+}
+
+const struct usb_hid_nkro_report *macro_get_keys(void) {
+    return &macro_keys;
+}
@@ -22,15 +22,28 @@
  * SOFTWARE.
  */
 
+#include "config.h"
+#include "flash_store.h"
 #include "keyboard.h"
+#include "keymap.h"
+#include "ramfunc.h"
 #include "usb_hid.h"
 
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
 
+// sleep until an interrupt is pending (the simulator replaces it, see sim/sim.mk)
+#ifndef WAIT_FOR_INTERRUPT
+#define WAIT_FOR_INTERRUPT() __asm__ volatile ("wfi")
+#endif
+
+// the scan preempts everything else, so it runs at a steady rate
+#define SYSTICK_IRQ_PRIORITY 0x00
+
 static void setup_clock(void) {
     rcc_osc_on(RCC_HSE);
     rcc_wait_for_osc_ready(RCC_HSE);
@@ -56,20 +69,44 @@ static void setup_clock(void) {
 
     systick_set_clocksource(STK_CSR_CLKSOURCE_EXT);
     systick_set_frequency(1000 / KEYBOARD_POLL_INTERVAL_MS, rcc_ahb_frequency);
+    nvic_set_priority(NVIC_SYSTICK_IRQ, SYSTICK_IRQ_PRIORITY);
     systick_counter_enable();
     systick_interrupt_enable();
 }
 
-void sys_tick_handler(void) {
-    keyboard_poll();
+RAMFUNC void sys_tick_handler(void) {
+    keyboard_scan();
 }
 
 int main(void) {
     setup_clock();
+    flash_store_init();
     usb_hid_init();
     keyboard_init();
+    config_init();
 
+    // USB and the scan run from their interrupts, the main loop only turns key events into reports
     while(1) {
-        usb_hid_poll();
+        keyboard_poll();
+        config_poll();
+        keymap_step();
+
+        // commit config changes to flash a step at a time once nobody is typing, polling in between
+        if (keyboard_can_commit() && flash_store_step()) {
+            continue;
+        }
+
+        // check for new work with interrupts masked - an interrupt that queued work since the poll above
+        // ends the sleep right away instead of waiting for the next one
+        cm_disable_interrupts();
+        if (!keyboard_has_work() && !usb_hid_config_request_pending()) {
+            // an idle keyboard also stops scanning until a key is pressed
+            bool sleeping = keyboard_can_sleep() && keyboard_sleep();
+            WAIT_FOR_INTERRUPT();
+            if (sleeping) {
+                keyboard_wake();
+            }
+        }
+        cm_enable_interrupts();
     }
 }
@@ -0,0 +1,249 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "matrix.h"
+#include "ramfunc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+
+#if MATRIX_SCAN_DMA
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/timer.h>
+#endif
+
+#define ROW_GPIO_PORT GPIOA
+#define COL_GPIO_PORT GPIOB
+
+#define ROW_START_PIN 0
+#define COL_START_PIN 0
+
+#define ROW_PINS (uint16_t)(((1 << NUM_ROWS) - 1) << ROW_START_PIN)
+#define COL_PINS (uint16_t)(((1 << NUM_COLS) - 1) << COL_START_PIN)
+
+// EXTI line n belongs to pin n
+#define COL_EXTI_LINES COL_PINS
+
+// delay between driving a row and sampling the columns, each iteration is a handful of cycles (~1us in total)
+#define ROW_SETTLE_ITERATIONS 8
+
+#if MATRIX_SCAN_DMA
+// TIM3 update events write the next row pattern to the row port, CC1 events sample the column port afterwards
+#define SCAN_TIMER TIM3
+
+#define ROW_DMA_CHANNEL DMA_CHANNEL3  // TIM3_UP
+#define COL_DMA_CHANNEL DMA_CHANNEL4  // TIM3_CH1
+
+// BSRR values driving one row and releasing all others
+static uint32_t matrix_row_patterns[NUM_ROWS];
+
+// column samples, the DMA fills one frame while the other holds the last complete one
+static volatile uint16_t matrix_frames[2][NUM_ROWS];
+#endif
+
+static const uint8_t matrix_exti_irqs[] = {NVIC_EXTI0_1_IRQ, NVIC_EXTI2_3_IRQ, NVIC_EXTI4_15_IRQ};
+
+static void row_settle_delay(void) {
+    for (uint8_t i = 0; i < ROW_SETTLE_ITERATIONS; i++) {
+        __asm__ volatile ("nop");
+    }
+}
+
+static void scan_rows(uint16_t matrix[NUM_ROWS]) {
+    // drive each row in turn and sample the columns
+    for (uint16_t row = 0; row < NUM_ROWS; row++) {
+        gpio_set(ROW_GPIO_PORT, (1 << row) << ROW_START_PIN);
+        row_settle_delay();
+        matrix[row] = gpio_port_read(COL_GPIO_PORT) >> COL_START_PIN;
+        gpio_clear(ROW_GPIO_PORT, (1 << row) << ROW_START_PIN);
+    }
+}
+
+#if MATRIX_SCAN_DMA
+static void setup_scan_dma(void) {
+    for (uint16_t row = 0; row < NUM_ROWS; row++) {
+        uint16_t row_pin = (1 << row) << ROW_START_PIN;
+        matrix_row_patterns[row] = row_pin | ((uint32_t)(ROW_PINS & ~row_pin) << 16);
+    }
+
+    rcc_periph_clock_enable(RCC_DMA);
+    rcc_periph_clock_enable(RCC_TIM3);
+
+    // memory to GPIO: one row pattern per timer update
+    dma_channel_reset(DMA1, ROW_DMA_CHANNEL);
+    dma_set_priority(DMA1, ROW_DMA_CHANNEL, DMA_CCR_PL_VERY_HIGH);
+    dma_set_read_from_memory(DMA1, ROW_DMA_CHANNEL);
+    dma_set_peripheral_address(DMA1, ROW_DMA_CHANNEL, (uint32_t)&GPIO_BSRR(ROW_GPIO_PORT));
+    dma_set_peripheral_size(DMA1, ROW_DMA_CHANNEL, DMA_CCR_PSIZE_32BIT);
+    dma_set_memory_address(DMA1, ROW_DMA_CHANNEL, (uint32_t)matrix_row_patterns);
+    dma_set_memory_size(DMA1, ROW_DMA_CHANNEL, DMA_CCR_MSIZE_32BIT);
+    dma_enable_memory_increment_mode(DMA1, ROW_DMA_CHANNEL);
+    dma_enable_circular_mode(DMA1, ROW_DMA_CHANNEL);
+
+    // GPIO to memory: one column sample per timer compare, two frames deep
+    dma_channel_reset(DMA1, COL_DMA_CHANNEL);
+    dma_set_priority(DMA1, COL_DMA_CHANNEL, DMA_CCR_PL_VERY_HIGH);
+    dma_set_read_from_peripheral(DMA1, COL_DMA_CHANNEL);
+    dma_set_peripheral_address(DMA1, COL_DMA_CHANNEL, (uint32_t)&GPIO_IDR(COL_GPIO_PORT));
+    dma_set_peripheral_size(DMA1, COL_DMA_CHANNEL, DMA_CCR_PSIZE_16BIT);
+    dma_set_memory_address(DMA1, COL_DMA_CHANNEL, (uint32_t)matrix_frames);
+    dma_set_memory_size(DMA1, COL_DMA_CHANNEL, DMA_CCR_MSIZE_16BIT);
+    dma_enable_memory_increment_mode(DMA1, COL_DMA_CHANNEL);
+    dma_enable_circular_mode(DMA1, COL_DMA_CHANNEL);
+
+    // one timer period per row, the columns are sampled half way through to let the row settle
+    uint32_t period = rcc_apb1_frequency / (MATRIX_DMA_SCAN_RATE_HZ * NUM_ROWS);
+    timer_set_mode(SCAN_TIMER, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(SCAN_TIMER, 0);
+    timer_set_period(SCAN_TIMER, period - 1);
+    timer_set_oc_value(SCAN_TIMER, TIM_OC1, period / 2);
+    timer_enable_irq(SCAN_TIMER, TIM_DIER_UDE | TIM_DIER_CC1DE);
+}
+
+static void start_scan_dma(void) {
+    // both channels start over at row 0 of the first frame
+    dma_set_number_of_data(DMA1, ROW_DMA_CHANNEL, NUM_ROWS);
+    dma_enable_channel(DMA1, ROW_DMA_CHANNEL);
+    dma_set_number_of_data(DMA1, COL_DMA_CHANNEL, 2 * NUM_ROWS);
+    dma_enable_channel(DMA1, COL_DMA_CHANNEL);
+
+    // the initial update event drives the first row, so that the first sample lines up with it
+    timer_generate_event(SCAN_TIMER, TIM_EGR_UG);
+    timer_enable_counter(SCAN_TIMER);
+}
+
+static void stop_scan_dma(void) {
+    timer_disable_counter(SCAN_TIMER);
+    dma_disable_channel(DMA1, ROW_DMA_CHANNEL);
+    dma_disable_channel(DMA1, COL_DMA_CHANNEL);
+    gpio_clear(ROW_GPIO_PORT, ROW_PINS);
+}
+#endif
+
+void matrix_init(void) {
+    rcc_periph_clock_enable(RCC_GPIOA);
+    rcc_periph_clock_enable(RCC_GPIOB);
+
+    // Set rows as outputs, no row is driven between scans
+    gpio_mode_setup(ROW_GPIO_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, ROW_PINS);
+    gpio_set_output_options(ROW_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_LOW, ROW_PINS);
+    gpio_clear(ROW_GPIO_PORT, ROW_PINS);
+
+    // Set columns as inputs
+    gpio_mode_setup(COL_GPIO_PORT, GPIO_MODE_INPUT, GPIO_PUPD_NONE, COL_PINS);
+
+    // route the columns to the EXTI lines used to wake up from matrix_sleep(), left disarmed while scanning
+    rcc_periph_clock_enable(RCC_SYSCFG_COMP);
+    exti_select_source(COL_EXTI_LINES, COL_GPIO_PORT);
+    exti_set_trigger(COL_EXTI_LINES, EXTI_TRIGGER_RISING);
+
+#if MATRIX_SCAN_DMA
+    setup_scan_dma();
+    start_scan_dma();
+#endif
+}
+
+bool matrix_sleep(void) {
+#if MATRIX_SCAN_DMA
+    stop_scan_dma();
+#endif
+
+    // with every row driven, pressing any key raises its column
+    gpio_set(ROW_GPIO_PORT, ROW_PINS);
+    row_settle_delay();
+
+    exti_reset_request(COL_EXTI_LINES);
+    exti_enable_request(COL_EXTI_LINES);
+    for (size_t i = 0; i < sizeof(matrix_exti_irqs); i++) {
+        nvic_clear_pending_irq(matrix_exti_irqs[i]);
+        nvic_enable_irq(matrix_exti_irqs[i]);
+    }
+
+    // a key that went down before the lines were armed has no edge left to catch
+    if (gpio_port_read(COL_GPIO_PORT) & COL_PINS) {
+        matrix_wake();
+        return false;
+    }
+    return true;
+}
+
+void matrix_wake(void) {
+    for (size_t i = 0; i < sizeof(matrix_exti_irqs); i++) {
+        nvic_disable_irq(matrix_exti_irqs[i]);
+    }
+    exti_disable_request(COL_EXTI_LINES);
+    exti_reset_request(COL_EXTI_LINES);
+
+    gpio_clear(ROW_GPIO_PORT, ROW_PINS);
+
+#if MATRIX_SCAN_DMA
+    // fill both frames by hand, so the first matrix_scan() already sees the key that caused the wake up
+    uint16_t matrix[NUM_ROWS];
+    scan_rows(matrix);
+    for (uint16_t row = 0; row < NUM_ROWS; row++) {
+        matrix_frames[0][row] = matrix[row] << COL_START_PIN;
+        matrix_frames[1][row] = matrix[row] << COL_START_PIN;
+    }
+    start_scan_dma();
+#endif
+}
+
+// the wake up is handled by the main loop, which disarms the lines before unmasking interrupts - these only clear
+// the lines in case an edge is ever taken as an interrupt
+void exti0_1_isr(void) {
+    exti_reset_request(COL_EXTI_LINES & (EXTI0 | EXTI1));
+}
+
+void exti2_3_isr(void) {
+    exti_reset_request(COL_EXTI_LINES & (EXTI2 | EXTI3));
+}
+
+void exti4_15_isr(void) {
+    exti_reset_request(COL_EXTI_LINES & ~(EXTI0 | EXTI1 | EXTI2 | EXTI3));
+}
+
+#if MATRIX_SCAN_DMA
+RAMFUNC void matrix_scan(uint16_t matrix[NUM_ROWS]) {
+    // the DMA counts down from two frames, so more than one frame left means it is filling the first one
+    bool filling_first;
+    do {
+        filling_first = dma_get_number_of_data(DMA1, COL_DMA_CHANNEL) > NUM_ROWS;
+        volatile uint16_t *frame = matrix_frames[filling_first ? 1 : 0];
+        for (uint16_t row = 0; row < NUM_ROWS; row++) {
+            matrix[row] = frame[row] >> COL_START_PIN;
+        }
+
+        // retry if the DMA moved on to the frame being copied
+    } while (filling_first != (dma_get_number_of_data(DMA1, COL_DMA_CHANNEL) > NUM_ROWS));
+}
+#else
+RAMFUNC void matrix_scan(uint16_t matrix[NUM_ROWS]) {
+    scan_rows(matrix);
+}
+#endif
@@ -0,0 +1,100 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "trace.h"
+#include "latency.h"
+
+#include <string.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+
+#if (TRACE_BUFFER_SIZE & TRACE_BUFFER_MASK) != 0
+#error "TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+#if TRACE_EVENTS
+static struct trace_entry trace_buffer[TRACE_BUFFER_SIZE];
+
+// sequence number of the next event, its slot is the oldest one kept once the buffer has filled up
+static uint32_t trace_head = 0;
+
+void trace_record(enum trace_event event, uint8_t arg, uint16_t value) {
+    uint32_t time_us = latency_now_us();
+
+    // recorded from the scan and USB interrupts as well as the main loop - the M0 has no exclusive accesses, so the
+    // slot is claimed and filled in with interrupts masked, which is shorter than working around a torn entry
+    uint32_t masked = cm_mask_interrupts(1);
+    struct trace_entry *entry = &trace_buffer[trace_head & TRACE_BUFFER_MASK];
+    entry->time_us = time_us;
+    entry->event = event;
+    entry->arg = arg;
+    entry->value = value;
+    trace_head++;
+    cm_mask_interrupts(masked);
+}
+
+void trace_clear(void) {
+    cm_disable_interrupts();
+    memset(trace_buffer, 0, sizeof(trace_buffer));
+    trace_head = 0;
+    cm_enable_interrupts();
+}
+
+uint32_t trace_next_sequence(void) {
+    return trace_head;
+}
+
+uint8_t trace_read(uint32_t *sequence, struct trace_entry *entries, uint8_t max_entries) {
+    cm_disable_interrupts();
+
+    uint32_t oldest = (trace_head > TRACE_BUFFER_SIZE) ? (trace_head - TRACE_BUFFER_SIZE) : 0;
+    if (*sequence < oldest) {
+        *sequence = oldest;
+    }
+
+    uint8_t count = 0;
+    for (uint32_t i = *sequence; (i < trace_head) && (count < max_entries); i++) {
+        entries[count++] = trace_buffer[i & TRACE_BUFFER_MASK];
+    }
+
+    cm_enable_interrupts();
+    return count;
+}
+#else
+// nothing is ever recorded, and the buffer takes no RAM
+void trace_clear(void) {
+}
+
+uint32_t trace_next_sequence(void) {
+    return 0;
+}
+
+uint8_t trace_read(uint32_t *sequence, struct trace_entry *entries, uint8_t max_entries) {
+    (void)entries;
+    (void)max_entries;
+    *sequence = 0;
+    return 0;
+}
+#endif
@@ -23,25 +23,46 @@
  */
 
 #include "usb_hid.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "trace.h"
 
 #include <stddef.h>
 #include <string.h>
 
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/st_usbfs.h>
 #include <libopencm3/usb/hid.h>
 #include <libopencm3/usb/usbd.h>
 
-#define USB_HID_REPORT_DESC_SIZE 62
+#define USB_HID_REPORT_DESC_SIZE 53
 #define USB_HID_DT_HID_SIZE 0x09
 #define USB_HID_CONFIG_TOTAL_SIZE (             \
           USB_DT_CONFIGURATION_SIZE             \
         + USB_DT_INTERFACE_SIZE                 \
         + sizeof(struct usb_hid_descriptor_full)\
-        + USB_DT_ENDPOINT_SIZE )                \
+        + USB_DT_ENDPOINT_SIZE                  \
+        + USB_DT_INTERFACE_SIZE                 \
+        + sizeof(struct usb_hid_descriptor_full)\
+        + 2 * USB_DT_ENDPOINT_SIZE )            \
+
+#define NUM_USB_STRINGS 6
+
+#define USB_HID_KEYBOARD_INTERFACE 0
+#define USB_HID_CONFIG_INTERFACE 1
+
+// reports waiting for the IN endpoint, must be a power of two
+#define USB_HID_REPORT_QUEUE_SIZE 8
+#define USB_HID_REPORT_QUEUE_MASK (USB_HID_REPORT_QUEUE_SIZE - 1)
+#define USB_HID_MAX_REPORT_SIZE sizeof(struct usb_hid_nkro_report)
 
-#define NUM_USB_STRINGS 5
+// below the scan (SysTick), so a long control transfer never delays a scan
+#define USB_HID_IRQ_PRIORITY 0x40
+
+// remote wakeup signalling must last 1-15ms (USB 2.0 7.1.7.7), leave room for the 2ms update granularity
+#define USB_HID_RESUME_SIGNAL_MS 10
 
 const struct usb_device_descriptor usb_device_desc = {
     .bLength = USB_DT_DEVICE_SIZE,
@@ -60,6 +81,7 @@ const struct usb_device_descriptor usb_device_desc = {
     .bNumConfigurations = 1,
 };
 
+// NKRO report used in report protocol, see struct usb_hid_nkro_report (the boot protocol report is fixed by the spec)
 static uint8_t usb_hid_report_desc[USB_HID_REPORT_DESC_SIZE] __attribute__((packed)) = {
     0x05, 0x01,        // USAGE_PAGE (Generic Desktop)
     0x09, 0x06,        // USAGE (Keyboard)
@@ -72,9 +94,6 @@ static uint8_t usb_hid_report_desc[USB_HID_REPORT_DESC_SIZE] __attribute__((pack
     0x75, 0x01,        //   REPORT_SIZE (1)
     0x95, 0x08,        //   REPORT_COUNT (8)
     0x81, 0x02,        //   INPUT (Data,Var,Abs)
-    0x95, 0x01,        //   REPORT_COUNT (1)
-    0x75, 0x08,        //   REPORT_SIZE (8)
-    0x81, 0x01,        //   INPUT (Cnst,Ary,Abs)
     0x05, 0x08,        //   USAGE_PAGE (LEDs)
     0x19, 0x01,        //   USAGE_MINIMUM (Num Lock)
     0x29, 0x03,        //   USAGE_MAXIMUM (Scroll Lock)
@@ -86,11 +105,30 @@ static uint8_t usb_hid_report_desc[USB_HID_REPORT_DESC_SIZE] __attribute__((pack
     0x91, 0x01,        //   OUTPUT (Cnst,Ary,Abs)
     0x05, 0x07,        //   USAGE_PAGE (Keyboard)
     0x19, 0x00,        //   USAGE_MINIMUM (Reserved (no event indicated))
-    0x29, 0x65,        //   USAGE_MAXIMUM (Keyboard Application)
+    0x29, 0xdf,        //   USAGE_MAXIMUM (0xdf, last usage before the modifiers)
+    0x75, 0x01,        //   REPORT_SIZE (1)
+    0x95, 0xe0,        //   REPORT_COUNT (224)
+    0x81, 0x02,        //   INPUT (Data,Var,Abs)
+    0xc0               // END_COLLECTION
+};
+
+// vendor defined reports of the config interface, USB_HID_CONFIG_REPORT_SIZE bytes each way
+static uint8_t usb_hid_config_report_desc[] = {
+    0x06, 0x60, 0xff,  // USAGE_PAGE (Vendor Defined 0xFF60)
+    0x09, 0x61,        // USAGE (0x61)
+    0xa1, 0x01,        // COLLECTION (Application)
+    0x09, 0x62,        //   USAGE (0x62)
+    0x15, 0x00,        //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,  //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,        //   REPORT_SIZE (8)
+    0x95, USB_HID_CONFIG_REPORT_SIZE,  //   REPORT_COUNT (32)
+    0x81, 0x02,        //   INPUT (Data,Var,Abs)
+    0x09, 0x63,        //   USAGE (0x63)
+    0x15, 0x00,        //   LOGICAL_MINIMUM (0)
     0x26, 0xff, 0x00,  //   LOGICAL_MAXIMUM (255)
     0x75, 0x08,        //   REPORT_SIZE (8)
-    0x95, 0x06,        //   REPORT_COUNT (6)
-    0x81, 0x00,        //   INPUT (Data,Ary,Abs)
+    0x95, USB_HID_CONFIG_REPORT_SIZE,  //   REPORT_COUNT (32)
+    0x91, 0x02,        //   OUTPUT (Data,Var,Abs)
     0xc0               // END_COLLECTION
 };
 
@@ -112,23 +150,55 @@ const struct usb_hid_descriptor_full usb_hid_desc = {
     .wDescriptorLength = USB_HID_REPORT_DESC_SIZE,
 };
 
+const struct usb_hid_descriptor_full usb_hid_config_desc = {
+    .head = {
+        .bLength = USB_HID_DT_HID_SIZE,
+        .bDescriptorType = USB_HID_DT_HID,
+        .bcdHID = 0x0111,
+        .bCountryCode = 0,
+        .bNumDescriptors = 1,
+    },
+    .bDescriptorType = USB_HID_DT_REPORT,
+    .wDescriptorLength = sizeof(usb_hid_config_report_desc),
+};
+
 const struct usb_endpoint_descriptor usb_endpoint_desc = {
     .bLength = USB_DT_ENDPOINT_SIZE,
     .bDescriptorType = USB_DT_ENDPOINT,
     .bEndpointAddress = USB_ENDPOINT_ADDR_IN(1),
     .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
-    .wMaxPacketSize = 0x0008,
-    .bInterval = 2,  // 2ms - 500Hz
+    .wMaxPacketSize = 0x0020,  // large enough for the NKRO report
+    .bInterval = KEYBOARD_POLL_INTERVAL_MS,  // once per scan, 2ms (500Hz) or 1ms (1000Hz)
+};
+
+// config traffic has endpoints of its own, so it never holds up a keyboard report
+const struct usb_endpoint_descriptor usb_config_endpoint_descs[] = {
+    {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_ADDR_IN(2),
+        .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+        .wMaxPacketSize = USB_HID_CONFIG_REPORT_SIZE,
+        .bInterval = 1,
+    },
+    {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_ADDR_OUT(2),
+        .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+        .wMaxPacketSize = USB_HID_CONFIG_REPORT_SIZE,
+        .bInterval = 1,
+    },
 };
 
 const struct usb_interface_descriptor usb_iface_desc = {
     .bLength = USB_DT_INTERFACE_SIZE,
     .bDescriptorType = USB_DT_INTERFACE,
-    .bInterfaceNumber = 0,
+    .bInterfaceNumber = USB_HID_KEYBOARD_INTERFACE,
     .bAlternateSetting = 0,
     .bNumEndpoints = 1,
     .bInterfaceClass = USB_CLASS_HID,
-    .bInterfaceSubClass = USB_HID_SUBCLASS_NO,
+    .bInterfaceSubClass = USB_HID_SUBCLASS_BOOT_INTERFACE,  // lets the BIOS select the boot protocol
     .bInterfaceProtocol = USB_HID_INTERFACE_PROTOCOL_KEYBOARD,
     .iInterface = 5,
 
@@ -140,23 +210,46 @@ const struct usb_interface_descriptor usb_iface_desc = {
     .extralen = sizeof(usb_hid_desc),
 };
 
-const struct usb_interface usb_iface = {
-    .num_altsetting = 1,
-    .altsetting = &usb_iface_desc,
+const struct usb_interface_descriptor usb_config_iface_desc = {
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = USB_HID_CONFIG_INTERFACE,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 2,
+    .bInterfaceClass = USB_CLASS_HID,
+    .bInterfaceSubClass = 0,
+    .bInterfaceProtocol = 0,
+    .iInterface = 6,
+
+    .endpoint = usb_config_endpoint_descs,
+
+    .extra = &usb_hid_config_desc,
+    .extralen = sizeof(usb_hid_config_desc),
+};
+
+const struct usb_interface usb_ifaces[] = {
+    {
+        .num_altsetting = 1,
+        .altsetting = &usb_iface_desc,
+    },
+    {
+        .num_altsetting = 1,
+        .altsetting = &usb_config_iface_desc,
+    },
 };
 
 const struct usb_config_descriptor usb_config_desc = {
     .bLength = USB_DT_CONFIGURATION_SIZE,
     .bDescriptorType = USB_DT_CONFIGURATION,
     .wTotalLength = USB_HID_CONFIG_TOTAL_SIZE,
-    .bNumInterfaces = 1,
+    .bNumInterfaces = 2,
     .bConfigurationValue = 1,
     .iConfiguration = 4,
     .bmAttributes = USB_CONFIG_ATTR_DEFAULT | USB_CONFIG_ATTR_REMOTE_WAKEUP,
     .bMaxPower = 50,  // 100mA
 
-    // reference the above interface
-    .interface = &usb_iface
+    // reference the above interfaces
+    .interface = usb_ifaces
 };
 
 const char *usb_strings[NUM_USB_STRINGS] = {
@@ -165,44 +258,110 @@ const char *usb_strings[NUM_USB_STRINGS] = {
     "rev3",
     "Keyboard Configuration",
     "Keyboard Interface",
+    "Keyboard Config Interface",
 };
 
 static usbd_device *usb_dev;
 
 static uint8_t usb_control_buf[128];
 
-static bool usb_control_data_available = false;
-static bool usb_ep_data_available = false;
-static uint8_t usb_control_rx_data;
-static uint8_t usb_ep_rx_data[4];
+// written by the control callbacks in the USB interrupt, read by the main loop
+static volatile bool usb_control_data_available = false;
+static volatile uint8_t usb_control_rx_data;
 
-static enum usbd_request_return_codes usb_hid_control_cb(usbd_device *usbd_dev, struct usb_setup_data *req,
+struct usb_hid_queued_report {
+    uint8_t len;
+    uint8_t data[USB_HID_MAX_REPORT_SIZE];
+    bool stamped;
+    uint32_t change_ms;  // scan time of the oldest key change in it, if stamped
+};
+
+// reports are sent in order from the IN complete callback, the endpoint holds at most one of them at a time
+static struct usb_hid_queued_report usb_hid_report_queue[USB_HID_REPORT_QUEUE_SIZE];
+static uint8_t usb_hid_report_queue_head = 0;
+static volatile uint8_t usb_hid_report_queue_tail = 0;  // advanced by the USB interrupt
+static bool usb_hid_ep_busy = false;
+static uint32_t usb_hid_report_overflows = 0;
+
+// stamp for the next queued report, and the one of the report in the endpoint - for the end-to-end latency probe
+static bool usb_hid_next_stamped = false;
+static uint32_t usb_hid_next_change_ms = 0;
+static bool usb_hid_in_flight_stamped = false;
+static uint32_t usb_hid_in_flight_change_ms = 0;
+
+// queue index of the report in the endpoint, which numbers it in the trace
+static uint8_t usb_hid_in_flight_report = 0;
+
+// config request received by the USB interrupt, the OUT endpoint NAKs further ones until the response is sent
+static uint8_t usb_hid_config_request[USB_HID_CONFIG_REPORT_SIZE];
+static volatile bool usb_hid_config_request_available = false;
+static volatile bool usb_hid_config_busy = false;
+
+// bus state, kept by the USB interrupt
+static volatile bool usb_hid_suspended = false;
+static volatile bool usb_hid_remote_wakeup_enabled = false;
+
+// remote wakeup signalling, run from the main loop
+static bool usb_hid_wakeup_sent = false;
+static bool usb_hid_resume_signalling = false;
+static uint32_t usb_hid_resume_start_ms = 0;
+
+// frame the last report went out in, the host polls the keyboard endpoint every bInterval frames from there
+static volatile uint16_t usb_hid_in_frame = 0;
+
+// hosts start in report protocol, a BIOS switches to boot protocol with Set_Protocol
+static volatile enum usb_hid_protocol usb_hid_protocol = USB_HID_PROTOCOL_REPORT;
+
+static enum usbd_request_return_codes usb_hid_descriptor_cb(usbd_device *usbd_dev, struct usb_setup_data *req,
     uint8_t **buf, uint16_t *len, usbd_control_complete_callback *complete) {
-    
-    // respond to the HID report descriptor request
-    if (
-        (req->bmRequestType & (USB_REQ_TYPE_DIRECTION | USB_HID_REQ_TYPE_GET_REPORT)) &&
-        (req->bRequest == USB_REQ_GET_DESCRIPTOR) &&
-        (req->wValue = USB_HID_DT_REPORT << 8)
-    ) {
-        *buf = usb_hid_report_desc;
-        *len = USB_HID_REPORT_DESC_SIZE;
+
+    // respond to the HID report descriptor requests, leave every other standard request to libopencm3
+    if ((req->bRequest == USB_REQ_GET_DESCRIPTOR) && (req->wValue == USB_HID_DT_REPORT << 8)) {
+        if (req->wIndex == USB_HID_CONFIG_INTERFACE) {
+            *buf = usb_hid_config_report_desc;
+            *len = sizeof(usb_hid_config_report_desc);
+        } else {
+            *buf = usb_hid_report_desc;
+            *len = USB_HID_REPORT_DESC_SIZE;
+        }
 
         return USBD_REQ_HANDLED;
     }
-    
-    // process Set_Report request (used for setting LED state)
-    if (
-        (req->bmRequestType & (USB_REQ_TYPE_CLASS | USB_HID_REQ_TYPE_GET_REPORT)) &&
-        (req->bRequest == USB_HID_REQ_TYPE_SET_REPORT)
-    ) {
-        // TODO: make this more dynamic
-        if (req->wValue == 0x0200) {
-            // LED data
-            usb_control_data_available = true;
-            usb_control_rx_data = **buf;
+
+    (void)usbd_dev;
+    (void)complete;
+
+    return USBD_REQ_NEXT_CALLBACK;
+}
+
+static enum usbd_request_return_codes usb_hid_control_cb(usbd_device *usbd_dev, struct usb_setup_data *req,
+    uint8_t **buf, uint16_t *len, usbd_control_complete_callback *complete) {
+
+    // the config interface only uses its endpoints
+    if (req->wIndex != USB_HID_KEYBOARD_INTERFACE) {
+        return USBD_REQ_NOTSUPP;
+    }
+
+    switch (req->bRequest) {
+        case USB_HID_REQ_TYPE_SET_REPORT:
+            // TODO: make this more dynamic
+            if (req->wValue == 0x0200) {
+                // LED data
+                usb_control_data_available = true;
+                usb_control_rx_data = **buf;
+                trace_record(TRACE_EVENT_LEDS, usb_control_rx_data, 0);
+                return USBD_REQ_HANDLED;
+            }
+            break;
+        case USB_HID_REQ_TYPE_GET_PROTOCOL:
+            (*buf)[0] = usb_hid_protocol;
+            *len = 1;
             return USBD_REQ_HANDLED;
-        }
+        case USB_HID_REQ_TYPE_SET_PROTOCOL:
+            usb_hid_protocol = (req->wValue == USB_HID_PROTOCOL_BOOT) ? USB_HID_PROTOCOL_BOOT : USB_HID_PROTOCOL_REPORT;
+            return USBD_REQ_HANDLED;
+        default:
+            break;
     }
 
     (void)usbd_dev;
@@ -211,20 +370,198 @@ static enum usbd_request_return_codes usb_hid_control_cb(usbd_device *usbd_dev,
     return USBD_REQ_NOTSUPP;
 }
 
+static enum usbd_request_return_codes usb_hid_device_feature_cb(usbd_device *usbd_dev, struct usb_setup_data *req,
+    uint8_t **buf, uint16_t *len, usbd_control_complete_callback *complete) {
+
+    // libopencm3 STALLs Set_Feature/Clear_Feature(DEVICE_REMOTE_WAKEUP) and never reports the feature in Get_Status,
+    // so answer both here and leave the other device requests to it
+    switch (req->bRequest) {
+        case USB_REQ_SET_FEATURE:
+        case USB_REQ_CLEAR_FEATURE:
+            if (req->wValue == USB_FEAT_DEVICE_REMOTE_WAKEUP) {
+                usb_hid_remote_wakeup_enabled = (req->bRequest == USB_REQ_SET_FEATURE);
+                return USBD_REQ_HANDLED;
+            }
+            break;
+        case USB_REQ_GET_STATUS:
+            // bus powered, bit 1 is remote wakeup
+            (*buf)[0] = usb_hid_remote_wakeup_enabled ? 0x02 : 0x00;
+            (*buf)[1] = 0;
+            *len = 2;
+            return USBD_REQ_HANDLED;
+        default:
+            break;
+    }
+
+    (void)usbd_dev;
+    (void)complete;
+
+    return USBD_REQ_NEXT_CALLBACK;
+}
+
+static void usb_hid_suspend_cb(void) {
+    usb_hid_suspended = true;
+    *USB_CNTR_REG |= USB_CNTR_FSUSP;
+}
+
+static void usb_hid_resume_cb(void) {
+    *USB_CNTR_REG &= ~USB_CNTR_FSUSP;
+    usb_hid_suspended = false;
+    usb_hid_wakeup_sent = false;
+}
+
+static void usb_hid_reset_cb(void) {
+    usb_hid_suspended = false;
+    usb_hid_remote_wakeup_enabled = false;
+    usb_hid_wakeup_sent = false;
+}
+
+static void usb_hid_report_queue_reset(void) {
+    usb_hid_report_queue_head = 0;
+    usb_hid_report_queue_tail = 0;
+    usb_hid_ep_busy = false;
+    usb_hid_in_flight_stamped = false;
+}
+
+// hand the oldest queued report to the endpoint if it is free
+static void usb_hid_send_next(void) {
+    if (usb_hid_ep_busy || (usb_hid_report_queue_tail == usb_hid_report_queue_head)) {
+        return;
+    }
+
+    struct usb_hid_queued_report *report = &usb_hid_report_queue[usb_hid_report_queue_tail & USB_HID_REPORT_QUEUE_MASK];
+    if (usbd_ep_write_packet(usb_dev, usb_endpoint_desc.bEndpointAddress, report->data, report->len) == 0) {
+        // endpoint still busy, the IN complete callback tries again
+        usb_hid_ep_busy = true;
+        return;
+    }
+
+    usb_hid_in_flight_stamped = report->stamped;
+    usb_hid_in_flight_change_ms = report->change_ms;
+    usb_hid_in_flight_report = usb_hid_report_queue_tail;
+    usb_hid_report_queue_tail++;
+    usb_hid_ep_busy = true;
+}
+
+// queue a report, or with merge set let it replace the newest queued one if that one is still waiting for the
+// endpoint - returns true if it did
+static bool usb_hid_queue_report(const void *data, uint8_t len, bool merge) {
+    uint32_t probe_start = latency_start();
+
+    // the IN complete callback takes reports off the queue from the USB interrupt
+    nvic_disable_irq(NVIC_USB_IRQ);
+
+    bool stamped = usb_hid_next_stamped;
+    uint32_t change_ms = usb_hid_next_change_ms;
+    usb_hid_next_stamped = false;
+
+    uint8_t queued = usb_hid_report_queue_head - usb_hid_report_queue_tail;
+    struct usb_hid_queued_report *newest =
+        &usb_hid_report_queue[(uint8_t)(usb_hid_report_queue_head - 1) & USB_HID_REPORT_QUEUE_MASK];
+    merge = merge && queued && (newest->len == len);
+    if (merge) {
+        // goes out as early as the report it replaces would have, with the changes of both
+        memcpy(newest->data, data, len);
+        if (!newest->stamped) {
+            newest->stamped = stamped;
+            newest->change_ms = change_ms;
+        }
+        trace_record(TRACE_EVENT_REPORT_MERGED, len, (uint8_t)(usb_hid_report_queue_head - 1));
+    } else {
+        if (queued == USB_HID_REPORT_QUEUE_SIZE) {
+            // no room - the newest queued report is overwritten, so the host still ends up with the latest state.
+            // The changes it carried go out with this one, as late as it does.
+            usb_hid_report_overflows++;
+            usb_hid_report_queue_head--;
+            trace_record(TRACE_EVENT_OVERFLOW, TRACE_OVERFLOW_REPORT_QUEUE, usb_hid_report_queue_head);
+            if (newest->stamped) {
+                stamped = true;
+                change_ms = newest->change_ms;
+            }
+        }
+
+        struct usb_hid_queued_report *report =
+            &usb_hid_report_queue[usb_hid_report_queue_head & USB_HID_REPORT_QUEUE_MASK];
+        memcpy(report->data, data, len);
+        report->len = len;
+        report->stamped = stamped;
+        report->change_ms = change_ms;
+        trace_record(TRACE_EVENT_REPORT, len, usb_hid_report_queue_head);
+        usb_hid_report_queue_head++;
+
+        usb_hid_send_next();
+    }
+
+    nvic_enable_irq(NVIC_USB_IRQ);
+    latency_end(LATENCY_PROBE_SEND, probe_start);
+    return merge;
+}
+
 static void usb_hid_ep_cb(usbd_device *usbd_dev, uint8_t ep) {
-    uint16_t rx_bytes = usbd_ep_read_packet(usbd_dev, ep, usb_ep_rx_data, sizeof(usb_ep_rx_data));
-    if (rx_bytes == sizeof(usb_ep_rx_data)) {
-        usb_ep_data_available = true;
+    // the previous report reached the host
+    usb_hid_in_frame = *USB_FNR_REG & USB_FNR_FN;
+    trace_record(TRACE_EVENT_REPORT_SENT, 0, usb_hid_in_flight_report);
+    if (usb_hid_in_flight_stamped) {
+        latency_record(LATENCY_PROBE_END_TO_END, latency_now_us() - (usb_hid_in_flight_change_ms * 1000));
+        usb_hid_in_flight_stamped = false;
     }
+    usb_hid_ep_busy = false;
+    usb_hid_send_next();
+
+    (void)usbd_dev;
+    (void)ep;
+}
+
+static void usb_hid_sof_cb(void) {
+    // until a report has gone out the frames the host polls in are a guess, the scan moves over once one has
+    uint16_t frame = *USB_FNR_REG & USB_FNR_FN;
+    if (((uint16_t)(frame - usb_hid_in_frame) % usb_endpoint_desc.bInterval) == 0) {
+        keyboard_sof();
+    }
+}
+
+static void usb_hid_config_out_cb(usbd_device *usbd_dev, uint8_t ep) {
+    // hold off the next request until the main loop has answered this one
+    usbd_ep_nak_set(usbd_dev, ep, 1);
+    memset(usb_hid_config_request, 0, sizeof(usb_hid_config_request));
+    usbd_ep_read_packet(usbd_dev, ep, usb_hid_config_request, sizeof(usb_hid_config_request));
+    usb_hid_config_request_available = true;
+    usb_hid_config_busy = true;
+}
+
+static void usb_hid_config_in_cb(usbd_device *usbd_dev, uint8_t ep) {
+    // the response reached the host, take the next request
+    usb_hid_config_busy = false;
+    usbd_ep_nak_set(usbd_dev, usb_config_endpoint_descs[1].bEndpointAddress, 0);
+
+    (void)ep;
 }
 
 static void usb_set_config(usbd_device *dev, uint16_t wValue) {
     // setup the keyboard configuration regardless of wValue (since it's the only one)
     usbd_ep_setup(dev, usb_endpoint_desc.bEndpointAddress, usb_endpoint_desc.bmAttributes,
         usb_endpoint_desc.wMaxPacketSize, usb_hid_ep_cb);
+    for (size_t i = 0; i < sizeof(usb_config_endpoint_descs) / sizeof(usb_config_endpoint_descs[0]); i++) {
+        const struct usb_endpoint_descriptor *ep = &usb_config_endpoint_descs[i];
+        usbd_ep_setup(dev, ep->bEndpointAddress, ep->bmAttributes, ep->wMaxPacketSize,
+            (ep->bEndpointAddress & 0x80) ? usb_hid_config_in_cb : usb_hid_config_out_cb);
+    }
 
-    // setup an HID control callback that responds to any control request
-    usbd_register_control_callback(dev, 0, 0, usb_hid_control_cb);
+    // every configuration starts out in report protocol, with nothing left over from before
+    usb_hid_protocol = USB_HID_PROTOCOL_REPORT;
+    usb_hid_report_queue_reset();
+    usb_hid_config_request_available = false;
+    usb_hid_config_busy = false;
+
+    // setup HID callbacks for the report descriptor request and for the HID class requests
+    usbd_register_control_callback(dev, USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE,
+        USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, usb_hid_descriptor_cb);
+    usbd_register_control_callback(dev, USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+        USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, usb_hid_control_cb);
+
+    // Set_Feature/Clear_Feature(DEVICE_REMOTE_WAKEUP) and Get_Status of the device
+    usbd_register_control_callback(dev, USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE,
+        USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, usb_hid_device_feature_cb);
 
     (void)wValue;
 }
@@ -239,19 +576,119 @@ void usb_hid_init(void) {
     usb_dev = usbd_init(&st_usbfs_v2_usb_driver, &usb_device_desc, &usb_config_desc, usb_strings,
         NUM_USB_STRINGS, usb_control_buf, sizeof(usb_control_buf));
     usbd_register_set_config_callback(usb_dev, usb_set_config);
+    usbd_register_reset_callback(usb_dev, usb_hid_reset_cb);
+    usbd_register_suspend_callback(usb_dev, usb_hid_suspend_cb);
+    usbd_register_resume_callback(usb_dev, usb_hid_resume_cb);
+
+    usb_hid_report_queue_reset();
+    usb_hid_suspended = false;
+    usb_hid_remote_wakeup_enabled = false;
+    usb_hid_wakeup_sent = false;
+    usb_hid_resume_signalling = false;
+    usb_hid_report_overflows = 0;
+    usb_hid_in_frame = 0;
+
+    // the peripheral is serviced from its interrupt from here on
+    nvic_set_priority(NVIC_USB_IRQ, USB_HID_IRQ_PRIORITY);
+    nvic_enable_irq(NVIC_USB_IRQ);
 }
 
-void usb_hid_get_leds(struct usb_hid_report *report) {
+void usb_hid_get_leds(uint8_t *leds) {
     if (usb_control_data_available) {
         usb_control_data_available = false;
-        report->leds = usb_control_rx_data;
+        *leds = usb_control_rx_data;
+    }
+}
+
+bool usb_hid_leds_pending(void) {
+    return usb_control_data_available;
+}
+
+enum usb_hid_protocol usb_hid_get_protocol(void) {
+    return usb_hid_protocol;
+}
+
+void usb_hid_stamp_report(uint32_t change_ms) {
+    usb_hid_next_stamped = true;
+    usb_hid_next_change_ms = change_ms;
+}
+
+bool usb_hid_send_report(struct usb_hid_report *report, bool merge) {
+    return usb_hid_queue_report(report, sizeof(struct usb_hid_report), merge);
+}
+
+bool usb_hid_send_nkro_report(struct usb_hid_nkro_report *report, bool merge) {
+    return usb_hid_queue_report(report, sizeof(struct usb_hid_nkro_report), merge);
+}
+
+void usb_hid_update(uint32_t time_ms) {
+    // the CNTR bits are shared with the suspend and resume callbacks
+    nvic_disable_irq(NVIC_USB_IRQ);
+
+    if (usb_hid_resume_signalling) {
+        if (time_ms - usb_hid_resume_start_ms >= USB_HID_RESUME_SIGNAL_MS) {
+            *USB_CNTR_REG &= ~USB_CNTR_RESUME;
+            usb_hid_resume_signalling = false;
+        }
+    } else if (usb_hid_suspended && usb_hid_remote_wakeup_enabled && !usb_hid_wakeup_sent
+        && (usb_hid_ep_busy || (usb_hid_report_queue_head != usb_hid_report_queue_tail))) {
+        // a key changed while the host sleeps - wake it up, the report goes out once it resumes
+        *USB_CNTR_REG &= ~USB_CNTR_FSUSP;
+        *USB_CNTR_REG |= USB_CNTR_RESUME;
+        usb_hid_resume_start_ms = time_ms;
+        usb_hid_resume_signalling = true;
+        usb_hid_wakeup_sent = true;
+    }
+
+    nvic_enable_irq(NVIC_USB_IRQ);
+}
+
+bool usb_hid_config_request_pending(void) {
+    return usb_hid_config_request_available;
+}
+
+bool usb_hid_get_config_request(uint8_t *request) {
+    if (!usb_hid_config_request_available) {
+        return false;
     }
+
+    memcpy(request, usb_hid_config_request, USB_HID_CONFIG_REPORT_SIZE);
+    usb_hid_config_request_available = false;
+    return true;
+}
+
+void usb_hid_send_config_response(const uint8_t *response) {
+    nvic_disable_irq(NVIC_USB_IRQ);
+    usbd_ep_write_packet(usb_dev, usb_config_endpoint_descs[0].bEndpointAddress, response,
+        USB_HID_CONFIG_REPORT_SIZE);
+    nvic_enable_irq(NVIC_USB_IRQ);
+}
+
+void usb_hid_set_sof_enabled(bool enabled) {
+    nvic_disable_irq(NVIC_USB_IRQ);
+    usbd_register_sof_callback(usb_dev, enabled ? usb_hid_sof_cb : NULL);
+
+    // libopencm3 only sets the interrupt mask to match at the end of its next poll, which may be a while. A frame
+    // that started while the interrupt was off is long gone, don't let it through.
+    if (enabled) {
+        USB_CLR_ISTR_SOF();
+        *USB_CNTR_REG |= USB_CNTR_SOFM;
+    } else {
+        *USB_CNTR_REG &= ~USB_CNTR_SOFM;
+    }
+    nvic_enable_irq(NVIC_USB_IRQ);
+}
+
+bool usb_hid_reports_queued(void) {
+    return usb_hid_report_queue_head != usb_hid_report_queue_tail;
 }
 
-void usb_hid_send_report(struct usb_hid_report *report) {
-    usbd_ep_write_packet(usb_dev, usb_endpoint_desc.bEndpointAddress, report, sizeof(struct usb_hid_report));
+uint32_t usb_hid_get_report_overflows(void) {
+    return usb_hid_report_overflows;
 }
 
-void usb_hid_poll(void) {
+void usb_isr(void) {
+    uint32_t probe_start = latency_start();
     usbd_poll(usb_dev);
+    latency_end(LATENCY_PROBE_USB_ISR, probe_start);
 }
@@ -0,0 +1,339 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Cullen Jemison
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Key map compiler - turns a layout description into the built in layers, as a C table for keymap.c and as the
+ * image of the layers in the flash store (marker included), so both are the same down to the byte.
+ *
+ * The layout holds one block per layer, started by "layer <n>", with a line per matrix row and an entry per column,
+ * separated by spaces. '#' starts a comment. An entry is one of:
+ *
+ *   A, ESC, KP7, ...       the key code KEY_<name> from hid_codes.h
+ *   ___                    transparent, the next active layer below decides
+ *   MOD(LCTRL|LSHIFT)      modifiers, named like KEY_MOD_<name>
+ *   MO(n) TG(n) OSL(n)     layer n while held, toggled, for the next key
+ *   MACRO(n)               play macro n
+ *   MT(LCTRL,ESC)          key code on tap, modifiers on hold
+ *   LT(n,SPACE)            key code on tap, layer n on hold
+ *
+ * Layers missing from the layout are left transparent.
+ *
+ * Usage: keymapc <hid_codes.h> <layout> <header out> <image out>
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keymap.h"
+#include "macro.h"
+
+#define MAX_NAMES 256
+#define MAX_NAME_LEN 32
+#define MAX_LINE_LEN 512
+
+struct name {
+    char name[MAX_NAME_LEN];
+    unsigned int value;
+};
+
+// KEY_<name> and KEY_MOD_<name> definitions from hid_codes.h, without the prefixes
+static struct name key_names[MAX_NAMES];
+static int num_key_names = 0;
+static struct name mod_names[MAX_NAMES];
+static int num_mod_names = 0;
+
+static uint16_t layers[KEYMAP_NUM_LAYERS][NUM_ROWS][NUM_COLS];
+
+static const char *layout_path;
+static int layout_line;
+
+static void fail(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s:%d: ", layout_path, layout_line);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static void read_names(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), file)) {
+        char name[MAX_NAME_LEN];
+        unsigned int value;
+        if (sscanf(line, "#define KEY_%31s %i", name, &value) != 2) {
+            continue;
+        }
+
+        bool modifier = strncmp(name, "MOD_", 4) == 0;
+        struct name *names = modifier ? mod_names : key_names;
+        int *num_names = modifier ? &num_mod_names : &num_key_names;
+        if ((*num_names == MAX_NAMES) || (value > 0xff)) {
+            fprintf(stderr, "%s: unexpected KEY_%s\n", path, name);
+            exit(1);
+        }
+        strcpy(names[*num_names].name, modifier ? name + 4 : name);
+        names[*num_names].value = value;
+        (*num_names)++;
+    }
+    fclose(file);
+}
+
+static unsigned int lookup(const struct name *names, int num_names, const char *name, const char *kind) {
+    for (int i = 0; i < num_names; i++) {
+        if (strcmp(names[i].name, name) == 0) {
+            return names[i].value;
+        }
+    }
+    fail("unknown %s \"%s\"", kind, name);
+    return 0;
+}
+
+static uint8_t parse_key(const char *name) {
+    return lookup(key_names, num_key_names, name, "key");
+}
+
+// modifier names joined by '|'
+static uint8_t parse_modifiers(char *names) {
+    uint8_t mask = 0;
+    for (char *name = strtok(names, "|"); name; name = strtok(NULL, "|")) {
+        mask |= lookup(mod_names, num_mod_names, name, "modifier");
+    }
+    if (!mask) {
+        fail("no modifiers");
+    }
+    return mask;
+}
+
+static uint8_t parse_number(const char *text, unsigned int limit, const char *kind) {
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+    if ((*text == '\0') || (*end != '\0') || (value >= limit)) {
+        fail("invalid %s \"%s\"", kind, text);
+    }
+    return value;
+}
+
+static uint16_t parse_entry(char *entry) {
+    if (strcmp(entry, "___") == 0) {
+        return KEYMAP_TRANSPARENT;
+    }
+
+    // NAME(arg) or NAME(arg,arg)
+    char *open = strchr(entry, '(');
+    if (!open) {
+        return KEYMAP_ACTION(KEYMAP_ACTION_KEY, parse_key(entry));
+    }
+    size_t len = strlen(entry);
+    if (entry[len - 1] != ')') {
+        fail("missing ')' in \"%s\"", entry);
+    }
+    *open = '\0';
+    entry[len - 1] = '\0';
+    char *arg = open + 1;
+    char *arg2 = strchr(arg, ',');
+    if (arg2) {
+        *arg2++ = '\0';
+    }
+    bool two_args = (strcmp(entry, "MT") == 0) || (strcmp(entry, "LT") == 0);
+    if (two_args != (arg2 != NULL)) {
+        fail("wrong number of arguments to %s", entry);
+    }
+
+    if (strcmp(entry, "MOD") == 0) {
+        return MOD(parse_modifiers(arg));
+    } else if (strcmp(entry, "MO") == 0) {
+        return MO(parse_number(arg, KEYMAP_NUM_LAYERS, "layer"));
+    } else if (strcmp(entry, "TG") == 0) {
+        return TG(parse_number(arg, KEYMAP_NUM_LAYERS, "layer"));
+    } else if (strcmp(entry, "OSL") == 0) {
+        return OSL(parse_number(arg, KEYMAP_NUM_LAYERS, "layer"));
+    } else if (strcmp(entry, "MACRO") == 0) {
+        return MACRO(parse_number(arg, NUM_MACROS, "macro"));
+    } else if (strcmp(entry, "MT") == 0) {
+        uint8_t mask = parse_modifiers(arg);
+        if ((mask & 0x0f) && (mask & 0xf0)) {
+            fail("MT() takes the modifiers of one hand only");
+        }
+        return MT(mask, parse_key(arg2));
+    } else if (strcmp(entry, "LT") == 0) {
+        return LT(parse_number(arg, KEYMAP_NUM_LAYERS, "layer"), parse_key(arg2));
+    }
+    fail("unknown action %s", entry);
+    return 0;
+}
+
+static void read_layout(void) {
+    FILE *file = fopen(layout_path, "r");
+    if (!file) {
+        perror(layout_path);
+        exit(1);
+    }
+
+    for (int layer = 0; layer < KEYMAP_NUM_LAYERS; layer++) {
+        for (int row = 0; row < NUM_ROWS; row++) {
+            for (int col = 0; col < NUM_COLS; col++) {
+                layers[layer][row][col] = KEYMAP_TRANSPARENT;
+            }
+        }
+    }
+
+    bool seen[KEYMAP_NUM_LAYERS] = {false};
+    int layer = -1;
+    int row = NUM_ROWS;
+    char line[MAX_LINE_LEN];
+    layout_line = 0;
+    while (fgets(line, sizeof(line), file)) {
+        layout_line++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char *token = strtok(line, " \t\r\n");
+        if (!token) {
+            continue;
+        }
+
+        if (strcmp(token, "layer") == 0) {
+            if (row != NUM_ROWS) {
+                fail("layer %d has %d rows instead of %d", layer, row, NUM_ROWS);
+            }
+            char *number = strtok(NULL, " \t\r\n");
+            layer = parse_number(number ? number : "", KEYMAP_NUM_LAYERS, "layer");
+            if (seen[layer]) {
+                fail("layer %d given twice", layer);
+            }
+            seen[layer] = true;
+            row = 0;
+            continue;
+        }
+
+        if (row == NUM_ROWS) {
+            fail("more than %d rows", NUM_ROWS);
+        }
+        // strtok() is taken up by the entries, so split the row first
+        char *entries[NUM_COLS];
+        int col = 0;
+        for (; token; token = strtok(NULL, " \t\r\n")) {
+            if (col == NUM_COLS) {
+                fail("more than %d columns", NUM_COLS);
+            }
+            entries[col++] = token;
+        }
+        if (col != NUM_COLS) {
+            fail("%d columns instead of %d", col, NUM_COLS);
+        }
+        for (col = 0; col < NUM_COLS; col++) {
+            layers[layer][row][col] = parse_entry(entries[col]);
+        }
+        row++;
+    }
+    if (row != NUM_ROWS) {
+        fail("layer %d has %d rows instead of %d", layer, row, NUM_ROWS);
+    }
+    if (!seen[0]) {
+        fail("no layer 0");
+    }
+    fclose(file);
+}
+
+static void write_header(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(file, "// generated by keymapc from %s - edit that instead\n\n", layout_path);
+    fprintf(file, "static const uint16_t keymap_default_layers[KEYMAP_NUM_LAYERS][NUM_ROWS][NUM_COLS] = {\n");
+    for (int layer = 0; layer < KEYMAP_NUM_LAYERS; layer++) {
+        fprintf(file, "    {\n");
+        for (int row = 0; row < NUM_ROWS; row++) {
+            fprintf(file, "        {");
+            for (int col = 0; col < NUM_COLS; col++) {
+                fprintf(file, (col == 0) ? "0x%04x" : ", 0x%04x", layers[layer][row][col]);
+            }
+            fprintf(file, "},\n");
+        }
+        fprintf(file, "    },\n");
+    }
+    fprintf(file, "};\n");
+
+    if (fclose(file)) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static void put_u16(FILE *file, uint16_t value) {
+    fputc(value & 0xff, file);
+    fputc(value >> 8, file);
+}
+
+// what keymap_set() leaves in the flash store, little endian
+static void write_image(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    put_u16(file, KEYMAP_STORE_MAGIC);
+    for (int layer = 0; layer < KEYMAP_NUM_LAYERS; layer++) {
+        for (int row = 0; row < NUM_ROWS; row++) {
+            for (int col = 0; col < NUM_COLS; col++) {
+                put_u16(file, layers[layer][row][col]);
+            }
+        }
+    }
+
+    if (fclose(file)) {
+        perror(path);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s <hid_codes.h> <layout> <header out> <image out>\n", argv[0]);
+        return 1;
+    }
+
+    read_names(argv[1]);
+    layout_path = argv[2];
+    read_layout();
+    write_header(argv[3]);
+    write_image(argv[4]);
+    return 0;
+}
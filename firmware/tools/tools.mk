@@ -0,0 +1,34 @@
+# Key map compiler - a host tool that turns the layout description into the built in layers of keymap.c and into the
+# image of the layers in the flash store, build/gen/keymap_layers.bin. Build another layout with
+# 'make KEYMAP_LAYOUT=layouts/<name>.txt'.
+
+HOST_CC ?= cc
+
+KEYMAP_LAYOUT ?= layouts/default.txt
+
+TOOLS_DIR = tools
+TOOLS_BUILD_DIR = $(BUILD_DIR)/tools
+GEN_DIR = $(BUILD_DIR)/gen
+
+KEYMAPC = $(TOOLS_BUILD_DIR)/keymapc
+KEYMAP_HEADER = $(GEN_DIR)/keymap_layers.h
+KEYMAP_IMAGE = $(GEN_DIR)/keymap_layers.bin
+
+INCLUDES += -I$(GEN_DIR)
+
+$(KEYMAPC): $(TOOLS_DIR)/keymapc.c
+	@printf "  HOSTCC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(HOST_CC) -MD -O2 $(CSTD) -Wall -Wextra -Wundef -I$(INCLUDE_DIR) -o $@ $<
+
+# one run writes both, which a pattern rule with two targets tells make
+$(GEN_DIR)/%.h $(GEN_DIR)/%.bin: $(KEYMAP_LAYOUT) $(KEYMAPC) $(INCLUDE_DIR)/hid_codes.h
+	@printf "  KEYMAPC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(KEYMAPC) $(INCLUDE_DIR)/hid_codes.h $(KEYMAP_LAYOUT) $(GEN_DIR)/$*.h $(GEN_DIR)/$*.bin
+
+$(BUILD_DIR)/keymap.o: $(KEYMAP_HEADER)
+
+all: $(KEYMAP_IMAGE)
+
+-include $(KEYMAPC).d